@@ -33,6 +33,8 @@
 #include <vector>
 #include <map>
 
+#include <htslib/sam.h>
+
 #include "types.h"
 #include "string_database.h"
 #include "sequence_database.h"
@@ -100,6 +102,9 @@ namespace AlignmentDataMask
 
         // list of tags that we require
         READ_GROUP           = 0x1000,
+
+        // keep the raw htslib record for each read (host only, used to write alignments back out)
+        RECORD               = 0x2000,
     };
 }
 
@@ -177,6 +182,21 @@ struct alignment_batch_host : public alignment_batch_storage<host>
     // data that never gets copied to the device
     std::vector<std::string> name;          // read name
     resident_segment_map chromosome_map;    // map of chromosomes referenced by this batch
+    uint64 footprint_estimate;              // estimated pipeline working memory for this batch, in bytes (only computed under a memory budget)
+    uint64 batch_index;                     // position of this batch in the input stream
+    std::vector<bam1_t *> records;          // raw records (RECORD); may hold more entries than num_reads, as records are reused across batches
+
+    alignment_batch_host()
+        : batch_index(0)
+    { }
+
+    ~alignment_batch_host()
+    {
+        for(auto r : records)
+        {
+            bam_destroy1(r);
+        }
+    }
 
     const CRQ_index crq_index(uint32 read_id) const
     {
@@ -192,6 +212,7 @@ struct alignment_batch_host : public alignment_batch_storage<host>
     {
         num_reads = 0;
         max_read_size = 0;
+        footprint_estimate = 0;
         this->data_mask = data_mask;
 
         name.clear();
@@ -0,0 +1,114 @@
+/*
+ * Firepony
+ * Copyright (c) 2014-2015, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the NVIDIA CORPORATION nor the
+ *      names of its contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NVIDIA CORPORATION BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "alignment_writer.h"
+
+namespace firepony {
+
+alignment_writer::alignment_writer()
+    : fp(nullptr),
+      bam_header(nullptr),
+      next_batch(0),
+      num_reads(0)
+{
+}
+
+alignment_writer::~alignment_writer()
+{
+    close();
+}
+
+bool alignment_writer::open(const char *fname, const alignment_file& input, uint32 num_threads)
+{
+    fp = hts_open(fname, "wb");
+    if (fp == nullptr)
+    {
+        fprintf(stderr, "error opening %s\n", fname);
+        return false;
+    }
+
+    if (num_threads > 1)
+    {
+        // compress BGZF blocks on a pool of worker threads
+        hts_set_threads(fp, num_threads);
+    }
+
+    bam_header = input.get_bam_header();
+    if (sam_hdr_write(fp, bam_header) < 0)
+    {
+        fprintf(stderr, "error writing header to %s\n", fname);
+        return false;
+    }
+
+    return true;
+}
+
+void alignment_writer::close(void)
+{
+    if (fp)
+    {
+        hts_close(fp);
+        fp = nullptr;
+    }
+}
+
+void alignment_writer::write_batch(const alignment_batch_host *batch)
+{
+    // patch the qualities into the records before waiting for our turn
+    for(uint32 read_id = 0; read_id < batch->num_reads; read_id++)
+    {
+        bam1_t *record = batch->records[read_id];
+
+        if (uint32(record->core.l_qseq) == batch->qual_len[read_id])
+        {
+            memcpy(bam_get_qual(record), &batch->qualities[batch->qual_start[read_id]], batch->qual_len[read_id]);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(m);
+    while(next_batch != batch->batch_index)
+    {
+        cond.wait(lock);
+    }
+
+    for(uint32 read_id = 0; read_id < batch->num_reads; read_id++)
+    {
+        if (sam_write1(fp, bam_header, batch->records[read_id]) < 0)
+        {
+            fprintf(stderr, "ERROR: failed writing recalibrated alignments\n");
+            exit(1);
+        }
+    }
+
+    num_reads += batch->num_reads;
+    next_batch++;
+
+    lock.unlock();
+    cond.notify_all();
+}
+
+} // namespace firepony
@@ -0,0 +1,68 @@
+/*
+ * Firepony
+ * Copyright (c) 2014-2015, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the NVIDIA CORPORATION nor the
+ *      names of its contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NVIDIA CORPORATION BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+
+#include <htslib/hts.h>
+#include <htslib/sam.h>
+
+#include "alignment_data.h"
+#include "loader/alignments.h"
+
+namespace firepony {
+
+// writes batches of alignments out as BAM
+// batches can be handed in from any number of threads and in any order; they are written out in input order,
+// each thread blocking until all earlier batches have gone out
+struct alignment_writer
+{
+    htsFile *fp;
+    const bam_hdr_t *bam_header;
+
+    // batch_index of the next batch to be written
+    uint64 next_batch;
+    std::mutex m;
+    std::condition_variable cond;
+
+    uint64 num_reads;
+
+    alignment_writer();
+    ~alignment_writer();
+
+    // opens fname for writing, using the header of the input file and num_threads BGZF compression threads
+    bool open(const char *fname, const alignment_file& input, uint32 num_threads);
+    void close(void);
+
+    // writes out the records in a batch (which must have been loaded with AlignmentDataMask::RECORD),
+    // replacing their base qualities with the ones in the batch
+    void write_batch(const alignment_batch_host *batch);
+};
+
+} // namespace firepony
@@ -52,12 +52,28 @@ static void usage(void)
     fprintf(stderr, "  -d, --debug                           Enable debugging (*extremely* verbose)\n");
     fprintf(stderr, "  --disable-rounding                    Disable rounding on the output tables\n");
     fprintf(stderr, "  -b, --batch-size <n>                  Process input in batches of <n> reads\n");
+    fprintf(stderr, "  --min-read-length <n>                 Filter out reads with fewer than <n> bases\n");
+    fprintf(stderr, "  --max-memory <n>                      Limit the working memory of each compute device to <n> MB (shrinks batches as needed)\n");
     fprintf(stderr, "  --mmap                                Load reference/dbsnp from system shared memory if present\n");
     fprintf(stderr, "  -v, --verbose                         Verbose logging\n");
     fprintf(stderr, "  -o, --output <output-file-name>       File to write tabulated output to (default is stdout)\n");
+    fprintf(stderr, "  --binary-output <file-name>           Also write the recalibration tables in binary form (convert with firepony-export)\n");
+    fprintf(stderr, "  --recalibrated-output <bam-file-name> Write the input with recalibrated base qualities to <bam-file-name>\n");
+    fprintf(stderr, "  --apply <binary-table-file-name>      Recalibrate with tables written by --binary-output instead of computing them\n");
+    fprintf(stderr, "                                        (requires --recalibrated-output; no SNP database needed)\n");
+    fprintf(stderr, "  --output-threads <n>                  Number of BGZF compression threads for --recalibrated-output (default 4)\n");
     fprintf(stderr, "  --gpu-only                            Use only the CUDA GPU-accelerated backend\n");
     fprintf(stderr, "  --cpu-only                            Use only the CPU backend\n");
     fprintf(stderr, "  --cpu-threads                         Number of CPU worker threads to run\n");
+    fprintf(stderr, "  --gatk4                               Match GATK4 BaseRecalibrator defaults (disables BAQ)\n");
+    fprintf(stderr, "                                        (only the table contents follow GATK4; the Arguments table keeps the GATK3 list)\n");
+    fprintf(stderr, "  --baq-single-precision                Run the BAQ HMM in single precision\n");
+    fprintf(stderr, "  --baq-validate-precision              Report BAQ qualities that differ between double and single precision\n");
+    fprintf(stderr, "                                        (on the CPU, also between the SIMD lane and per-read HMM)\n");
+    fprintf(stderr, "  --baq-hmm <fused|split>               Run the BAQ HMM phases fused or as separate passes (default: fused on CPU, split on GPU)\n");
+    fprintf(stderr, "  --baq-checkpoint-interval <n>         Store every <n>-th BAQ forward row and recompute the rest (less memory, more compute)\n");
+    fprintf(stderr, "  --baq-max-read-length <n>             Skip BAQ for reads with more than <n> aligned bases (for long-read data)\n");
+    fprintf(stderr, "                                        (the cycle covariate only covers the first %d cycles of a read in this build)\n", CYCLE_COVARIATE_MAX);
     fprintf(stderr, "\n");
 
     fprintf(stderr, "  http://github.com/broadinstitute/firepony\n");
@@ -122,12 +138,24 @@ void parse_command_line(int argc, char **argv)
             { "debug", no_argument, NULL, 'd' },
             { "disable-rounding", no_argument, NULL, 'n' },
             { "batch-size", required_argument, NULL, 'b' },
+            { "min-read-length", required_argument, NULL, 'N' },
+            { "max-memory", required_argument, NULL, 'X' },
             { "mmap", no_argument, NULL, 'm' },
             { "verbose", no_argument, NULL, 'v' },
             { "output", required_argument, NULL, 'o' },
+            { "binary-output", required_argument, NULL, 'B' },
+            { "recalibrated-output", required_argument, NULL, 'W' },
+            { "apply", required_argument, NULL, 'A' },
+            { "output-threads", required_argument, NULL, 'T' },
             { "gpu-only", no_argument, NULL, 'g' },
             { "cpu-only", no_argument, NULL, 'c' },
             { "cpu-threads", required_argument, NULL, 't' },
+            { "gatk4", no_argument, NULL, '4' },
+            { "baq-single-precision", no_argument, NULL, 'F' },
+            { "baq-validate-precision", no_argument, NULL, 'P' },
+            { "baq-checkpoint-interval", required_argument, NULL, 'K' },
+            { "baq-hmm", required_argument, NULL, 'H' },
+            { "baq-max-read-length", required_argument, NULL, 'L' },
             { 0 },
     };
 
@@ -180,6 +208,30 @@ void parse_command_line(int argc, char **argv)
 
             break;
 
+        case 'N':
+            // --min-read-length
+            errno = 0;
+            command_line_options.min_read_length = strtol(optarg, NULL, 10);
+            if (errno != 0)
+            {
+                fprintf(stderr, "error: invalid minimum read length\n");
+                usage();
+            }
+
+            break;
+
+        case 'X':
+            // --max-memory
+            errno = 0;
+            command_line_options.max_memory = strtoull(optarg, NULL, 10) * 1024 * 1024;
+            if (errno != 0)
+            {
+                fprintf(stderr, "error: invalid memory limit\n");
+                usage();
+            }
+
+            break;
+
         case 'm':
             // --mmap
             command_line_options.try_mmap = true;
@@ -195,6 +247,33 @@ void parse_command_line(int argc, char **argv)
             command_line_options.output = strdup(optarg);
             break;
 
+        case 'B':
+            // --binary-output
+            command_line_options.binary_output = strdup(optarg);
+            break;
+
+        case 'W':
+            // --recalibrated-output
+            command_line_options.recalibrated_output = strdup(optarg);
+            break;
+
+        case 'A':
+            // --apply
+            command_line_options.apply_table = strdup(optarg);
+            break;
+
+        case 'T':
+            // --output-threads
+            errno = 0;
+            command_line_options.output_threads = strtol(optarg, NULL, 10);
+            if (errno != 0)
+            {
+                fprintf(stderr, "error: invalid number of output threads\n");
+                usage();
+            }
+
+            break;
+
         case 'g':
             // --gpu-only
             command_line_options.disable_all_backends();
@@ -219,6 +298,59 @@ void parse_command_line(int argc, char **argv)
 
             break;
 
+        case '4':
+            // --gatk4
+            command_line_options.gatk4 = true;
+            break;
+
+        case 'F':
+            // --baq-single-precision
+            command_line_options.baq_single_precision = true;
+            break;
+
+        case 'P':
+            // --baq-validate-precision
+            command_line_options.baq_validate_precision = true;
+            break;
+
+        case 'K':
+            // --baq-checkpoint-interval
+            errno = 0;
+            command_line_options.baq_checkpoint_interval = strtol(optarg, NULL, 10);
+            if (errno != 0 || command_line_options.baq_checkpoint_interval == 1)
+            {
+                fprintf(stderr, "error: invalid BAQ checkpoint interval (must be 0 or at least 2)\n");
+                usage();
+            }
+
+            break;
+
+        case 'H':
+            // --baq-hmm
+            if (!strcmp(optarg, "fused"))
+            {
+                command_line_options.baq_hmm = baq_hmm_fused;
+            } else if (!strcmp(optarg, "split")) {
+                command_line_options.baq_hmm = baq_hmm_split;
+            } else {
+                fprintf(stderr, "error: invalid BAQ HMM mode %s\n", optarg);
+                usage();
+            }
+
+            break;
+
+        case 'L':
+            // --baq-max-read-length
+            errno = 0;
+            command_line_options.baq_max_read_length = strtol(optarg, NULL, 10);
+            if (errno != 0)
+            {
+                fprintf(stderr, "error: invalid BAQ max read length\n");
+                usage();
+            }
+
+            break;
+
         case '?':
         case ':':
         default:
@@ -234,12 +366,19 @@ void parse_command_line(int argc, char **argv)
         usage();
     }
 
-    if (command_line_options.snp_database == nullptr)
+    // the SNP database is only used to compute the tables
+    if (command_line_options.snp_database == nullptr && command_line_options.apply_table == nullptr)
     {
         fprintf(stderr, "error: missing SNP database file name\n\n");
         usage();
     }
 
+    if (command_line_options.apply_table && command_line_options.recalibrated_output == nullptr)
+    {
+        fprintf(stderr, "error: --apply requires --recalibrated-output\n\n");
+        usage();
+    }
+
     if (optind == argc)
     {
         fprintf(stderr, "error: missing input file name\n\n");
@@ -273,18 +412,52 @@ std::string canonical_command_line(void)
     snprintf(buf, sizeof(buf), "-r %s", command_line_options.reference);
     concat(ret, buf);
 
-    snprintf(buf, sizeof(buf), "-s %s", command_line_options.snp_database);
-    concat(ret, buf);
+    if (command_line_options.snp_database)
+    {
+        snprintf(buf, sizeof(buf), "-s %s", command_line_options.snp_database);
+        concat(ret, buf);
+    }
 
     snprintf(buf, sizeof(buf), "-o %s", command_line_options.output ? command_line_options.output : "-");
     concat(ret, buf);
 
+    if (command_line_options.binary_output)
+    {
+        snprintf(buf, sizeof(buf), "--binary-output %s", command_line_options.binary_output);
+        concat(ret, buf);
+    }
+
+    if (command_line_options.apply_table)
+    {
+        snprintf(buf, sizeof(buf), "--apply %s", command_line_options.apply_table);
+        concat(ret, buf);
+    }
+
+    if (command_line_options.recalibrated_output)
+    {
+        snprintf(buf, sizeof(buf), "--recalibrated-output %s --output-threads %u",
+                 command_line_options.recalibrated_output, command_line_options.output_threads);
+        concat(ret, buf);
+    }
+
     if (command_line_options.batch_size != uint32(-1))
     {
         snprintf(buf, sizeof(buf), "--batch-size %d", command_line_options.batch_size);
         concat(ret, buf);
     }
 
+    if (command_line_options.min_read_length)
+    {
+        snprintf(buf, sizeof(buf), "--min-read-length %u", command_line_options.min_read_length);
+        concat(ret, buf);
+    }
+
+    if (command_line_options.max_memory)
+    {
+        snprintf(buf, sizeof(buf), "--max-memory %lu", command_line_options.max_memory / (1024 * 1024));
+        concat(ret, buf);
+    }
+
     if (command_line_options.debug)
     {
         concat(ret, "--debug");
@@ -331,6 +504,38 @@ std::string canonical_command_line(void)
         concat(ret, "--verbose");
     }
 
+    if (command_line_options.gatk4)
+    {
+        concat(ret, "--gatk4");
+    }
+
+    if (command_line_options.baq_single_precision)
+    {
+        concat(ret, "--baq-single-precision");
+    }
+
+    if (command_line_options.baq_validate_precision)
+    {
+        concat(ret, "--baq-validate-precision");
+    }
+
+    if (command_line_options.baq_hmm != baq_hmm_auto)
+    {
+        concat(ret, command_line_options.baq_hmm == baq_hmm_fused ? "--baq-hmm fused" : "--baq-hmm split");
+    }
+
+    if (command_line_options.baq_checkpoint_interval)
+    {
+        snprintf(buf, sizeof(buf), "--baq-checkpoint-interval %u", command_line_options.baq_checkpoint_interval);
+        concat(ret, buf);
+    }
+
+    if (command_line_options.baq_max_read_length)
+    {
+        snprintf(buf, sizeof(buf), "--baq-max-read-length %u", command_line_options.baq_max_read_length);
+        concat(ret, buf);
+    }
+
     return ret;
 }
 
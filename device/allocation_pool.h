@@ -0,0 +1,224 @@
+/*
+ * Firepony
+ *
+ * Copyright (c) 2014-2015, NVIDIA CORPORATION
+ * Copyright (c) 2015, Nuno Subtil <subtil@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the copyright holders nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "../types.h"
+
+#include <algorithm>
+#include <map>
+#include <typeindex>
+#include <vector>
+
+namespace firepony {
+
+// per-context pool of temporary buffers (host-only)
+// stages that need scratch space for the duration of a call take a pooled_allocation instead of a scoped_allocation;
+// buffers are returned to the pool when the pooled_allocation goes out of scope and are reused by later requests
+// for the same element type, so after the first few batches temporaries no longer hit the system allocator
+//
+// buffers grow in power-of-two size classes; persistent allocations keep their storage when shrunk,
+// so a buffer that has grown once serves any later request that fits in its size class
+template <target_system system>
+struct allocation_pool
+{
+    struct buffer_base
+    {
+        // size in bytes of the largest size this buffer has been resized to
+        size_t capacity;
+
+        buffer_base()
+            : capacity(0)
+        { }
+
+        virtual ~buffer_base()
+        { }
+    };
+
+    template <typename T>
+    struct buffer : public buffer_base
+    {
+        persistent_allocation<system, T> storage;
+    };
+
+    // total number of buffers handed out
+    uint64 num_requests;
+    // number of requests that required allocating or growing a buffer
+    uint64 num_allocations;
+    // bytes currently checked out and the largest amount ever checked out at once
+    size_t bytes_in_use;
+    size_t high_water_mark;
+
+    allocation_pool()
+        : num_requests(0),
+          num_allocations(0),
+          bytes_in_use(0),
+          high_water_mark(0)
+    { }
+
+    ~allocation_pool()
+    {
+        for(auto b : buffers)
+        {
+            delete b;
+        }
+    }
+
+    // number of bytes held by all buffers in the pool
+    size_t footprint(void) const
+    {
+        size_t ret = 0;
+        for(auto b : buffers)
+        {
+            ret += b->capacity;
+        }
+
+        return ret;
+    }
+
+    // returns a buffer with at least size elements
+    template <typename T>
+    buffer<T> *acquire(size_t size)
+    {
+        auto& list = free_buffers[std::type_index(typeid(T))];
+        const size_t bytes = size * sizeof(T);
+
+        // prefer the smallest free buffer that fits; failing that, grow the largest one
+        auto best = list.end();
+        for(auto it = list.begin(); it != list.end(); it++)
+        {
+            if (best == list.end())
+            {
+                best = it;
+                continue;
+            }
+
+            const size_t capacity = (*it)->capacity;
+            const size_t best_capacity = (*best)->capacity;
+            const bool fits = (capacity >= bytes);
+            const bool best_fits = (best_capacity >= bytes);
+
+            if (fits != best_fits)
+            {
+                if (fits)
+                    best = it;
+            } else if (fits ? (capacity < best_capacity) : (capacity > best_capacity)) {
+                best = it;
+            }
+        }
+
+        buffer<T> *b;
+        if (best == list.end())
+        {
+            b = new buffer<T>();
+            buffers.push_back(b);
+        } else {
+            b = static_cast<buffer<T> *>(*best);
+            list.erase(best);
+        }
+
+        if (b->capacity < bytes)
+        {
+            // grow to the next size class
+            b->storage.resize(size_class(size));
+            b->capacity = b->storage.size() * sizeof(T);
+            num_allocations++;
+        }
+
+        b->storage.resize(size);
+
+        num_requests++;
+        bytes_in_use += b->capacity;
+        high_water_mark = std::max(high_water_mark, bytes_in_use);
+
+        return b;
+    }
+
+    // returns a buffer to the pool
+    template <typename T>
+    void release(buffer<T> *b)
+    {
+        bytes_in_use -= b->capacity;
+
+        // the caller may have grown the buffer past its size class
+        const size_t bytes = b->storage.size() * sizeof(T);
+        if (bytes > b->capacity)
+        {
+            b->capacity = bytes;
+            num_allocations++;
+        }
+
+        free_buffers[std::type_index(typeid(T))].push_back(b);
+    }
+
+private:
+    static size_t size_class(size_t size)
+    {
+        size_t ret = 1024;
+        while(ret < size)
+        {
+            ret <<= 1;
+        }
+
+        return ret;
+    }
+
+    std::vector<buffer_base *> buffers;
+    std::map<std::type_index, std::vector<buffer_base *> > free_buffers;
+};
+
+// a temporary buffer borrowed from an allocation_pool for the lifetime of this object
+// converts to the underlying allocation, so it can be passed wherever a scoped_allocation was used before
+template <target_system system, typename T>
+struct pooled_allocation
+{
+    allocation_pool<system>& pool;
+    typename allocation_pool<system>::template buffer<T> *b;
+
+    pooled_allocation(allocation_pool<system>& pool, size_t size = 0)
+        : pool(pool),
+          b(pool.template acquire<T>(size))
+    { }
+
+    ~pooled_allocation()
+    {
+        pool.release(b);
+    }
+
+    pooled_allocation(const pooled_allocation&) = delete;
+    pooled_allocation& operator=(const pooled_allocation&) = delete;
+
+    operator persistent_allocation<system, T>& ()
+    {
+        return b->storage;
+    }
+};
+
+} // namespace firepony
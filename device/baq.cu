@@ -34,6 +34,7 @@
 #include <thrust/iterator/zip_iterator.h>
 #include <thrust/tuple.h>
 #include <thrust/functional.h>
+#include <thrust/transform.h>
 
 #include <lift/parallel.h>
 #include <lift/memory/strided_iterator.h>
@@ -52,6 +53,17 @@
 
 namespace firepony {
 
+// number of reads the host HMM processes together, one per lane of a double precision SIMD register
+#if defined(__AVX512F__)
+#define BAQ_HOST_LANES 8
+#elif defined(__AVX__)
+#define BAQ_HOST_LANES 4
+#else
+#define BAQ_HOST_LANES 2
+#endif
+
+// stride: number of reads whose HMM matrices are interleaved
+// uniform_rows: whether all reads in a stride group use the same matrix row pitch
 template <target_system system>
 struct baq_stride
 { };
@@ -60,12 +72,14 @@ template <>
 struct baq_stride<cuda>
 {
     static constexpr uint32 stride = 32;
+    static constexpr bool uniform_rows = false;
 };
 
 template <>
 struct baq_stride<host>
 {
-    static constexpr uint32 stride = 1;
+    static constexpr uint32 stride = BAQ_HOST_LANES;
+    static constexpr bool uniform_rows = true;
 };
 
 #define MAX_PHRED_SCORE 93
@@ -78,7 +92,7 @@ struct baq_stride<host>
 // all bases with q < minBaseQual are up'd to this value
 #define MIN_BASE_QUAL 4
 
-#define GAP_OPEN_PROBABILITY (pow(10.0, (-40.0)/10.))
+#define GAP_OPEN_PROBABILITY 1e-4 // 10^(-40/10)
 #define GAP_EXTENSION_PROBABILITY 0.1
 
 static CUDA_HOST_DEVICE inline uint32 abs(int32 val)
@@ -93,15 +107,15 @@ struct compute_hmm_windows : public lambda<system>
 
     CUDA_HOST_DEVICE void operator() (const uint32 read_index)
     {
-        // read_needs_baq is used to avoid disabling reads that don't actually need BAQ if we determine that BAQ can't otherwise be computed
-        // (we still compute HMM windows even for reads that do not need BAQ)
-        const bool read_needs_baq = (ctx.cigar.num_errors[read_index] != 0);
-
         const CRQ_index idx = batch.crq_index(read_index);
 
-        const ushort2& read_window_clipped = ctx.cigar.read_window_clipped[read_index];
-        const ushort2& read_window_clipped_no_insertions = ctx.cigar.read_window_clipped_no_insertions[read_index];
-        const ushort2& reference_window_clipped = ctx.cigar.reference_window_clipped[read_index];
+        const read_coord2& read_window_clipped = ctx.cigar.read_window_clipped[read_index];
+        const read_coord2& read_window_clipped_no_insertions = ctx.cigar.read_window_clipped_no_insertions[read_index];
+        const read_coord2& reference_window_clipped = ctx.cigar.reference_window_clipped[read_index];
+
+        // read_needs_baq is used to avoid disabling reads that don't actually need BAQ if we determine that BAQ can't otherwise be computed
+        // (we still compute HMM windows even for reads that do not need BAQ)
+        const bool read_needs_baq = (ctx.cigar.num_errors[read_index] != 0 && !ctx.baq.skips_read(read_window_clipped));
 
         // note: the band width for any given read is not necessarily constant, but GATK always uses the min band width when computing the reference offset
         // this looks a lot like a bug in GATK, but we replicate the same behavior here
@@ -116,11 +130,11 @@ struct compute_hmm_windows : public lambda<system>
         const bool right_clip = (read_window_clipped.y != idx.read_len - 1);
 
         // compute the left and right insertion offsets
-        const short left_insertion = (left_clip ? 0 : read_window_clipped_no_insertions.x - read_window_clipped.x);
-        const short right_insertion = (right_clip ? 0 : read_window_clipped.y - read_window_clipped_no_insertions.y);
+        const signed_read_coord left_insertion = (left_clip ? 0 : read_window_clipped_no_insertions.x - read_window_clipped.x);
+        const signed_read_coord right_insertion = (right_clip ? 0 : read_window_clipped.y - read_window_clipped_no_insertions.y);
 
         // compute the reference window in local read coordinates
-        short2 hmm_reference_window;
+        signed_read_coord2 hmm_reference_window;
         hmm_reference_window.x = reference_window_clipped.x - left_insertion - offset;
         hmm_reference_window.y = reference_window_clipped.y + right_insertion + offset;
 
@@ -140,19 +154,9 @@ struct compute_hmm_windows : public lambda<system>
             // HMM window lies beyond the end of the reference sequence
             // can't compute BAQ, filter out this read
 
-            // clear the cigar event -> read bp offset mapping for this read
-            const uint32 cigar_ev_start = ctx.cigar.cigar_offsets[idx.cigar_start];
-            const uint32 cigar_ev_stop = ctx.cigar.cigar_offsets[idx.cigar_start + idx.cigar_len];
-
-            for(uint32 i = cigar_ev_start; i < cigar_ev_stop; i++)
-            {
-                ctx.cigar.cigar_event_read_index[i] = uint32(-1);
-                ctx.cigar.cigar_event_read_coordinates[i] = uint16(-1);
-            }
-
             // emit an invalid HMM window
             // this will cause this read to be removed from the active read list
-            ctx.baq.hmm_reference_windows[read_index] = make_short2(short(-1), short(-1));
+            ctx.baq.hmm_reference_windows[read_index] = make_signed_read_coord2(-1, -1);
 
             return;
         }
@@ -167,7 +171,7 @@ struct compute_hmm_windows : public lambda<system>
         referenceLen = hmm_reference_window.y - hmm_reference_window.x + 1;
         queryLen = read_window_clipped.y - read_window_clipped.x + 1;
 
-        uint16 bandWidth = max(referenceLen, queryLen);
+        read_coord bandWidth = max(referenceLen, queryLen);
 
         if (MIN_BAND_WIDTH < abs(referenceLen - queryLen))
         {
@@ -193,8 +197,8 @@ struct hmm_window_valid : public lambda<system>
 
     CUDA_HOST_DEVICE bool operator() (const uint32 read_index)
     {
-        if (ctx.baq.hmm_reference_windows[read_index].x == short(-1) &&
-            ctx.baq.hmm_reference_windows[read_index].y == short(-1))
+        if (ctx.baq.hmm_reference_windows[read_index].x == signed_read_coord(-1) &&
+            ctx.baq.hmm_reference_windows[read_index].y == signed_read_coord(-1))
         {
             return false;
         } else {
@@ -211,31 +215,121 @@ typedef enum
     hmm_phase_all = 4 + 2 + 1,
 } hmm_phase;
 
-template <target_system system, uint32 phase>
-struct hmm_glocal : public lambda<system>
+// selects the HMM matrix storage for a given precision
+template <target_system system, typename T>
+struct hmm_storage
+{ };
+
+template <target_system system>
+struct hmm_storage<system, double>
 {
-    pointer<system, uint32> baq_state;
+    static CUDA_HOST_DEVICE persistent_allocation<system, double>& forward(baq_context<system>& baq)  { return baq.forward; }
+    static CUDA_HOST_DEVICE persistent_allocation<system, double>& backward(baq_context<system>& baq) { return baq.backward; }
+    static CUDA_HOST_DEVICE persistent_allocation<system, double>& scaling(baq_context<system>& baq)  { return baq.scaling; }
+    static CUDA_HOST_DEVICE baq_probability_tables<system, double>& tables(baq_context<system>& baq)  { return baq.tables; }
+};
 
-    hmm_glocal(firepony_context<system> ctx,
-               const alignment_batch_device<system> batch,
-               pointer<system, uint32> baq_state)
-        : lambda<system>(ctx, batch), baq_state(baq_state)
-    { }
+template <target_system system>
+struct hmm_storage<system, float>
+{
+    static CUDA_HOST_DEVICE persistent_allocation<system, float>& forward(baq_context<system>& baq)  { return baq.forward_sp; }
+    static CUDA_HOST_DEVICE persistent_allocation<system, float>& backward(baq_context<system>& baq) { return baq.backward_sp; }
+    static CUDA_HOST_DEVICE persistent_allocation<system, float>& scaling(baq_context<system>& baq)  { return baq.scaling_sp; }
+    static CUDA_HOST_DEVICE baq_probability_tables<system, float>& tables(baq_context<system>& baq)  { return baq.tables_sp; }
+};
+
+// number of entries per query length in the transition table: sM followed by the 3x3 transition matrix
+#define HMM_TRANSITION_STRIDE 10
+// number of entries in the emission table: every possible quality, match and mismatch
+#define HMM_EMISSION_TABLE_SIZE (256 * 2)
+
+// builds the emission probability table
+// qualities below MIN_BASE_QUAL are clamped, as GATK does
+template <typename T>
+static void build_hmm_emission_table(persistent_allocation<host, T>& out)
+{
+    out.resize(HMM_EMISSION_TABLE_SIZE);
+
+    for(uint32 q = 0; q < 256; q++)
+    {
+        const int qualB = q < MIN_BASE_QUAL ? MIN_BASE_QUAL : q;
+        const T qual = pow(10.0, -qualB/10.0);
+
+        out[q * 2 + 0] = 1 - qual;
+        out[q * 2 + 1] = qual * T(EM);
+    }
+}
+
+// builds the transition terms for all query lengths up to max_query_len
+template <typename T>
+static void build_hmm_transition_table(persistent_allocation<host, T>& out, const uint32 max_query_len)
+{
+    out.resize((max_query_len + 1) * HMM_TRANSITION_STRIDE);
+
+    for(uint32 queryLen = 0; queryLen <= max_query_len; queryLen++)
+    {
+        T *t = &out[queryLen * HMM_TRANSITION_STRIDE];
+        T *m = t + 1;
+
+        const T sM = 1.0 / (2 * queryLen + 2);
+        const T sI = sM;
+
+        t[0] = sM;
+
+        m[0*3+0] = (1 - GAP_OPEN_PROBABILITY - GAP_OPEN_PROBABILITY) * (1 - sM);
+        m[0*3+1] = GAP_OPEN_PROBABILITY * (1 - sM);
+        m[0*3+2] = m[0*3+1];
+        m[1*3+0] = (1 - GAP_EXTENSION_PROBABILITY) * (1 - sI);
+        m[1*3+1] = GAP_EXTENSION_PROBABILITY * (1 - sI);
+        m[1*3+2] = 0.0;
+        m[2*3+0] = 1 - GAP_EXTENSION_PROBABILITY;
+        m[2*3+1] = 0.0;
+        m[2*3+2] = GAP_EXTENSION_PROBABILITY;
+    }
+}
+
+// makes sure the probability tables cover all reads in a batch
+template <target_system system, typename T>
+static void update_hmm_tables(baq_probability_tables<system, T>& tables, const uint32 max_query_len)
+{
+    if (tables.emission.size() == 0)
+    {
+        persistent_allocation<host, T> emission;
+        build_hmm_emission_table(emission);
+        tables.emission.copy(emission);
+    }
 
+    if (tables.transition.size() < (max_query_len + 1) * HMM_TRANSITION_STRIDE)
+    {
+        persistent_allocation<host, T> transition;
+        build_hmm_transition_table(transition, max_query_len);
+        tables.transition.copy(transition);
+    }
+}
+
+// per-read HMM state: window coordinates, transition probabilities and matrix pointers
+// T is the floating point type used for the HMM matrices and math (double or float)
+// the HMM is rescaled on every row, which keeps all values in a range where single precision is usable
+template <target_system system, typename T>
+struct hmm_read_state
+{
     int bandWidth, bandWidth2;
 
     int referenceStart, referenceLength;
     int queryStart, queryEnd, queryLen;
 
-    typedef strided_iterator<double, baq_stride<system>::stride> matrix_iterator;
+    typedef strided_iterator<T, baq_stride<system>::stride> matrix_iterator;
 
     matrix_iterator forwardMatrix;
     matrix_iterator backwardMatrix;
     matrix_iterator scalingFactors;
 
-    double sM, sI, bM, bI;
+    T sM, sI, bM, bI;
+
+    T m[9];
 
-    double m[9];
+    // emission probabilities, see build_hmm_emission_table
+    const T *emission;
 
     stream_dna16<system> referenceBases;
     stream_dna16<system> queryBases;
@@ -244,16 +338,14 @@ struct hmm_glocal : public lambda<system>
     uint8 *outputQualities;
     uint32 *outputState;
 
-    template<typename Tuple>
-    CUDA_HOST_DEVICE void setup(const Tuple& hmm_index)
+    CUDA_HOST_DEVICE void setup(firepony_context<system>& ctx,
+                                const alignment_batch_device<system>& batch,
+                                pointer<system, uint8>& qualities,
+                                pointer<system, uint32>& baq_state,
+                                const uint32 read_index,
+                                const uint32 matrix_index,
+                                const uint32 scaling_index)
     {
-        auto& ctx = this->ctx;
-        auto& batch = this->batch;
-
-        const uint32 read_index    = thrust::get<0>(hmm_index);
-        const uint32 matrix_index  = thrust::get<1>(hmm_index);
-        const uint32 scaling_index = thrust::get<2>(hmm_index);
-
         const CRQ_index idx = batch.crq_index(read_index);
 
         const uint32 matrix_offset = matrix_index % baq_stride<system>::stride;
@@ -263,13 +355,15 @@ struct hmm_glocal : public lambda<system>
         const uint32 scaling_base = scaling_index - scaling_offset;
 
         // set up matrix and scaling factor pointers
-        forwardMatrix = matrix_iterator(&ctx.baq.forward[matrix_base + matrix_offset]);
-        backwardMatrix = matrix_iterator(&ctx.baq.backward[matrix_base + matrix_offset]);
-        scalingFactors = matrix_iterator(&ctx.baq.scaling[scaling_base + scaling_offset]);
+        forwardMatrix = matrix_iterator(&hmm_storage<system, T>::forward(ctx.baq)[matrix_base + matrix_offset]);
+        // the checkpointed HMM keeps its backward rows inside the forward matrix
+        if (ctx.baq.checkpoint_interval == 0)
+            backwardMatrix = matrix_iterator(&hmm_storage<system, T>::backward(ctx.baq)[matrix_base + matrix_offset]);
+        scalingFactors = matrix_iterator(&hmm_storage<system, T>::scaling(ctx.baq)[scaling_base + scaling_offset]);
 
         // get the windows for the current read
         const auto& hmm_reference_window = ctx.baq.hmm_reference_windows[read_index];
-        const ushort2& read_window_clipped = ctx.cigar.read_window_clipped[read_index];
+        const read_coord2& read_window_clipped = ctx.cigar.read_window_clipped[read_index];
 
         referenceStart = hmm_reference_window.x;
         referenceLength = hmm_reference_window.y - hmm_reference_window.x + 1;
@@ -282,20 +376,18 @@ struct hmm_glocal : public lambda<system>
         bandWidth2 = bandWidth * 2 + 1;
 
         // initialize transition probabilities
-        sM = 1.0 / (2 * queryLen + 2);
+        baq_probability_tables<system, T>& tables = hmm_storage<system, T>::tables(ctx.baq);
+        const T *transition = &tables.transition[queryLen * HMM_TRANSITION_STRIDE];
+
+        sM = transition[0];
         sI = sM;
         bM = (1 - GAP_OPEN_PROBABILITY) / referenceLength;
         bI = GAP_OPEN_PROBABILITY / referenceLength;
 
-        m[0*3+0] = (1 - GAP_OPEN_PROBABILITY - GAP_OPEN_PROBABILITY) * (1 - sM);
-        m[0*3+1] = GAP_OPEN_PROBABILITY * (1 - sM);
-        m[0*3+2] = m[0*3+1];
-        m[1*3+0] = (1 - GAP_EXTENSION_PROBABILITY) * (1 - sI);
-        m[1*3+1] = GAP_EXTENSION_PROBABILITY * (1 - sI);
-        m[1*3+2] = 0.0;
-        m[2*3+0] = 1 - GAP_EXTENSION_PROBABILITY;
-        m[2*3+1] = 0.0;
-        m[2*3+2] = GAP_EXTENSION_PROBABILITY;
+        for(int j = 0; j < 9; j++)
+            m[j] = transition[j + 1];
+
+        emission = &tables.emission[0];
 
 //        printf("referenceStart = %u\n", referenceStart);
 //        printf("queryStart = %u queryLen = %u\n", queryStart, queryLen);
@@ -320,8 +412,8 @@ struct hmm_glocal : public lambda<system>
 
         inputQualities = &batch.qualities[idx.qual_start] + queryStart;
 
-        if (ctx.baq.qualities.size() > 0)
-            outputQualities = &ctx.baq.qualities[idx.qual_start] + queryStart;
+        if (qualities.size() > 0)
+            outputQualities = &qualities[idx.qual_start] + queryStart;
         else
             outputQualities = NULL;
 
@@ -346,19 +438,51 @@ struct hmm_glocal : public lambda<system>
         return i * (bandWidth2 * 3 + 6) + j;
     }
 
-    // computes the required HMM matrix size for the given read length
-    CUDA_HOST_DEVICE static uint32 matrix_size(const uint32 read_len, const int bandWidth)
+    // zeroes an entire matrix row
+    CUDA_HOST_DEVICE void clear_row(matrix_iterator row)
     {
-        const int bandWidth2 = bandWidth * 2 + 1;
-        return (read_len + 1) * (bandWidth2 * 3 + 6);
+        for (int j = 0; j < bandWidth2 * 3 + 6; j++)
+            row[j] = 0.0;
     }
 
-    CUDA_HOST_DEVICE static double qual2prob(uint8 q)
+    // prepares row i of the forward or backward matrix before it is computed
+    // the recurrences read one cell triple on either side of the band of the current and adjacent rows and expect zeros there,
+    // so we clear the band plus those guard cells instead of zero-filling the whole matrix up front
+    // the last row is read across its full width when computing the last scaling factor, so it is cleared entirely
+    CUDA_HOST_DEVICE void init_row(matrix_iterator row, const int i)
     {
-        return pow(10.0, -q/10.0);
+        if (i == queryLen)
+        {
+            clear_row(row);
+            return;
+        }
+
+        const int beg = 1 > i - bandWidth ? 1 : i - bandWidth;
+        const int end = referenceLength < i + bandWidth ? referenceLength : i + bandWidth;
+
+        const int _beg = set_u(bandWidth, i, beg) - 3;
+        const int _end = set_u(bandWidth, i, end) + 5;
+
+        for (int j = _beg; j <= _end; j++)
+            row[j] = 0.0;
+    }
+
+    // computes the required HMM matrix size for the given read length
+    // with checkpointing enabled, this covers every k-th forward row, a k-row segment buffer and two backward rows
+    CUDA_HOST_DEVICE static uint32 matrix_size(const uint32 read_len, const int bandWidth, const uint32 checkpoint_interval)
+    {
+        const int bandWidth2 = bandWidth * 2 + 1;
+
+        if (checkpoint_interval)
+        {
+            const uint32 segment_rows = checkpoint_interval < read_len + 1 ? checkpoint_interval : read_len + 1;
+            return (read_len / checkpoint_interval + 1 + segment_rows + 2) * (bandWidth2 * 3 + 6);
+        }
+
+        return (read_len + 1) * (bandWidth2 * 3 + 6);
     }
 
-    CUDA_HOST_DEVICE static double calcEpsilon(uint8 ref, uint8 read, uint8 qualB)
+    CUDA_HOST_DEVICE T calcEpsilon(uint8 ref, uint8 read, uint8 qualB)
     {
         if (ref == from_nvbio::AlphabetTraits<from_nvbio::DNA_IUPAC>::N ||
             read == from_nvbio::AlphabetTraits<from_nvbio::DNA_IUPAC>::N)
@@ -366,15 +490,192 @@ struct hmm_glocal : public lambda<system>
             return 1.0;
         }
 
-        double qual = qual2prob(qualB < MIN_BASE_QUAL ? MIN_BASE_QUAL : qualB);
-        double e = (ref == read ? 1 - qual : qual * EM);
-        return e;
+        return emission[qualB * 2 + (ref == read ? 0 : 1)];
+    }
+};
+
+template <target_system system, uint32 phase, typename T>
+struct hmm_glocal : public lambda<system>, public hmm_read_state<system, T>
+{
+    typedef hmm_read_state<system, T> state;
+    typedef typename state::matrix_iterator matrix_iterator;
+
+    using state::bandWidth;
+    using state::bandWidth2;
+    using state::referenceLength;
+    using state::queryStart;
+    using state::queryLen;
+    using state::forwardMatrix;
+    using state::backwardMatrix;
+    using state::scalingFactors;
+    using state::sM;
+    using state::sI;
+    using state::bM;
+    using state::bI;
+    using state::m;
+    using state::referenceBases;
+    using state::queryBases;
+    using state::inputQualities;
+    using state::outputQualities;
+    using state::outputState;
+    using state::set_u;
+    using state::off;
+    using state::calcEpsilon;
+
+    pointer<system, uint8> qualities;
+    pointer<system, uint32> baq_state;
+
+    hmm_glocal(firepony_context<system> ctx,
+               const alignment_batch_device<system> batch,
+               pointer<system, uint8> qualities,
+               pointer<system, uint32> baq_state)
+        : lambda<system>(ctx, batch), qualities(qualities), baq_state(baq_state)
+    { }
+
+    template<typename Tuple>
+    CUDA_HOST_DEVICE void setup(const Tuple& hmm_index)
+    {
+        state::setup(this->ctx, this->batch, qualities, baq_state,
+                     thrust::get<0>(hmm_index),
+                     thrust::get<1>(hmm_index),
+                     thrust::get<2>(hmm_index));
+    }
+
+    // computes and rescales f[1]
+    CUDA_HOST_DEVICE void hmm_forward_first_row(matrix_iterator fi)
+    {
+        int k;
+
+        // f[1]
+        T sum;
+        int beg = 1;
+        int end = referenceLength < bandWidth + 1? referenceLength : bandWidth + 1;
+        int _beg, _end;
+
+        sum = 0.0;
+        for (k = beg; k <= end; ++k)
+        {
+            int u;
+            T e = calcEpsilon(referenceBases[k-1], queryBases[queryStart], inputQualities[queryStart]);
+//                printf("referenceBases[%d-1] = %c inputQualities[%d] = %d queryBases[%d] = %c -> e = %.4f\n",
+////                       read_index,
+//                       k,
+//                       from_nvbio::iupac16_to_char(referenceBases[k-1]),
+//                       queryStart,
+//                       inputQualities[queryStart],
+//                       queryStart,
+//                       from_nvbio::iupac16_to_char(queryBases[queryStart]), e);
+
+            u = set_u(bandWidth, 1, k);
+
+            fi[u+0] = e * bM;
+            fi[u+1] = T(EI) * bI;
+
+            sum += fi[u] + fi[u+1];
+        }
+
+        // rescale
+        scalingFactors[1] = sum;
+        _beg = set_u(bandWidth, 1, beg);
+        _end = set_u(bandWidth, 1, end);
+        _end += 2;
+
+        for (int k = _beg; k <= _end; ++k)
+            fi[k] /= sum;
+    }
+
+    // computes and rescales f[i] for i >= 2 from f[i-1]
+    CUDA_HOST_DEVICE void hmm_forward_row(const int i, matrix_iterator fi, matrix_iterator fi1)
+    {
+        int k;
+        T sum;
+
+        int beg = 1;
+        int end = referenceLength;
+        int x, _beg, _end;
+
+        char qyi = queryBases[queryStart+i-1];
+
+        x = i - bandWidth;
+        beg = beg > x? beg : x; // band start
+
+        x = i + bandWidth;
+        end = end < x? end : x; // band end
+
+        sum = 0.0;
+        for (k = beg; k <= end; ++k)
+        {
+            int u, v11, v01, v10;
+            T e = calcEpsilon(referenceBases[k-1], qyi, inputQualities[queryStart+i-1]);
+//                printf("read %d: referenceBases[%d-1] = %c inputQualities[%d+%d-1] = %d qyi = %c -> e = %.4f\n",
+//                       read_index,
+//                       k,
+//                       from_nvbio::iupac16_to_char(referenceBases[k-1]),
+//                       queryStart,
+//                       i,
+//                       inputQualities[queryStart+i-1],
+//                       from_nvbio::iupac16_to_char(qyi), e);
+
+            u = set_u(bandWidth, i, k);
+            v11 = set_u(bandWidth, i-1, k-1);
+            v10 = set_u(bandWidth, i-1, k);
+            v01 = set_u(bandWidth, i, k-1);
+
+            fi[u+0] = e * (m[0] * fi1[v11+0] + m[3] * fi1[v11+1] + m[6] * fi1[v11+2]);
+            fi[u+1] = T(EI) * (m[1] * fi1[v10+0] + m[4] * fi1[v10+1]);
+            fi[u+2] = m[2] * fi[v01+0] + m[8] * fi[v01+2];
+
+            sum += fi[u] + fi[u+1] + fi[u+2];
+
+//                printf("(%d,%d;%d): %.32f,%.32f,%.32f\n", i, k, u, fi[u], fi[u+1], fi[u+2]);
+//                printf(" .. u = %d v11 = %d v01 = %d v10 = %d e = %f\n", u, v11, v01, v10, e);
+//                printf("HMM: %d, %d, %d, %d, %d, %d, %d, %d, %d, %.32f, %.32f, %.32f, %.32f, %.32f, %.32f, %.32f, %.32f, %.32f, %.32f, %.32f\n",
+//                       i, k, u,
+//                       from_nvbio::iupac16_to_char(uint8(referenceBases[k-1])), from_nvbio::iupac16_to_char(qyi), uint8(inputQualities[queryStart+i-1]),
+//                       v01, v10, v11,
+//                       e,
+//                       fi1[v01+0], fi1[v01+1],
+//                       fi1[v10+0], fi1[v10+1],
+//                       fi1[v11+0], fi1[v11+1], fi1[v11+2],
+//                       fi[u+0], fi[u+1], fi[u+2]);
+        }
+
+        // rescale
+        scalingFactors[i] = sum;
+
+        _beg = set_u(bandWidth, i, beg);
+        _end = set_u(bandWidth, i, end);
+        _end += 2;
+
+        for (k = _beg, sum = T(1.)/sum; k <= _end; ++k)
+            fi[k] *= sum;
+    }
+
+    // computes the last scaling factor from f[l_query]
+    CUDA_HOST_DEVICE void hmm_forward_last_scaling(matrix_iterator fq)
+    {
+        int k;
+
+        // f[l_query+1]
+        T sum = 0.0;
+
+        for (k = 1; k <= referenceLength; ++k)
+        {
+            int u = set_u(bandWidth, queryLen, k);
+
+            if (u < 3 || u >= bandWidth2*3+3)
+                continue;
+
+            sum += fq[u+0] * sM + fq[u+1] * sI;
+        }
+
+        scalingFactors[queryLen+1] = sum; // the last scaling factor
     }
 
     template <typename Tuple>
     CUDA_HOST_DEVICE void hmm_forward(const Tuple& hmm_index)
     {
-        int i, k;
+        int i;
 
 //        const uint32 read_index    = thrust::get<0>(hmm_index);
 //        printf("read %d: hmm_glocal(l_ref=%d qstart=%d, l_query=%d)\n", read_index, referenceLength, queryStart, queryLen);
@@ -401,298 +702,896 @@ struct hmm_glocal : public lambda<system>
         // f[0]
         forwardMatrix[off(0, set_u(bandWidth, 0, 0))] = 1.0;
         scalingFactors[0] = 1.0;
-        { // f[1]
-            matrix_iterator fi(&forwardMatrix[off(1)]);
-            double sum;
+
+        // f[1]
+        state::init_row(matrix_iterator(&forwardMatrix[off(1)]), 1);
+        hmm_forward_first_row(matrix_iterator(&forwardMatrix[off(1)]));
+
+        // f[2..l_query]
+        for (i = 2; i <= queryLen; ++i)
+        {
+            state::init_row(matrix_iterator(&forwardMatrix[off(i)]), i);
+            hmm_forward_row(i, matrix_iterator(&forwardMatrix[off(i)]), matrix_iterator(&forwardMatrix[off(i-1)]));
+        }
+
+        // f[l_query+1]
+        hmm_forward_last_scaling(matrix_iterator(&forwardMatrix[off(queryLen)]));
+    }
+
+    // computes b[l_query] (b[l_query+1][0]=1 and thus \tilde{b}[][]=1/s[l_query+1]; this is where s[l_query+1] comes from)
+    CUDA_HOST_DEVICE void hmm_backward_last_row(matrix_iterator bi)
+    {
+        int k;
+
+        for (k = 1; k <= referenceLength; ++k)
+        {
+            int u = set_u(bandWidth, queryLen, k);
+
+            if (u < 3 || u >= bandWidth2*3+3)
+                continue;
+
+            bi[u+0] = sM / scalingFactors[queryLen] / scalingFactors[queryLen+1];
+            bi[u+1] = sI / scalingFactors[queryLen] / scalingFactors[queryLen+1];
+        }
+    }
+
+    // computes and rescales b[i] for i < l_query from b[i+1]
+    CUDA_HOST_DEVICE void hmm_backward_row(const int i, matrix_iterator bi, matrix_iterator bi1)
+    {
+        int k;
+        int beg = 1;
+        int end = referenceLength;
+        int x, _beg, _end;
+
+        T y = (i > 1)? 1. : 0.;
+
+        char qyi1 = queryBases[queryStart+i];
+
+        x = i - bandWidth;
+        beg = beg > x? beg : x;
+
+        x = i + bandWidth;
+        end = end < x? end : x;
+
+        for (k = end; k >= beg; --k)
+        {
+            int u, v11, v01, v10;
+
+            u = set_u(bandWidth, i, k);
+            v11 = set_u(bandWidth, i+1, k+1);
+            v10 = set_u(bandWidth, i+1, k);
+            v01 = set_u(bandWidth, i, k+1);
+
+            /* const */ T e;
+            if (k >= referenceLength)
+                e = 0;
+            else
+                e = calcEpsilon(referenceBases[k], qyi1, inputQualities[queryStart+i]) * bi1[v11];
+
+            bi[u+0] = e * m[0] + T(EI) * m[1] * bi1[v10+1] + m[2] * bi[v01+2]; // bi1[v11] has been folded into e.
+            bi[u+1] = e * m[3] + T(EI) * m[4] * bi1[v10+1];
+            bi[u+2] = (e * m[6] + m[8] * bi[v01+2]) * y;
+        }
+
+        // rescale
+        _beg = set_u(bandWidth, i, beg);
+        _end = set_u(bandWidth, i, end);
+        _end += 2;
+
+        y = T(1.0) / scalingFactors[i];
+        for (k = _beg; k <= _end; ++k)
+            bi[k] *= y;
+    }
+
+    template <typename Tuple>
+    CUDA_HOST_DEVICE void hmm_backward(const Tuple& hmm_index)
+    {
+        int i, k;
+
+        /*** backward ***/
+        // b[l_query]
+        state::init_row(matrix_iterator(&backwardMatrix[off(queryLen)]), queryLen);
+        hmm_backward_last_row(matrix_iterator(&backwardMatrix[off(queryLen)]));
+
+        // b[l_query-1..1]
+        for (i = queryLen - 1; i >= 1; --i)
+        {
+            state::init_row(matrix_iterator(&backwardMatrix[off(i)]), i);
+            hmm_backward_row(i, matrix_iterator(&backwardMatrix[off(i)]), matrix_iterator(&backwardMatrix[off(i+1)]));
+        }
+
+//        T pb = 0.0;
+        { // b[0]
             int beg = 1;
             int end = referenceLength < bandWidth + 1? referenceLength : bandWidth + 1;
-            int _beg, _end;
 
-            sum = 0.0;
-            for (k = beg; k <= end; ++k)
+            T sum = 0.0;
+            for (k = end; k >= beg; --k)
             {
-                int u;
-                double e = calcEpsilon(referenceBases[k-1], queryBases[queryStart], inputQualities[queryStart]);
-//                printf("referenceBases[%d-1] = %c inputQualities[%d] = %d queryBases[%d] = %c -> e = %.4f\n",
-////                       read_index,
-//                       k,
-//                       from_nvbio::iupac16_to_char(referenceBases[k-1]),
-//                       queryStart,
-//                       inputQualities[queryStart],
-//                       queryStart,
-//                       from_nvbio::iupac16_to_char(queryBases[queryStart]), e);
+                int u = set_u(bandWidth, 1, k);
+                T e = calcEpsilon(referenceBases[k-1], queryBases[queryStart], inputQualities[queryStart]);
+
+                if (u < 3 || u >= bandWidth2*3+3)
+                    continue;
+
+                sum += e * backwardMatrix[off(1, u+0)] * bM + T(EI) * backwardMatrix[off(1, u+1)] * bI;
+            }
+
+            backwardMatrix[off(0, set_u(bandWidth, 0, 0))] = sum / scalingFactors[0];
+//            pb = backwardMatrix[off(0, set_u(bandWidth, 0, 0))]; // if everything works as is expected, pb == 1.0
+        }
+    }
 
-                u = set_u(bandWidth, 1, k);
+    // computes the MAP state and BAQ quality for query position i from f[i] and b[i]
+    CUDA_HOST_DEVICE void hmm_map_row(const int i, matrix_iterator fi, matrix_iterator bi)
+    {
+        int k;
+        T sum = 0.0;
+        T max = 0.0;
+
+        int beg = 1;
+        int end = referenceLength;
+        int x, max_k = -1;
 
-                fi[u+0] = e * bM;
-                fi[u+1] = EI * bI;
+        x = i - bandWidth;
+        beg = beg > x? beg : x;
 
-                sum += fi[u] + fi[u+1];
+        x = i + bandWidth;
+        end = end < x? end : x;
+
+        for (k = beg; k <= end; ++k)
+        {
+            const int u = set_u(bandWidth, i, k);
+            T z = 0.0;
+
+            z = fi[u+0] * bi[u+0];
+            sum += z;
+            if (z > max)
+            {
+                max = z;
+                max_k = (k-1) << 2 | 0;
             }
 
-            // rescale
-            scalingFactors[1] = sum;
-            _beg = set_u(bandWidth, 1, beg);
-            _end = set_u(bandWidth, 1, end);
-            _end += 2;
+            z = fi[u+1] * bi[u+1];
+            sum += z;
+            if (z > max)
+            {
+                max = z;
+                max_k = (k-1) << 2 | 1;
+            }
+        }
+
+        max /= sum;
+        sum *= scalingFactors[i]; // if everything works as is expected, sum == 1.0
+
+        if (outputState != NULL)
+            outputState[queryStart+i-1] = max_k;
+
+        if (outputQualities != NULL)
+        {
+            k = (int)(double(-4.343) * log(double(1.0) - double(max)) + double(.499)); // = 10*log10(1-max)
+            outputQualities[queryStart+i-1] = (char)(k > 100? 99 : (k < MIN_BASE_QUAL ? MIN_BASE_QUAL : k));
 
-            for (int k = _beg; k <= _end; ++k)
-                fi[k] /= sum;
+//            printf("outputQualities[%d]: max = %.16f k = %d -> %d\n", queryStart+i-1, max, k, outputQualities[queryStart+i-1]);
         }
 
-        // f[2..l_query]
-        for (i = 2; i <= queryLen; ++i)
+//        printf("(%.4f,%.4f) (%d,%d,%d,%.4f)\n", pb, sum, (i-1), (max_k>>2), (max_k&3), max);
+    }
+
+    template <typename Tuple>
+    CUDA_HOST_DEVICE void hmm_map(const Tuple& hmm_index)
+    {
+        int i;
+
+        /*** MAP ***/
+        for (i = 1; i <= queryLen; ++i)
         {
-            matrix_iterator fi(&forwardMatrix[off(i)]);
-            matrix_iterator fi1(&forwardMatrix[off(i-1)]);
-            double sum;
+            hmm_map_row(i, matrix_iterator(&forwardMatrix[off(i)]), matrix_iterator(&backwardMatrix[off(i)]));
+        }
+    }
 
-            int beg = 1;
-            int end = referenceLength;
-            int x, _beg, _end;
+    template <typename Tuple>
+    CUDA_HOST_DEVICE void operator() (const Tuple& hmm_index)
+    {
+        setup(hmm_index);
+
+        if (phase & hmm_phase_forward)
+            hmm_forward(hmm_index);
+
+        if (phase & hmm_phase_backward)
+            hmm_backward(hmm_index);
+
+        if (phase & hmm_phase_map)
+            hmm_map(hmm_index);
+    }
+};
 
-            char qyi = queryBases[queryStart+i-1];
+// runs the full HMM for a single read, storing only every k-th forward row
+// the backward pass walks the read one segment at a time, recomputing the forward rows of each segment from its checkpoint
+// this needs L/k + k + 2 rows per read instead of 2 * (L + 1), at the cost of computing most forward rows twice
+// rows are reused, so each is cleared before it's computed (see init_row)
+// rows are recomputed from identical inputs, so results match hmm_glocal exactly
+template <target_system system, typename T>
+struct hmm_glocal_checkpointed : public hmm_glocal<system, hmm_phase_all, T>
+{
+    typedef hmm_glocal<system, hmm_phase_all, T> base;
+    typedef typename base::matrix_iterator matrix_iterator;
+
+    using base::bandWidth;
+    using base::bandWidth2;
+    using base::queryLen;
+    using base::forwardMatrix;
+    using base::scalingFactors;
+    using base::set_u;
+    using base::off;
+    using base::clear_row;
+    using base::init_row;
+
+    int interval;
+    int num_checkpoints;
+
+    hmm_glocal_checkpointed(firepony_context<system> ctx,
+                            const alignment_batch_device<system> batch,
+                            pointer<system, uint8> qualities,
+                            pointer<system, uint32> baq_state)
+        : base(ctx, batch, qualities, baq_state)
+    { }
+
+    // forward row c * k
+    CUDA_HOST_DEVICE matrix_iterator checkpoint_row(const int c)
+    {
+        return matrix_iterator(&forwardMatrix[off(c)]);
+    }
+
+    // forward row i inside the current segment
+    CUDA_HOST_DEVICE matrix_iterator segment_row(const int i)
+    {
+        return matrix_iterator(&forwardMatrix[off(num_checkpoints + i % interval)]);
+    }
 
-            x = i - bandWidth;
-            beg = beg > x? beg : x; // band start
+    // backward row i, double buffered
+    CUDA_HOST_DEVICE matrix_iterator backward_row(const int i)
+    {
+        const int segment_rows = interval < queryLen + 1 ? interval : queryLen + 1;
+        return matrix_iterator(&forwardMatrix[off(num_checkpoints + segment_rows + (i & 1))]);
+    }
 
-            x = i + bandWidth;
-            end = end < x? end : x; // band end
+    CUDA_HOST_DEVICE void copy_row(matrix_iterator dst, matrix_iterator src)
+    {
+        for (int j = 0; j < bandWidth2 * 3 + 6; j++)
+            dst[j] = src[j];
+    }
+
+    CUDA_HOST_DEVICE void compute_forward_row(const int i)
+    {
+        matrix_iterator fi = segment_row(i);
 
-            sum = 0.0;
-            for (k = beg; k <= end; ++k)
+        init_row(fi, i);
+
+        if (i == 1)
+            base::hmm_forward_first_row(fi);
+        else
+            base::hmm_forward_row(i, fi, segment_row(i - 1));
+    }
+
+    template <typename Tuple>
+    CUDA_HOST_DEVICE void operator() (const Tuple& hmm_index)
+    {
+        int i;
+
+        base::setup(hmm_index);
+
+        interval = this->ctx.baq.checkpoint_interval;
+        num_checkpoints = queryLen / interval + 1;
+
+        /*** forward ***/
+        // f[0]
+        clear_row(segment_row(0));
+        segment_row(0)[set_u(bandWidth, 0, 0)] = 1.0;
+        scalingFactors[0] = 1.0;
+        copy_row(checkpoint_row(0), segment_row(0));
+
+        // f[1..l_query], keeping every k-th row
+        for (i = 1; i <= queryLen; ++i)
+        {
+            compute_forward_row(i);
+
+            if (i % interval == 0)
+                copy_row(checkpoint_row(i / interval), segment_row(i));
+        }
+
+        // f[l_query+1]
+        base::hmm_forward_last_scaling(segment_row(queryLen));
+
+        /*** backward + MAP ***/
+        const int last_segment = queryLen / interval;
+        for (int s = last_segment; s >= 0; --s)
+        {
+            const int first = s * interval;
+            const int last = first + interval - 1 < queryLen ? first + interval - 1 : queryLen;
+
+            // the last segment is still in the segment buffer after the forward pass
+            if (s != last_segment)
             {
-                int u, v11, v01, v10;
-                double e = calcEpsilon(referenceBases[k-1], qyi, inputQualities[queryStart+i-1]);
-//                printf("read %d: referenceBases[%d-1] = %c inputQualities[%d+%d-1] = %d qyi = %c -> e = %.4f\n",
-//                       read_index,
-//                       k,
-//                       from_nvbio::iupac16_to_char(referenceBases[k-1]),
-//                       queryStart,
-//                       i,
-//                       inputQualities[queryStart+i-1],
-//                       from_nvbio::iupac16_to_char(qyi), e);
+                copy_row(segment_row(first), checkpoint_row(s));
+
+                for (i = first + 1; i <= last; ++i)
+                    compute_forward_row(i);
+            }
+
+            for (i = last; i >= first && i >= 1; --i)
+            {
+                matrix_iterator bi = backward_row(i);
+
+                init_row(bi, i);
+
+                if (i == queryLen)
+                    base::hmm_backward_last_row(bi);
+                else
+                    base::hmm_backward_row(i, bi, backward_row(i + 1));
+
+                base::hmm_map_row(i, segment_row(i), bi);
+            }
+        }
+    }
+};
+
+// runs the HMM on a group of baq_stride reads at once, one read per SIMD lane
+// the matrices of a group are interleaved (see stride_hmm_index), so the cells the lanes compute together are contiguous,
+// and every lane uses the row pitch of the widest band in the group (see compute_hmm_matrix_size_strided)
+// rows are stored along the band diagonal: cell (i, k) of a lane with band width b lives in column j = k - i + b, so the
+// cells each recurrence reads are in the same column for every lane, regardless of where their bands start
+// the lanes run over every column of the widest band; cells outside a lane's band are multiplied by zero, which keeps
+// them at zero like the guard cells of hmm_glocal, and cells inside the band are multiplied by one, which is exact
+// each lane performs the same operations in the same order as hmm_glocal does for its read, so the results are bit-identical
+template <target_system system, uint32 phase, typename T>
+struct hmm_glocal_lanes : public lambda<system>
+{
+    typedef hmm_read_state<system, T> state;
+
+    static constexpr int lanes = baq_stride<system>::stride;
+
+    pointer<system, uint32> active_read_list;
+    uint32 num_reads;
+    pointer<system, uint8> qualities;
+    pointer<system, uint32> baq_state;
+
+    // state for one group of reads, with the values used in the inner loops stored as one array per field
+    struct group
+    {
+        state read[lanes];
+
+        int queryLen[lanes];
+        int referenceLength[lanes];
+        int bandWidth[lanes];
+
+        T m[9][lanes];
+        T sM[lanes], sI[lanes], bM[lanes], bI[lanes];
+
+        // band of the current row: reference positions [beg, end] and the same range as columns [lo, hi]
+        int beg[lanes], end[lanes];
+        T lo[lanes], hi[lanes];
+
+        T *forward, *backward, *scaling;
+
+        int width;          // number of columns, 2 * widest band width + 1
+        int max_query_len;
+    };
+
+    hmm_glocal_lanes(firepony_context<system> ctx,
+                     const alignment_batch_device<system> batch,
+                     pointer<system, uint32> active_read_list,
+                     uint32 num_reads,
+                     pointer<system, uint8> qualities,
+                     pointer<system, uint32> baq_state)
+        : lambda<system>(ctx, batch),
+          active_read_list(active_read_list),
+          num_reads(num_reads),
+          qualities(qualities),
+          baq_state(baq_state)
+    { }
+
+    CUDA_HOST_DEVICE void setup(group& g, const uint32 group_index)
+    {
+        baq_context<system>& baq = this->ctx.baq;
+        const uint32 first = group_index * lanes;
+
+        g.width = 0;
+        g.max_query_len = 0;
+
+        for(int l = 0; l < lanes; l++)
+        {
+            if (first + l < num_reads)
+            {
+                state& r = g.read[l];
+                r.setup(this->ctx, this->batch, qualities, baq_state,
+                        active_read_list[first + l], baq.matrix_index[first + l], baq.scaling_index[first + l]);
+
+                g.queryLen[l] = r.queryLen;
+                g.referenceLength[l] = r.referenceLength;
+                g.bandWidth[l] = r.bandWidth;
+
+                for(int j = 0; j < 9; j++)
+                    g.m[j][l] = r.m[j];
+
+                g.sM[l] = r.sM;
+                g.sI[l] = r.sI;
+                g.bM[l] = r.bM;
+                g.bI[l] = r.bI;
+
+                g.width = max(g.width, r.bandWidth2);
+                g.max_query_len = max(g.max_query_len, r.queryLen);
+            } else {
+                // padding lane, never active
+                g.queryLen[l] = 0;
+                g.referenceLength[l] = 0;
+                g.bandWidth[l] = 0;
+
+                for(int j = 0; j < 9; j++)
+                    g.m[j][l] = 0.0;
+
+                g.sM[l] = g.sI[l] = g.bM[l] = g.bI[l] = 0.0;
+            }
+        }
+
+        g.forward = &hmm_storage<system, T>::forward(baq)[baq.matrix_index[first]];
+        g.backward = &hmm_storage<system, T>::backward(baq)[baq.matrix_index[first]];
+        g.scaling = &hmm_storage<system, T>::scaling(baq)[baq.scaling_index[first]];
+    }
+
+    // row i of a group matrix
+    // column j holds cells (j + 1) * 3 .. (j + 1) * 3 + 2, with a column of zeros on either side; cell c of lane l is at [c * lanes + l]
+    CUDA_HOST_DEVICE T *row(const group& g, T *matrix, const int i)
+    {
+        return matrix + i * (g.width * 3 + 6) * lanes;
+    }
+
+    CUDA_HOST_DEVICE T *column(T *r, const int j)
+    {
+        return r + (j + 1) * 3 * lanes;
+    }
+
+    CUDA_HOST_DEVICE void clear_row(const group& g, T *r)
+    {
+        for(int c = 0; c < (g.width * 3 + 6) * lanes; c++)
+            r[c] = 0.0;
+    }
+
+    // zeroes the columns on either side of the band
+    CUDA_HOST_DEVICE void clear_guards(const group& g, T *r)
+    {
+        for(int c = 0; c < 3 * lanes; c++)
+        {
+            column(r, -1)[c] = 0.0;
+            column(r, g.width)[c] = 0.0;
+        }
+    }
+
+    // computes the band of row i for every lane
+    // lanes that are not active in this row get an empty band
+    CUDA_HOST_DEVICE void band(group& g, const int i, const bool active[lanes])
+    {
+        for(int l = 0; l < lanes; l++)
+        {
+            const int b = g.bandWidth[l];
+
+            g.beg[l] = 1 > i - b ? 1 : i - b;
+            g.end[l] = g.referenceLength[l] < i + b ? g.referenceLength[l] : i + b;
+
+            if (!active[l] || g.end[l] < g.beg[l])
+            {
+                g.beg[l] = 1;
+                g.end[l] = 0;
+            }
+
+            g.lo[l] = T(g.beg[l] - i + b);
+            g.hi[l] = T(g.end[l] - i + b);
+        }
+    }
+
+    // computes and rescales f[1]
+    CUDA_HOST_DEVICE void forward_first_row(group& g)
+    {
+        T *fi = row(g, g.forward, 1);
+        T sum[lanes], bM[lanes], bI[lanes];
+        bool active[lanes];
+
+        for(int l = 0; l < lanes; l++)
+            active[l] = g.queryLen[l] >= 1;
 
-                u = set_u(bandWidth, i, k);
-                v11 = set_u(bandWidth, i-1, k-1);
-                v10 = set_u(bandWidth, i-1, k);
-                v01 = set_u(bandWidth, i, k-1);
+        band(g, 1, active);
 
-                fi[u+0] = e * (m[0] * fi1[v11+0] + m[3] * fi1[v11+1] + m[6] * fi1[v11+2]);
-                fi[u+1] = EI * (m[1] * fi1[v10+0] + m[4] * fi1[v10+1]);
-                fi[u+2] = m[2] * fi[v01+0] + m[8] * fi[v01+2];
+        // stage the emission probabilities in the match cells
+        for(int l = 0; l < lanes; l++)
+        {
+            state& r = g.read[l];
+
+            for(int j = 0; j < g.width; j++)
+            {
+                const int k = j + 1 - g.bandWidth[l];
+                column(fi, j)[l] = (k >= g.beg[l] && k <= g.end[l]) ?
+                                        r.calcEpsilon(r.referenceBases[k-1], r.queryBases[r.queryStart], r.inputQualities[r.queryStart]) : T(0.0);
+            }
+
+            sum[l] = 0.0;
+            bM[l] = g.bM[l];
+            bI[l] = g.bI[l];
+        }
+
+        clear_guards(g, fi);
+
+        for(int j = 0; j < g.width; j++)
+        {
+            T *u = column(fi, j);
+            const T dj = T(j);
+
+            #pragma omp simd
+            for(int l = 0; l < lanes; l++)
+            {
+                const T mask = (g.lo[l] <= dj && dj <= g.hi[l]) ? T(1.0) : T(0.0);
+
+                const T f0 = u[l] * bM[l] * mask;
+                const T f1 = T(EI) * bI[l] * mask;
+
+                u[l] = f0;
+                u[lanes + l] = f1;
+                u[2 * lanes + l] = 0.0;
+                sum[l] = sum[l] + (f0 + f1);
+            }
+        }
+
+        // rescale
+        for(int l = 0; l < lanes; l++)
+        {
+            if (active[l])
+                g.scaling[1 * lanes + l] = sum[l];
+
+            if (g.end[l] < g.beg[l])
+                sum[l] = 1.0;
+        }
+
+        for(int j = 0; j < g.width; j++)
+        {
+            T *u = column(fi, j);
+
+            #pragma omp simd
+            for(int l = 0; l < lanes; l++)
+            {
+                u[l] = u[l] / sum[l];
+                u[lanes + l] = u[lanes + l] / sum[l];
+                u[2 * lanes + l] = u[2 * lanes + l] / sum[l];
+            }
+        }
+    }
+
+    // computes and rescales f[i] for i >= 2 from f[i-1]
+    CUDA_HOST_DEVICE void forward_row(group& g, const int i)
+    {
+        T *fi = row(g, g.forward, i);
+        T *fi1 = row(g, g.forward, i - 1);
+        T sum[lanes], m0[lanes], m1[lanes], m2[lanes], m3[lanes], m4[lanes], m6[lanes], m8[lanes];
+        bool active[lanes];
+
+        for(int l = 0; l < lanes; l++)
+            active[l] = g.queryLen[l] >= i;
+
+        band(g, i, active);
+
+        // stage the emission probabilities in the match cells, which the recurrence reads once before overwriting them
+        for(int l = 0; l < lanes; l++)
+        {
+            state& r = g.read[l];
+
+            for(int j = 0; j < g.width; j++)
+            {
+                const int k = j + i - g.bandWidth[l];
+                column(fi, j)[l] = (k >= g.beg[l] && k <= g.end[l]) ?
+                                        r.calcEpsilon(r.referenceBases[k-1], r.queryBases[r.queryStart+i-1], r.inputQualities[r.queryStart+i-1]) : T(0.0);
+            }
+
+            sum[l] = 0.0;
+            m0[l] = g.m[0][l];
+            m1[l] = g.m[1][l];
+            m2[l] = g.m[2][l];
+            m3[l] = g.m[3][l];
+            m4[l] = g.m[4][l];
+            m6[l] = g.m[6][l];
+            m8[l] = g.m[8][l];
+        }
+
+        clear_guards(g, fi);
+
+        for(int j = 0; j < g.width; j++)
+        {
+            // (i, k) is in column j, (i, k-1) in j-1, (i-1, k-1) in j and (i-1, k) in j+1
+            T *u = column(fi, j);
+            const T *v01 = column(fi, j - 1);
+            const T *v11 = column(fi1, j);
+            const T *v10 = column(fi1, j + 1);
+            const T dj = T(j);
+
+            #pragma omp simd
+            for(int l = 0; l < lanes; l++)
+            {
+                const T mask = (g.lo[l] <= dj && dj <= g.hi[l]) ? T(1.0) : T(0.0);
 
-                sum += fi[u] + fi[u+1] + fi[u+2];
+                const T f0 = u[l] * (m0[l] * v11[l] + m3[l] * v11[lanes + l] + m6[l] * v11[2 * lanes + l]) * mask;
+                const T f1 = T(EI) * (m1[l] * v10[l] + m4[l] * v10[lanes + l]) * mask;
+                const T f2 = (m2[l] * v01[l] + m8[l] * v01[2 * lanes + l]) * mask;
 
-//                printf("(%d,%d;%d): %.32f,%.32f,%.32f\n", i, k, u, fi[u], fi[u+1], fi[u+2]);
-//                printf(" .. u = %d v11 = %d v01 = %d v10 = %d e = %f\n", u, v11, v01, v10, e);
-//                printf("HMM: %d, %d, %d, %d, %d, %d, %d, %d, %d, %.32f, %.32f, %.32f, %.32f, %.32f, %.32f, %.32f, %.32f, %.32f, %.32f, %.32f\n",
-//                       i, k, u,
-//                       from_nvbio::iupac16_to_char(uint8(referenceBases[k-1])), from_nvbio::iupac16_to_char(qyi), uint8(inputQualities[queryStart+i-1]),
-//                       v01, v10, v11,
-//                       e,
-//                       fi1[v01+0], fi1[v01+1],
-//                       fi1[v10+0], fi1[v10+1],
-//                       fi1[v11+0], fi1[v11+1], fi1[v11+2],
-//                       fi[u+0], fi[u+1], fi[u+2]);
+                u[l] = f0;
+                u[lanes + l] = f1;
+                u[2 * lanes + l] = f2;
+                sum[l] = sum[l] + (f0 + f1 + f2);
             }
+        }
 
-            // rescale
-            scalingFactors[i] = sum;
-
-            _beg = set_u(bandWidth, i, beg);
-            _end = set_u(bandWidth, i, end);
-            _end += 2;
+        // rescale
+        for(int l = 0; l < lanes; l++)
+        {
+            if (active[l])
+                g.scaling[i * lanes + l] = sum[l];
 
-            for (k = _beg, sum = 1./sum; k <= _end; ++k)
-                fi[k] *= sum;
+            sum[l] = g.end[l] < g.beg[l] ? T(1.) : T(1.) / sum[l];
         }
 
-        { // f[l_query+1]
-            double sum = 0.0;
+        for(int j = 0; j < g.width; j++)
+        {
+            T *u = column(fi, j);
 
-            for (k = 1; k <= referenceLength; ++k)
+            #pragma omp simd
+            for(int l = 0; l < lanes; l++)
             {
-                int u = set_u(bandWidth, queryLen, k);
+                u[l] = u[l] * sum[l];
+                u[lanes + l] = u[lanes + l] * sum[l];
+                u[2 * lanes + l] = u[2 * lanes + l] * sum[l];
+            }
+        }
+    }
 
-                if (u < 3 || u >= bandWidth2*3+3)
-                    continue;
+    // computes the last scaling factor for the lanes whose last row is i
+    // hmm_glocal sums across the full width of the last row, but the cells outside the band are zero and don't change the sum
+    CUDA_HOST_DEVICE void forward_last_scaling(group& g, const int i)
+    {
+        T *fq = row(g, g.forward, i);
+
+        for(int l = 0; l < lanes; l++)
+        {
+            if (g.queryLen[l] != i)
+                continue;
 
-                sum += forwardMatrix[off(queryLen,u+0)] * sM + forwardMatrix[off(queryLen, u+1)] * sI;
+            T sum = 0.0;
+            for(int k = g.beg[l]; k <= g.end[l]; k++)
+            {
+                const T *u = column(fq, k - i + g.bandWidth[l]);
+                sum += u[l] * g.sM[l] + u[lanes + l] * g.sI[l];
             }
 
-            scalingFactors[queryLen+1] = sum; // the last scaling factor
+            g.scaling[(i + 1) * lanes + l] = sum;
         }
     }
 
-    template <typename Tuple>
-    CUDA_HOST_DEVICE void hmm_backward(const Tuple& hmm_index)
+    CUDA_HOST_DEVICE void forward(group& g)
     {
-        int i, k;
+        // f[0] is never read, only its scaling factor is set
+        for(int l = 0; l < lanes; l++)
+        {
+            if (g.queryLen[l])
+                g.scaling[l] = 1.0;
+        }
 
-        /*** backward ***/
-        // b[l_query] (b[l_query+1][0]=1 and thus \tilde{b}[][]=1/s[l_query+1]; this is where s[l_query+1] comes from)
-        for (k = 1; k <= referenceLength; ++k)
+        forward_first_row(g);
+        forward_last_scaling(g, 1);
+
+        for(int i = 2; i <= g.max_query_len; i++)
         {
-            int u = set_u(bandWidth, queryLen, k);
-            matrix_iterator bi(&backwardMatrix[off(queryLen)]);
+            forward_row(g, i);
+            forward_last_scaling(g, i);
+        }
+    }
 
-            if (u < 3 || u >= bandWidth2*3+3)
-                continue;
+    // computes b[i] from b[i+1] for the lanes where i is not the last row, then b[l_query] for the lanes where it is
+    CUDA_HOST_DEVICE void backward_row(group& g, const int i)
+    {
+        T *bi = row(g, g.backward, i);
+        T *bi1 = row(g, g.backward, i + 1);
+        T scale[lanes], m0[lanes], m1[lanes], m2[lanes], m3[lanes], m4[lanes], m6[lanes], m8[lanes];
+        bool active[lanes];
+        bool any_active = false;
 
-            bi[u+0] = sM / scalingFactors[queryLen] / scalingFactors[queryLen+1];
-            bi[u+1] = sI / scalingFactors[queryLen] / scalingFactors[queryLen+1];
+        for(int l = 0; l < lanes; l++)
+        {
+            active[l] = g.queryLen[l] > i;
+            any_active |= active[l];
         }
 
-        // b[l_query-1..1]
-        for (i = queryLen - 1; i >= 1; --i)
+        if (any_active)
         {
-            int beg = 1;
-            int end = referenceLength;
-            int x, _beg, _end;
+            band(g, i, active);
+
+            // stage the emission probabilities in the match cells
+            for(int l = 0; l < lanes; l++)
+            {
+                state& r = g.read[l];
 
-            matrix_iterator bi(&backwardMatrix[off(i)]);
-            matrix_iterator bi1(&backwardMatrix[off(i+1)]);
+                for(int j = 0; j < g.width; j++)
+                {
+                    const int k = j + i - g.bandWidth[l];
 
-            double y = (i > 1)? 1. : 0.;
+                    // e is zero at the end of the reference
+                    column(bi, j)[l] = (k >= g.beg[l] && k <= g.end[l] && k < g.referenceLength[l]) ?
+                                            r.calcEpsilon(r.referenceBases[k], r.queryBases[r.queryStart+i], r.inputQualities[r.queryStart+i]) : T(0.0);
+                }
 
-            char qyi1 = queryBases[queryStart+i];
+                scale[l] = active[l] ? T(1.0) / g.scaling[i * lanes + l] : T(1.0);
+                m0[l] = g.m[0][l];
+                m1[l] = g.m[1][l];
+                m2[l] = g.m[2][l];
+                m3[l] = g.m[3][l];
+                m4[l] = g.m[4][l];
+                m6[l] = g.m[6][l];
+                m8[l] = g.m[8][l];
+            }
 
-            x = i - bandWidth;
-            beg = beg > x? beg : x;
+            clear_guards(g, bi);
 
-            x = i + bandWidth;
-            end = end < x? end : x;
+            const T y = (i > 1)? 1. : 0.;
 
-            for (k = end; k >= beg; --k)
+            for(int j = g.width - 1; j >= 0; j--)
             {
-                int u, v11, v01, v10;
+                // (i, k) is in column j, (i, k+1) in j+1, (i+1, k+1) in j and (i+1, k) in j-1
+                T *u = column(bi, j);
+                const T *v01 = column(bi, j + 1);
+                const T *v11 = column(bi1, j);
+                const T *v10 = column(bi1, j - 1);
+                const T dj = T(j);
+
+                #pragma omp simd
+                for(int l = 0; l < lanes; l++)
+                {
+                    const T mask = (g.lo[l] <= dj && dj <= g.hi[l]) ? T(1.0) : T(0.0);
 
-                u = set_u(bandWidth, i, k);
-                v11 = set_u(bandWidth, i+1, k+1);
-                v10 = set_u(bandWidth, i+1, k);
-                v01 = set_u(bandWidth, i, k+1);
+                    // bi1[v11] is folded into e
+                    const T e = u[l] * v11[l];
 
-                /* const */ double e;
-                if (k >= referenceLength)
-                    e = 0;
-                else
-                    e = calcEpsilon(referenceBases[k], qyi1, inputQualities[queryStart+i]) * bi1[v11];
+                    const T b0 = (e * m0[l] + T(EI) * m1[l] * v10[lanes + l] + m2[l] * v01[2 * lanes + l]) * mask;
+                    const T b1 = (e * m3[l] + T(EI) * m4[l] * v10[lanes + l]) * mask;
+                    const T b2 = ((e * m6[l] + m8[l] * v01[2 * lanes + l]) * y) * mask;
 
-                bi[u+0] = e * m[0] + EI * m[1] * bi1[v10+1] + m[2] * bi[v01+2]; // bi1[v11] has been folded into e.
-                bi[u+1] = e * m[3] + EI * m[4] * bi1[v10+1];
-                bi[u+2] = (e * m[6] + m[8] * bi[v01+2]) * y;
+                    u[l] = b0;
+                    u[lanes + l] = b1;
+                    u[2 * lanes + l] = b2;
+                }
             }
 
             // rescale
-            _beg = set_u(bandWidth, i, beg);
-            _end = set_u(bandWidth, i, end);
-            _end += 2;
+            for(int j = 0; j < g.width; j++)
+            {
+                T *u = column(bi, j);
 
-            y = 1.0 / scalingFactors[i];
-            for (k = _beg; k <= _end; ++k)
-                bi[k] *= y;
+                #pragma omp simd
+                for(int l = 0; l < lanes; l++)
+                {
+                    u[l] = u[l] * scale[l];
+                    u[lanes + l] = u[lanes + l] * scale[l];
+                    u[2 * lanes + l] = u[2 * lanes + l] * scale[l];
+                }
+            }
+        } else {
+            // no lane has a row i + 1
+            clear_row(g, bi);
         }
 
-//        double pb = 0.0;
-        { // b[0]
-            int beg = 1;
-            int end = referenceLength < bandWidth + 1? referenceLength : bandWidth + 1;
+        // b[l_query]
+        // hmm_glocal also fills the cells past the end of the band here, but nothing reads them
+        bool last[lanes];
+        for(int l = 0; l < lanes; l++)
+            last[l] = g.queryLen[l] == i;
 
-            double sum = 0.0;
-            for (k = end; k >= beg; --k)
-            {
-                int u = set_u(bandWidth, 1, k);
-                double e = calcEpsilon(referenceBases[k-1], queryBases[queryStart], inputQualities[queryStart]);
+        band(g, i, last);
 
-                if (u < 3 || u >= bandWidth2*3+3)
-                    continue;
+        for(int l = 0; l < lanes; l++)
+        {
+            for(int k = g.beg[l]; k <= g.end[l]; k++)
+            {
+                T *u = column(bi, k - i + g.bandWidth[l]);
 
-                sum += e * backwardMatrix[off(1, u+0)] * bM + EI * backwardMatrix[off(1, u+1)] * bI;
+                u[l] = g.sM[l] / g.scaling[i * lanes + l] / g.scaling[(i + 1) * lanes + l];
+                u[lanes + l] = g.sI[l] / g.scaling[i * lanes + l] / g.scaling[(i + 1) * lanes + l];
             }
-
-            backwardMatrix[off(0, set_u(bandWidth, 0, 0))] = sum / scalingFactors[0];
-//            pb = backwardMatrix[off(0, set_u(bandWidth, 0, 0))]; // if everything works as is expected, pb == 1.0
         }
     }
 
-    template <typename Tuple>
-    CUDA_HOST_DEVICE void hmm_map(const Tuple& hmm_index)
+    // b[0] is not computed: hmm_glocal only uses it as a sanity check and nothing reads it
+    CUDA_HOST_DEVICE void backward(group& g)
     {
-        int i, k;
+        for(int i = g.max_query_len; i >= 1; i--)
+            backward_row(g, i);
+    }
 
-        /*** MAP ***/
-        for (i = 1; i <= queryLen; ++i)
+    // computes the MAP state and BAQ quality for query position i from f[i] and b[i]
+    // cells outside the band are zero on both sides, so they add nothing to the sum and never become the maximum
+    CUDA_HOST_DEVICE void map_row(group& g, const int i)
+    {
+        T *fi = row(g, g.forward, i);
+        T *bi = row(g, g.backward, i);
+        T sum[lanes], max_z[lanes], max_cell[lanes];
+
+        for(int l = 0; l < lanes; l++)
         {
-            double sum = 0.0;
-            double max = 0.0;
+            sum[l] = 0.0;
+            max_z[l] = 0.0;
+            max_cell[l] = -1.0;
+        }
 
-            matrix_iterator fi(&forwardMatrix[off(i)]);
-            matrix_iterator bi(&backwardMatrix[off(i)]);
+        for(int j = 0; j < g.width; j++)
+        {
+            const T *f = column(fi, j);
+            const T *b = column(bi, j);
+            const T dj = T(j);
 
-            int beg = 1;
-            int end = referenceLength;
-            int x, max_k = -1;
+            // the maximum tracking does not vectorize under strict IEEE semantics, but the lanes still share the loop
+            for(int l = 0; l < lanes; l++)
+            {
+                const T z0 = f[l] * b[l];
+                sum[l] = sum[l] + z0;
+                max_cell[l] = z0 > max_z[l] ? dj * 2 : max_cell[l];
+                max_z[l] = z0 > max_z[l] ? z0 : max_z[l];
+
+                const T z1 = f[lanes + l] * b[lanes + l];
+                sum[l] = sum[l] + z1;
+                max_cell[l] = z1 > max_z[l] ? dj * 2 + 1 : max_cell[l];
+                max_z[l] = z1 > max_z[l] ? z1 : max_z[l];
+            }
+        }
 
-            x = i - bandWidth;
-            beg = beg > x? beg : x;
+        for(int l = 0; l < lanes; l++)
+        {
+            if (i > g.queryLen[l])
+                continue;
 
-            x = i + bandWidth;
-            end = end < x? end : x;
+            state& r = g.read[l];
+            const T max = max_z[l] / sum[l];
 
-            for (k = beg; k <= end; ++k)
+            int max_k = -1;
+            if (max_cell[l] >= 0)
             {
-                const int u = set_u(bandWidth, i, k);
-                double z = 0.0;
-
-                z = fi[u+0] * bi[u+0];
-                sum += z;
-                if (z > max)
-                {
-                    max = z;
-                    max_k = (k-1) << 2 | 0;
-                }
-
-                z = fi[u+1] * bi[u+1];
-                sum += z;
-                if (z > max)
-                {
-                    max = z;
-                    max_k = (k-1) << 2 | 1;
-                }
+                const int cell = int(max_cell[l]);
+                const int k = cell / 2 + i - g.bandWidth[l];
+                max_k = (k-1) << 2 | (cell & 1);
             }
 
-            max /= sum;
-            sum *= scalingFactors[i]; // if everything works as is expected, sum == 1.0
-
-            if (outputState != NULL)
-                outputState[queryStart+i-1] = max_k;
+            if (r.outputState != NULL)
+                r.outputState[r.queryStart+i-1] = max_k;
 
-            if (outputQualities != NULL)
+            if (r.outputQualities != NULL)
             {
-                k = (int)(double(-4.343) * log(double(1.0) - double(max)) + double(.499)); // = 10*log10(1-max)
-                outputQualities[queryStart+i-1] = (char)(k > 100? 99 : (k < MIN_BASE_QUAL ? MIN_BASE_QUAL : k));
-
-//                printf("outputQualities[%d]: max = %.16f k = %d -> %d\n", queryStart+i-1, max, k, outputQualities[queryStart+i-1]);
+                const int k = (int)(double(-4.343) * log(double(1.0) - double(max)) + double(.499)); // = 10*log10(1-max)
+                r.outputQualities[r.queryStart+i-1] = (char)(k > 100? 99 : (k < MIN_BASE_QUAL ? MIN_BASE_QUAL : k));
             }
-
-//            printf("(%.4f,%.4f) (%d,%d,%d,%.4f)\n", pb, sum, (i-1), (max_k>>2), (max_k&3), max);
         }
     }
 
-    template <typename Tuple>
-    CUDA_HOST_DEVICE void operator() (const Tuple& hmm_index)
+    CUDA_HOST_DEVICE void map(group& g)
     {
-        setup(hmm_index);
+        for(int i = 1; i <= g.max_query_len; i++)
+            map_row(g, i);
+    }
+
+    CUDA_HOST_DEVICE void operator() (const uint32 group_index)
+    {
+        group g;
+
+        setup(g, group_index);
 
         if (phase & hmm_phase_forward)
-            hmm_forward(hmm_index);
+            forward(g);
 
         if (phase & hmm_phase_backward)
-            hmm_backward(hmm_index);
+            backward(g);
 
         if (phase & hmm_phase_map)
-            hmm_map(hmm_index);
+            map(g);
     }
 };
 
@@ -706,7 +1605,20 @@ struct compute_hmm_matrix_size : public thrust::unary_function<uint32, uint32>,
     CUDA_HOST_DEVICE uint32 operator() (const uint32 read_index)
     {
         const CRQ_index idx = batch.crq_index(read_index);
-        return hmm_glocal<system, hmm_phase_all>::matrix_size(idx.read_len, ctx.baq.bandwidth[read_index]);
+        return hmm_read_state<system, double>::matrix_size(idx.read_len, ctx.baq.bandwidth[read_index], ctx.baq.checkpoint_interval);
+    }
+};
+
+// scheduling key for BAQ reads: larger HMM matrices sort first
+template <target_system system>
+struct compute_hmm_schedule_key : public thrust::unary_function<uint32, uint32>, public lambda<system>
+{
+    LAMBDA_INHERIT;
+
+    CUDA_HOST_DEVICE uint32 operator() (const uint32 read_index)
+    {
+        const CRQ_index idx = batch.crq_index(read_index);
+        return ~hmm_read_state<system, double>::matrix_size(idx.read_len, ctx.baq.bandwidth[read_index], ctx.baq.checkpoint_interval);
     }
 };
 
@@ -730,6 +1642,8 @@ struct compute_hmm_matrix_size_strided : public lambda<system>
     CUDA_HOST_DEVICE void operator() (const uint32 index)
     {
         uint32 ret = 0;
+        uint32 max_read_len = 0;
+        int max_bandwidth = 0;
 
         // smear the max matrix size across the thread group so we can stride it later on
         constexpr uint32 stride = baq_stride<system>::stride;
@@ -742,11 +1656,20 @@ struct compute_hmm_matrix_size_strided : public lambda<system>
             {
                 const uint32 read_index = active_read_list[i];
                 const CRQ_index idx = batch.crq_index(read_index);
-                const uint32 size = hmm_glocal<system, hmm_phase_all>::matrix_size(idx.read_len, ctx.baq.bandwidth[read_index]);
+                const uint32 size = hmm_read_state<system, double>::matrix_size(idx.read_len, ctx.baq.bandwidth[read_index], ctx.baq.checkpoint_interval);
                 ret = max(ret, size);
+
+                max_read_len = max(max_read_len, idx.read_len);
+                max_bandwidth = max(max_bandwidth, int(ctx.baq.bandwidth[read_index]));
             }
         }
 
+        if (baq_stride<system>::uniform_rows)
+        {
+            // every read in the group uses the row pitch of the widest band (see hmm_glocal_lanes)
+            ret = hmm_read_state<system, double>::matrix_size(max_read_len, max_bandwidth, ctx.baq.checkpoint_interval);
+        }
+
         matrix_size_output[index] = ret;
     }
 };
@@ -833,12 +1756,23 @@ struct read_needs_baq : public lambda<system>
     CUDA_HOST_DEVICE bool operator() (const uint32 read_index)
     {
         if (ctx.cigar.num_errors[read_index] != 0)
-            return true;
+            return !ctx.baq.skips_read(ctx.cigar.read_window_clipped[read_index]);
 
         return false;
     }
 };
 
+template <target_system system>
+struct read_skips_baq : public lambda<system>
+{
+    LAMBDA_INHERIT;
+
+    CUDA_HOST_DEVICE uint32 operator() (const uint32 read_index)
+    {
+        return (ctx.cigar.num_errors[read_index] != 0 && ctx.baq.skips_read(ctx.cigar.read_window_clipped[read_index]));
+    }
+};
+
 template <target_system system>
 struct read_flat_baq : public lambda<system>
 {
@@ -851,14 +1785,14 @@ struct read_flat_baq : public lambda<system>
             return;
         }
 
-        if (ctx.cigar.num_errors[read_index] != 0)
+        const CRQ_index idx = batch.crq_index(read_index);
+        const read_coord2& read_window = ctx.cigar.read_window_clipped[read_index];
+
+        if (ctx.cigar.num_errors[read_index] != 0 && !ctx.baq.skips_read(read_window))
         {
             // reads with errors will have BAQ computed explicitly
             return;
         }
-
-        const CRQ_index idx = batch.crq_index(read_index);
-        const ushort2& read_window = ctx.cigar.read_window_clipped[read_index];
         const uint32 queryStart = read_window.x;
         const uint32 queryLen = read_window.y - read_window.x + 1;
         uint8 *outputQualities = &ctx.baq.qualities[idx.qual_start] + queryStart;
@@ -913,9 +1847,9 @@ struct cap_baq_qualities : public lambda<system>
                                    const uint32 cigar_start,
                                    const uint32 cigar_end,
                                    const uint32 baq_start,
-                                   const ushort2 read_window_clipped,
-                                   const ushort2 reference_window_clipped,
-                                   const short2 hmm_reference_window)
+                                   const read_coord2 read_window_clipped,
+                                   const read_coord2 reference_window_clipped,
+                                   const signed_read_coord2 hmm_reference_window)
     {
         uint32 readI = 0;
         uint32 refI = 0;
@@ -924,7 +1858,7 @@ struct cap_baq_qualities : public lambda<system>
         // compute the shift applied to the reference during BAQ setup
         // this happens if the computed HMM window start lies before the chromosome start (i.e., the start coordinate is negative)
         // also computes the shift in expected read BP positions that is present in the BAQ state vector
-        int16 reference_shift, read_shift;
+        signed_read_coord reference_shift, read_shift;
         if (hmm_reference_window.x < 0 && batch.alignment_start[read_index] < abs(hmm_reference_window.x))
         {
             reference_shift = abs(hmm_reference_window.x);
@@ -935,14 +1869,16 @@ struct cap_baq_qualities : public lambda<system>
         }
 
         // compute the reference window offset
-        const int16 refOffset = hmm_reference_window.x - reference_window_clipped.x + reference_shift;
+        const signed_read_coord refOffset = hmm_reference_window.x - reference_window_clipped.x + reference_shift;
+
+        auto events = ctx.cigar.events(batch, read_index);
 
         for(uint32 i = baq_start; i < cigar_end - cigar_start; i++)
         {
-            const uint16 read_bp_idx = ctx.cigar.cigar_event_read_coordinates[cigar_start + i];
+            const read_coord read_bp_idx = events.read_coordinate(cigar_start + i);
             const uint32 qual_idx = idx.qual_start + read_bp_idx;
 
-            if (read_bp_idx != uint16(-1))
+            if (read_bp_idx != read_coord(-1))
             {
                 if (read_bp_idx < read_window_clipped.x)
                     continue;
@@ -951,7 +1887,7 @@ struct cap_baq_qualities : public lambda<system>
                     break;
             }
 
-            switch(ctx.cigar.cigar_events[i + cigar_start])
+            switch(events.event(i + cigar_start))
             {
             case cigar_event::S:
                 refI++;
@@ -1005,19 +1941,20 @@ struct cap_baq_qualities : public lambda<system>
     {
         const CRQ_index idx = batch.crq_index(read_index);
 
-        const uint32 cigar_start = ctx.cigar.cigar_offsets[idx.cigar_start];
-        const uint32 cigar_end = ctx.cigar.cigar_offsets[idx.cigar_start + idx.cigar_len];
+        const uint32 cigar_start = ctx.cigar.cigar_event_range[read_index].x;
+        const uint32 cigar_end = ctx.cigar.cigar_event_range[read_index].y;
 
         const auto read_window_clipped = ctx.cigar.read_window_clipped[read_index];
         const auto reference_window_clipped = ctx.cigar.reference_window_clipped[read_index];
         const auto hmm_reference_window = ctx.baq.hmm_reference_windows[read_index];
 
         // scan for the start of the baq region
+        auto events = ctx.cigar.events(batch, read_index);
         uint32 baq_start = 0;
         for(uint32 i = 0; i < cigar_end - cigar_start; i++)
         {
-            const uint16 read_bp_idx = ctx.cigar.cigar_event_read_coordinates[cigar_start + i];
-            if (read_bp_idx != uint16(-1) && read_bp_idx >= read_window_clipped.x)
+            const read_coord read_bp_idx = events.read_coordinate(cigar_start + i);
+            if (read_bp_idx != read_coord(-1) && read_bp_idx >= read_window_clipped.x)
             {
                 baq_start = i;
                 break;
@@ -1080,6 +2017,248 @@ struct recode_baq_qualities : public lambda<system>
     }
 };
 
+// runs the HMM one read per thread
+template <uint32 phase, typename T, target_system system>
+static void run_hmm_glocal_reads(firepony_context<system>& context,
+                                 const alignment_batch<system>& batch,
+                                 persistent_allocation<system, uint32>& active_baq_read_list,
+                                 uint32 num_reads,
+                                 persistent_allocation<system, uint8>& qualities,
+                                 persistent_allocation<system, uint32>& baq_state)
+{
+    struct baq_context<system>& baq = context.baq;
+
+    auto hmm_index = thrust::make_zip_iterator(thrust::make_tuple(active_baq_read_list.begin(),
+                                                                  baq.matrix_index.begin(),
+                                                                  baq.scaling_index.begin()));
+
+    parallel<system>::for_each(hmm_index,
+                               hmm_index + num_reads,
+                               hmm_glocal<system, phase, T>(context, batch.device, qualities, baq_state));
+}
+
+// the GPU runs one read per thread
+template <uint32 phase, typename T>
+static void run_hmm_glocal(firepony_context<cuda>& context,
+                           const alignment_batch<cuda>& batch,
+                           persistent_allocation<cuda, uint32>& active_baq_read_list,
+                           uint32 num_reads,
+                           persistent_allocation<cuda, uint8>& qualities,
+                           persistent_allocation<cuda, uint32>& baq_state)
+{
+    run_hmm_glocal_reads<phase, T>(context, batch, active_baq_read_list, num_reads, qualities, baq_state);
+}
+
+// runs the HMM on the host, one group of baq_stride reads at a time with a read in each SIMD lane
+template <uint32 phase, typename T>
+static void run_hmm_glocal(firepony_context<host>& context,
+                           const alignment_batch<host>& batch,
+                           persistent_allocation<host, uint32>& active_baq_read_list,
+                           uint32 num_reads,
+                           persistent_allocation<host, uint8>& qualities,
+                           persistent_allocation<host, uint32>& baq_state)
+{
+    constexpr uint32 stride = baq_stride<host>::stride;
+    const uint32 num_groups = (num_reads + stride - 1) / stride;
+
+    parallel<host>::for_each(thrust::make_counting_iterator(0u),
+                             thrust::make_counting_iterator(0u) + num_groups,
+                             hmm_glocal_lanes<host, phase, T>(context, batch.device, active_baq_read_list, num_reads, qualities, baq_state));
+}
+
+// runs the given HMM phases in precision T over the first num_reads reads in the active BAQ list
+// BAQ qualities are written to qualities; baq_state can be empty, in which case no state is recorded
+template <uint32 phase, typename T, target_system system>
+static void run_hmm(firepony_context<system>& context,
+                    const alignment_batch<system>& batch,
+                    persistent_allocation<system, uint32>& active_baq_read_list,
+                    uint32 num_reads,
+                    persistent_allocation<system, uint8>& qualities,
+                    persistent_allocation<system, uint32>& baq_state)
+{
+    struct baq_context<system>& baq = context.baq;
+
+    if (baq.checkpoint_interval)
+    {
+        // the checkpointed HMM always runs all phases in a single pass
+        auto hmm_index = thrust::make_zip_iterator(thrust::make_tuple(active_baq_read_list.begin(),
+                                                                      baq.matrix_index.begin(),
+                                                                      baq.scaling_index.begin()));
+
+        parallel<system>::for_each(hmm_index,
+                                   hmm_index + num_reads,
+                                   hmm_glocal_checkpointed<system, T>(context, batch.device, qualities, baq_state));
+    } else {
+        run_hmm_glocal<phase, T>(context, batch, active_baq_read_list, num_reads, qualities, baq_state);
+    }
+}
+
+// runs the given HMM phases over all reads in the active BAQ list, in the precision selected at runtime
+template <uint32 phase, target_system system>
+static void run_hmm(firepony_context<system>& context,
+                    const alignment_batch<system>& batch,
+                    persistent_allocation<system, uint32>& active_baq_read_list,
+                    persistent_allocation<system, uint32>& baq_state)
+{
+    if (context.options.baq_single_precision && !context.options.baq_validate_precision)
+    {
+        run_hmm<phase, float>(context, batch, active_baq_read_list, active_baq_read_list.size(), context.baq.qualities, baq_state);
+    } else {
+        run_hmm<phase, double>(context, batch, active_baq_read_list, active_baq_read_list.size(), context.baq.qualities, baq_state);
+    }
+}
+
+// moves every group_step-th group of baq_stride reads to the front of the active BAQ list, along with their matrix and scaling indices,
+// so that a sample spread over the whole (size-sorted) list runs as the first num_groups groups
+// groups move whole and in lane order, which keeps the interleaved matrices of each group together
+// this runs as a single thread: position k * group_step is never touched by an earlier swap, so each swap brings in an original group
+// (the order of the list no longer matters once the HMM has run, since its output is indexed by read)
+template <target_system system>
+struct gather_hmm_sample : public lambda<system>
+{
+    pointer<system, uint32> active_baq_read_list;
+    uint32 num_groups;
+    uint32 group_step;
+
+    gather_hmm_sample(firepony_context<system> ctx,
+                      const alignment_batch_device<system> batch,
+                      pointer<system, uint32> active_baq_read_list,
+                      uint32 num_groups,
+                      uint32 group_step)
+        : lambda<system>(ctx, batch),
+          active_baq_read_list(active_baq_read_list),
+          num_groups(num_groups),
+          group_step(group_step)
+    { }
+
+    CUDA_HOST_DEVICE void swap(pointer<system, uint32> v, const uint32 a, const uint32 b)
+    {
+        const uint32 t = v[a];
+        v[a] = v[b];
+        v[b] = t;
+    }
+
+    CUDA_HOST_DEVICE void operator() (const uint32 unused)
+    {
+        constexpr uint32 stride = baq_stride<system>::stride;
+        baq_context<system>& baq = this->ctx.baq;
+
+        for(uint32 k = 1; k < num_groups; k++)
+        {
+            const uint32 dst = k * stride;
+            const uint32 src = k * group_step * stride;
+
+            for(uint32 l = 0; l < stride; l++)
+            {
+                swap(active_baq_read_list, dst + l, src + l);
+                swap(baq.matrix_index, dst + l, src + l);
+                swap(baq.scaling_index, dst + l, src + l);
+            }
+        }
+    }
+};
+
+// counts the bases for which a sampled single-precision BAQ quality was computed
+struct baq_precision_sampled : public thrust::unary_function<thrust::tuple<uint8, uint8>, uint32>
+{
+    CUDA_HOST_DEVICE uint32 operator() (const thrust::tuple<uint8, uint8>& q) const
+    {
+        return thrust::get<1>(q) != uint8(-1);
+    }
+};
+
+// counts the sampled bases where the single-precision BAQ quality differs from the double-precision one
+struct baq_precision_mismatch : public thrust::unary_function<thrust::tuple<uint8, uint8>, uint32>
+{
+    CUDA_HOST_DEVICE uint32 operator() (const thrust::tuple<uint8, uint8>& q) const
+    {
+        return thrust::get<1>(q) != uint8(-1) && thrust::get<0>(q) != thrust::get<1>(q);
+    }
+};
+
+// the GPU does not use the SIMD lane HMM, so there is nothing to cross-check
+static void validate_hmm_lanes(firepony_context<cuda>& context,
+                               const alignment_batch<cuda>& batch,
+                               persistent_allocation<cuda, uint32>& active_baq_read_list,
+                               uint32 num_sampled)
+{
+}
+
+// reruns the sampled reads through the per-read HMM in double precision and counts
+// the bases where hmm_glocal_lanes produced a different quality in baq.qualities
+static void validate_hmm_lanes(firepony_context<host>& context,
+                               const alignment_batch<host>& batch,
+                               persistent_allocation<host, uint32>& active_baq_read_list,
+                               uint32 num_sampled)
+{
+    struct baq_context<host>& baq = context.baq;
+    persistent_allocation<host, uint32> no_state;
+
+    // the checkpointed HMM never runs in lanes
+    if (baq.checkpoint_interval)
+        return;
+
+    thrust::fill(lift::backend_policy<host>::execution_policy(), baq.validation_qualities.begin(), baq.validation_qualities.end(), uint8(-1));
+
+    run_hmm_glocal_reads<hmm_phase_all, double>(context, batch, active_baq_read_list, num_sampled, baq.validation_qualities, no_state);
+
+    auto q = thrust::make_zip_iterator(thrust::make_tuple(baq.qualities.begin(), baq.validation_qualities.begin()));
+    context.stats.baq_lane_mismatches += parallel<host>::sum(thrust::make_transform_iterator(q, baq_precision_mismatch()),
+                                                             baq.qualities.size(),
+                                                             context.temp_storage);
+}
+
+// reruns the HMM in single precision over a sample of the active BAQ reads and
+// compares the resulting qualities against the double-precision output in baq.qualities
+// on the host, the same sample is also checked against the per-read HMM
+template <target_system system>
+static void validate_hmm_precision(firepony_context<system>& context,
+                                   const alignment_batch<system>& batch,
+                                   persistent_allocation<system, uint32>& active_baq_read_list)
+{
+    struct baq_context<system>& baq = context.baq;
+    // no state is recorded for the validation run
+    persistent_allocation<system, uint32> no_state;
+
+    constexpr uint32 stride = baq_stride<system>::stride;
+    const uint32 num_active = active_baq_read_list.size();
+    const uint32 num_full_groups = num_active / stride;
+    const uint32 max_groups = divide_ri(BAQ_PRECISION_VALIDATION_READS, stride);
+    uint32 num_sampled;
+
+    if (num_full_groups <= max_groups)
+    {
+        // small batch, validate all of it
+        num_sampled = num_active;
+    } else {
+        // the list is sorted by matrix size, so sample whole groups at a fixed step instead of taking the largest reads
+        // (only full groups are sampled, so the sample never includes padding lanes)
+        const uint32 group_step = num_full_groups / max_groups;
+
+        parallel<system>::for_each(thrust::make_counting_iterator(0u),
+                                   thrust::make_counting_iterator(0u) + 1,
+                                   gather_hmm_sample<system>(context, batch.device, active_baq_read_list, max_groups, group_step));
+
+        num_sampled = max_groups * stride;
+    }
+
+    baq.validation_qualities.resize(baq.qualities.size());
+    thrust::fill(lift::backend_policy<system>::execution_policy(), baq.validation_qualities.begin(), baq.validation_qualities.end(), uint8(-1));
+
+    run_hmm<hmm_phase_all, float>(context, batch, active_baq_read_list, num_sampled, baq.validation_qualities, no_state);
+
+    auto q = thrust::make_zip_iterator(thrust::make_tuple(baq.qualities.begin(), baq.validation_qualities.begin()));
+
+    context.stats.baq_validated_bases += parallel<system>::sum(thrust::make_transform_iterator(q, baq_precision_sampled()),
+                                                               baq.qualities.size(),
+                                                               context.temp_storage);
+    context.stats.baq_validation_mismatches += parallel<system>::sum(thrust::make_transform_iterator(q, baq_precision_mismatch()),
+                                                                     baq.qualities.size(),
+                                                                     context.temp_storage);
+
+    validate_hmm_lanes(context, batch, active_baq_read_list, num_sampled);
+}
+
 template <target_system system>
 void baq_reads(firepony_context<system>& context, const alignment_batch<system>& batch)
 {
@@ -1090,12 +2269,20 @@ void baq_reads(firepony_context<system>& context, const alignment_batch<system>&
     uint32 num_active;
 
     timer<system> baq_setup, baq_hmm, baq_postprocess;
-#if BAQ_HMM_SPLIT_PHASE
     timer<system> baq_hmm_forward, baq_hmm_backward, baq_hmm_map;
-#endif
+
+    // split-phase runs a separate pass for each HMM phase, which suits the GPU
+    // on the host, the fused HMM keeps each read's matrices in cache between phases
+    // the checkpointed HMM recomputes forward rows during the backward pass and is always fused
+    const bool split_phase = context.options.baq_checkpoint_interval == 0 &&
+                             (context.options.baq_hmm == baq_hmm_split ||
+                              (context.options.baq_hmm == baq_hmm_auto && system == cuda));
 
     baq_setup.start();
 
+    baq.checkpoint_interval = context.options.baq_checkpoint_interval;
+    baq.max_read_length = context.options.baq_max_read_length;
+
     // allocate our output
     baq.qualities.resize(batch.device.qualities.size());
     thrust::fill(lift::backend_policy<system>::execution_policy(), baq.qualities.begin(), baq.qualities.end(), uint8(-1));
@@ -1111,6 +2298,14 @@ void baq_reads(firepony_context<system>& context, const alignment_batch<system>&
 
     active_baq_read_list.resize(num_active);
 
+    if (baq.max_read_length)
+    {
+        context.stats.baq_skipped_reads += parallel<system>::sum(thrust::make_transform_iterator(context.active_read_list.begin(),
+                                                                                                 read_skips_baq<system>(context, batch.device)),
+                                                                 context.active_read_list.size(),
+                                                                 context.temp_storage);
+    }
+
     if (num_active)
     {
         baq.hmm_reference_windows.resize(batch.device.num_reads);
@@ -1132,10 +2327,8 @@ void baq_reads(firepony_context<system>& context, const alignment_batch<system>&
 
         temp_active_list.resize(num_active);
         active_baq_read_list.copy(temp_active_list);
-    }
 
-    if (num_active)
-    {
+        // these reads are dropped from the batch entirely
         temp_active_list.resize(context.active_read_list.size());
         uint32 temp_num_active = parallel<system>::copy_if(context.active_read_list.begin(),
                                                            context.active_read_list.size(),
@@ -1144,6 +2337,27 @@ void baq_reads(firepony_context<system>& context, const alignment_batch<system>&
                                                            context.temp_storage);
         temp_active_list.resize(temp_num_active);
         context.active_read_list.copy(temp_active_list);
+    }
+
+    if (num_active)
+    {
+#if BAQ_SCHEDULE_BY_SIZE
+        // process the reads with the largest HMM matrices first
+        // this keeps the strided matrix groups homogeneous and avoids a long tail of large reads at the end of each phase
+        // (the HMM writes its output by read index, so the order of the list doesn't affect results)
+        persistent_allocation<system, uint32>& schedule_keys = temp_active_list;
+        persistent_allocation<system, uint32>& temp_keys = baq_state;
+        persistent_allocation<system, uint32>& temp_values = context.temp_u32_4;
+
+        schedule_keys.resize(num_active);
+        thrust::transform(lift::backend_policy<system>::execution_policy(),
+                          active_baq_read_list.begin(),
+                          active_baq_read_list.end(),
+                          schedule_keys.begin(),
+                          compute_hmm_schedule_key<system>(context, batch.device));
+
+        parallel<system>::sort_by_key(schedule_keys, active_baq_read_list, temp_keys, temp_values, context.temp_storage, 32);
+#endif
 
         constexpr uint32 stride = baq_stride<system>::stride;
 
@@ -1214,9 +2428,31 @@ void baq_reads(firepony_context<system>& context, const alignment_batch<system>&
         uint32 matrix_len = baq.matrix_index.peek(baq.matrix_index.size() - 1);
         uint32 scaling_len = baq.scaling_index.peek(baq.scaling_index.size() - 1);
 
-        baq.forward.resize(matrix_len);
-        baq.backward.resize(matrix_len);
-        baq.scaling.resize(scaling_len);
+        const bool use_double = !context.options.baq_single_precision || context.options.baq_validate_precision;
+        const bool use_single = context.options.baq_single_precision || context.options.baq_validate_precision;
+
+        // the checkpointed HMM stores its backward rows in the forward matrix
+        const bool use_backward = (baq.checkpoint_interval == 0);
+
+        if (use_double)
+        {
+            update_hmm_tables(baq.tables, batch.device.max_read_size);
+
+            baq.forward.resize(matrix_len);
+            if (use_backward)
+                baq.backward.resize(matrix_len);
+            baq.scaling.resize(scaling_len);
+        }
+
+        if (use_single)
+        {
+            update_hmm_tables(baq.tables_sp, batch.device.max_read_size);
+
+            baq.forward_sp.resize(matrix_len);
+            if (use_backward)
+                baq.backward_sp.resize(matrix_len);
+            baq.scaling_sp.resize(scaling_len);
+        }
 
 //        fprintf(stderr, "reads: %u\n", batch.num_reads);
 //        fprintf(stderr, "forward len = %u bytes = %lu\n", matrix_len, matrix_len * sizeof(double));
@@ -1238,61 +2474,45 @@ void baq_reads(firepony_context<system>& context, const alignment_batch<system>&
 //        fflush(stdout);
 
 
+        // note: the HMM only writes the state for the bases inside each read's HMM window, which are the only ones cap_baq reads
         baq_state.resize(batch.device.qualities.size());
+#if PRESERVE_BAQ_STATE
         thrust::fill(lift::backend_policy<system>::execution_policy(), baq_state.begin(), baq_state.end(), uint32(-1));
+#endif
 
-        // initialize matrices and scaling factors
-        thrust::fill_n(lift::backend_policy<system>::execution_policy(), baq.forward.begin(), baq.forward.size(), 0.0);
-        thrust::fill_n(lift::backend_policy<system>::execution_policy(), baq.backward.begin(), baq.backward.size(), 0.0);
-        thrust::fill_n(lift::backend_policy<system>::execution_policy(), baq.scaling.begin(), baq.scaling.size(), 0.0);
+        // the HMM matrices and scaling factors are not initialized here
+        // each HMM row clears the band cells it touches before computing them (see hmm_read_state::init_row)
 
         baq_setup.stop();
 
         baq_hmm.start();
 
-#if BAQ_HMM_SPLIT_PHASE
-        // run the HMM split in 3 phases
-        baq_hmm_forward.start();
-        parallel<system>::for_each(thrust::make_zip_iterator(thrust::make_tuple(active_baq_read_list.begin(),
-                                                                                baq.matrix_index.begin(),
-                                                                                baq.scaling_index.begin())),
-                                   thrust::make_zip_iterator(thrust::make_tuple(active_baq_read_list.end(),
-                                                                                baq.matrix_index.end(),
-                                                                                baq.scaling_index.end())),
-                                   hmm_glocal<system, hmm_phase_forward>(context, batch.device, baq_state));
-        baq_hmm_forward.stop();
-
-        baq_hmm_backward.start();
-        parallel<system>::for_each(thrust::make_zip_iterator(thrust::make_tuple(active_baq_read_list.begin(),
-                                                                                baq.matrix_index.begin(),
-                                                                                baq.scaling_index.begin())),
-                                   thrust::make_zip_iterator(thrust::make_tuple(active_baq_read_list.end(),
-                                                                                baq.matrix_index.end(),
-                                                                                baq.scaling_index.end())),
-                                   hmm_glocal<system, hmm_phase_backward>(context, batch.device, baq_state));
-        baq_hmm_backward.stop();
-
-        baq_hmm_map.start();
-        parallel<system>::for_each(thrust::make_zip_iterator(thrust::make_tuple(active_baq_read_list.begin(),
-                                                                                baq.matrix_index.begin(),
-                                                                                baq.scaling_index.begin())),
-                                   thrust::make_zip_iterator(thrust::make_tuple(active_baq_read_list.end(),
-                                                                                baq.matrix_index.end(),
-                                                                                baq.scaling_index.end())),
-                                   hmm_glocal<system, hmm_phase_map>(context, batch.device, baq_state));
-        baq_hmm_map.stop();
-#else
-        // run the HMM itself
-        parallel<system>::for_each(thrust::make_zip_iterator(thrust::make_tuple(active_baq_read_list.begin(),
-                                                                                baq.matrix_index.begin(),
-                                                                                baq.scaling_index.begin())),
-                                   thrust::make_zip_iterator(thrust::make_tuple(active_baq_read_list.end(),
-                                                                                baq.matrix_index.end(),
-                                                                                baq.scaling_index.end())),
-                                   hmm_glocal<system, hmm_phase_all>(context, batch.device, baq_state));
-#endif
+        if (split_phase)
+        {
+            // run the HMM split in 3 phases
+            baq_hmm_forward.start();
+            run_hmm<hmm_phase_forward>(context, batch, active_baq_read_list, baq_state);
+            baq_hmm_forward.stop();
+
+            baq_hmm_backward.start();
+            run_hmm<hmm_phase_backward>(context, batch, active_baq_read_list, baq_state);
+            baq_hmm_backward.stop();
+
+            baq_hmm_map.start();
+            run_hmm<hmm_phase_map>(context, batch, active_baq_read_list, baq_state);
+            baq_hmm_map.stop();
+        } else {
+            // run all phases in a single pass
+            run_hmm<hmm_phase_all>(context, batch, active_baq_read_list, baq_state);
+        }
 
         baq_hmm.stop();
+
+        if (context.options.baq_validate_precision)
+        {
+            // compare against single precision before the qualities are capped and recoded
+            validate_hmm_precision(context, batch, active_baq_read_list);
+        }
     }
 
     baq_postprocess.start();
@@ -1325,11 +2545,15 @@ void baq_reads(firepony_context<system>& context, const alignment_batch<system>&
     {
         context.stats.baq_setup.add(baq_setup);
         context.stats.baq_hmm.add(baq_hmm);
-#if BAQ_HMM_SPLIT_PHASE
-        context.stats.baq_hmm_forward.add(baq_hmm_forward);
-        context.stats.baq_hmm_backward.add(baq_hmm_backward);
-        context.stats.baq_hmm_map.add(baq_hmm_map);
-#endif
+
+        if (split_phase)
+        {
+            context.stats.baq_hmm_forward.add(baq_hmm_forward);
+            context.stats.baq_hmm_backward.add(baq_hmm_backward);
+            context.stats.baq_hmm_map.add(baq_hmm_map);
+        } else {
+            context.stats.baq_hmm_fused.add(baq_hmm);
+        }
     }
 
     context.stats.baq_postprocess.add(baq_postprocess);
@@ -1345,8 +2569,8 @@ void debug_baq(firepony_context<system>& context, const alignment_batch<system>&
 
     const CRQ_index idx = h_batch.crq_index(read_index);
 
-    ushort2 read_window = context.cigar.read_window_clipped[read_index];
-    short2 reference_window = context.baq.hmm_reference_windows[read_index];
+    read_coord2 read_window = context.cigar.read_window_clipped[read_index];
+    signed_read_coord2 reference_window = context.baq.hmm_reference_windows[read_index];
 
     fprintf(stderr, "    read window                 = [ %u %u ]\n", read_window.x, read_window.y);
     fprintf(stderr, "    relative reference window   = [ %d %d ]\n", reference_window.x, reference_window.y);
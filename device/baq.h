@@ -32,6 +32,7 @@
 
 #include "device_types.h"
 #include "alignment_data_device.h"
+#include "util.h"
 
 namespace firepony {
 
@@ -39,17 +40,30 @@ namespace firepony {
 
 // set to 1 to store BAQ state in the context, useful for debugging
 #define PRESERVE_BAQ_STATE 0
-// set to 1 to run separate kernels for the various HMM stages
-#define BAQ_HMM_SPLIT_PHASE 1
+// set to 1 to schedule BAQ reads by decreasing HMM matrix size
+#define BAQ_SCHEDULE_BY_SIZE 1
+// number of reads sampled per batch when validating single-precision BAQ against double precision
+// (rounded up to whole groups of reads that share interleaved HMM matrices)
+#define BAQ_PRECISION_VALIDATION_READS 256u
+
+// precomputed HMM probabilities, built on the host and shared by all BAQ kernels
+template <target_system system, typename T>
+struct baq_probability_tables
+{
+    // emission probabilities indexed by quality * 2 + (1 if the read base mismatches the reference)
+    persistent_allocation<system, T> emission;
+    // transition terms for each query length: sM followed by the 3x3 transition matrix
+    persistent_allocation<system, T> transition;
+};
 
 template <target_system system>
 struct baq_context
 {
     // reference windows for HMM relative to the base alignment position
     // note: these are signed and the first coordinate is expected to be negative
-    persistent_allocation<system, short2> hmm_reference_windows;
+    persistent_allocation<system, signed_read_coord2> hmm_reference_windows;
     // band widths
-    persistent_allocation<system, uint16> bandwidth;
+    persistent_allocation<system, read_coord> bandwidth;
 
     // BAQ'ed qualities for each read, same size as each read
     persistent_allocation<system, uint8> qualities;
@@ -65,10 +79,62 @@ struct baq_context
     // index vector for forward/backward matrices
     persistent_allocation<system, uint32> matrix_index;
 
+    // if nonzero, only every checkpoint_interval-th forward row is stored and the backward matrix is not allocated
+    uint32 checkpoint_interval;
+    // if nonzero, reads with a longer clipped read window skip the HMM and get flat BAQ
+    uint32 max_read_length;
+
     // scaling factors
     persistent_allocation<system, double> scaling;
     // index vector for scaling factors
     persistent_allocation<system, uint32> scaling_index;
+
+    // single-precision HMM matrices and scaling factors, same layout as above
+    persistent_allocation<system, float> forward_sp;
+    persistent_allocation<system, float> backward_sp;
+    persistent_allocation<system, float> scaling_sp;
+
+    // emission and transition probabilities for the double and single-precision HMM
+    baq_probability_tables<system, double> tables;
+    baq_probability_tables<system, float> tables_sp;
+
+    // single-precision BAQ qualities for the sampled reads when validating precision
+    persistent_allocation<system, uint8> validation_qualities;
+
+    baq_context()
+        : checkpoint_interval(0),
+          max_read_length(0)
+    { }
+
+    // number of bytes held by this context
+    size_t footprint(footprint_tracker& tracker) const
+    {
+        return firepony::footprint(tracker, hmm_reference_windows) +
+               firepony::footprint(tracker, bandwidth) +
+               firepony::footprint(tracker, qualities) +
+#if PRESERVE_BAQ_STATE
+               firepony::footprint(tracker, state) +
+#endif
+               firepony::footprint(tracker, forward) +
+               firepony::footprint(tracker, backward) +
+               firepony::footprint(tracker, matrix_index) +
+               firepony::footprint(tracker, scaling) +
+               firepony::footprint(tracker, scaling_index) +
+               firepony::footprint(tracker, forward_sp) +
+               firepony::footprint(tracker, backward_sp) +
+               firepony::footprint(tracker, scaling_sp) +
+               firepony::footprint(tracker, tables.emission) +
+               firepony::footprint(tracker, tables.transition) +
+               firepony::footprint(tracker, tables_sp.emission) +
+               firepony::footprint(tracker, tables_sp.transition) +
+               firepony::footprint(tracker, validation_qualities);
+    }
+
+    // reads that are too long for the HMM are treated as if they had no errors
+    CUDA_HOST_DEVICE bool skips_read(const read_coord2 read_window) const
+    {
+        return max_read_length && uint32(read_window.y - read_window.x + 1) > max_read_length;
+    }
 };
 
 template <target_system system> void baq_reads(firepony_context<system>& context, const alignment_batch<system>& batch);
@@ -43,54 +43,45 @@
 
 namespace firepony {
 
-// compute the length of a given cigar operator
-struct cigar_op_len : public thrust::unary_function<const cigar_op&, uint32>
-{
-    CUDA_HOST_DEVICE uint32 operator() (const cigar_op& op) const
-    {
-        return op.len;
-    }
-};
-
-// expand cigar ops into temp storage
+// compute the number of cigar events for a read
 template <target_system system>
-struct cigar_op_expand : public lambda<system>
+struct read_event_count : public lambda<system>
 {
     LAMBDA_INHERIT;
 
-    CUDA_HOST_DEVICE void operator() (const uint32 op_index)
+    CUDA_HOST_DEVICE uint32 operator() (const uint32 read_index)
     {
-        const cigar_op& op = batch.cigars[op_index];
-        const uint32 out_base = ctx.cigar.cigar_offsets[op_index];
-
-        uint8 *out = &ctx.temp_storage[0] + out_base;
+        const CRQ_index idx = batch.crq_index(read_index);
 
-        for(uint32 i = 0; i < op.len; i++)
+        uint32 len = 0;
+        for(uint32 c = idx.cigar_start; c < idx.cigar_start + idx.cigar_len; c++)
         {
-            switch(op.op)
-            {
-            case cigar_op::OP_M:
-            case cigar_op::OP_MATCH:
-            case cigar_op::OP_X:
-                out[i] = cigar_event::M;
-                break;
+            len += batch.cigars[c].len;
+        }
 
-            case cigar_op::OP_I:
-            case cigar_op::OP_N:
-                out[i] = cigar_event::I;
-                break;
+        return len;
+    }
+};
 
-            case cigar_op::OP_D:
-            case cigar_op::OP_H:
-            case cigar_op::OP_P:
-                out[i] = cigar_event::D;
-                break;
+// store the cigar event range for each active read
+template <target_system system>
+struct store_event_range : public lambda<system>
+{
+    LAMBDA_INHERIT_MEMBERS;
 
-            case cigar_op::OP_S:
-                out[i] = cigar_event::S;
-                break;
-            }
-        }
+    pointer<system, uint32> event_offsets;
+
+    store_event_range(firepony_context<system> ctx,
+                      const alignment_batch_device<system> batch,
+                      pointer<system, uint32> event_offsets)
+        : lambda<system>(ctx, batch),
+          event_offsets(event_offsets)
+    { }
+
+    CUDA_HOST_DEVICE void operator() (const uint32 index)
+    {
+        const uint32 read_index = ctx.active_read_list[index];
+        ctx.cigar.cigar_event_range[read_index] = make_uint2(event_offsets[index], event_offsets[index + 1]);
     }
 };
 
@@ -104,7 +95,7 @@ struct read_window_init : public lambda<system>
     CUDA_HOST_DEVICE void operator() (const uint32 read_index)
     {
         const CRQ_index idx = batch.crq_index(read_index);
-        ctx.cigar.read_window_clipped[read_index] = make_ushort2(0, idx.read_len - 1);
+        ctx.cigar.read_window_clipped[read_index] = make_read_coord2(0, idx.read_len - 1);
     }
 };
 
@@ -176,16 +167,17 @@ struct remove_adapters : public lambda<system>
     {
         const CRQ_index idx = batch.crq_index(read_index);
 
-        const uint32 cigar_start = ctx.cigar.cigar_offsets[idx.cigar_start];
-        const uint32 cigar_stop = ctx.cigar.cigar_offsets[idx.cigar_start + idx.cigar_len];
+        const uint32 cigar_start = ctx.cigar.cigar_event_range[read_index].x;
+        const uint32 cigar_stop = ctx.cigar.cigar_event_range[read_index].y;
+        auto events = ctx.cigar.events(batch, read_index);
 
         for(uint32 ev = cigar_start; ev < cigar_stop; ev++)
         {
-            if (batch.alignment_start[read_index] + ctx.cigar.cigar_event_reference_coordinates[ev] == ref_coord)
+            if (batch.alignment_start[read_index] + events.reference_coordinate(ev) == ref_coord)
             {
-                uint16 read_coord = ctx.cigar.cigar_event_read_coordinates[ev];
+                read_coord read_bp = events.read_coordinate(ev);
 
-                if (read_coord == uint16(-1))
+                if (read_bp == read_coord(-1))
                 {
                     // if there is no read coordinate, we must be in a deletion
                     // move forward/backward (depending on which tail we're locating) until we find a valid clipping point
@@ -194,9 +186,9 @@ struct remove_adapters : public lambda<system>
                     {
                         while(ev < cigar_stop)
                         {
-                            read_coord = ctx.cigar.cigar_event_read_coordinates[ev];
+                            read_bp = events.read_coordinate(ev);
 
-                            if (read_coord != uint16(-1))
+                            if (read_bp != read_coord(-1))
                                 break;
 
                             ev++;
@@ -206,27 +198,27 @@ struct remove_adapters : public lambda<system>
                         {
                             ev--;
 
-                            read_coord = ctx.cigar.cigar_event_read_coordinates[ev];
+                            read_bp = events.read_coordinate(ev);
 
-                            if (read_coord != uint16(-1))
+                            if (read_bp != read_coord(-1))
                                 break;
                         }
                     }
 
                     // if we get here, then we failed to find a clipping coordinate
                     // this should not happen unless the read is malformed
-                    if (read_coord == uint16(-1))
+                    if (read_bp == read_coord(-1))
                         return -1;
                 }
 
-                return read_coord;
+                return read_bp;
             }
         }
 
         return -1;
     }
 
-    CUDA_HOST_DEVICE ushort2 hardClipByReferenceCoordinates(const uint32 read_index, int refStart, int refStop)
+    CUDA_HOST_DEVICE read_coord2 hardClipByReferenceCoordinates(const uint32 read_index, int refStart, int refStop)
     {
         int start;
         int stop;
@@ -240,44 +232,45 @@ struct remove_adapters : public lambda<system>
             stop = ctx.cigar.read_window_clipped[read_index].y - ctx.cigar.read_window_clipped[read_index].x - 1;
         }
 
-        return make_ushort2(start, stop);
+        return make_read_coord2(start, stop);
     }
 
     CUDA_HOST_DEVICE void hardClipByReferenceCoordinates_LeftTail(const uint32 read_index, int refStop)
     {
         auto& read_window_clipped = ctx.cigar.read_window_clipped[read_index];
 
-        ushort2 adapter = hardClipByReferenceCoordinates(read_index, -1, refStop);
-        read_window_clipped.x = max<uint16>(read_window_clipped.x, adapter.y + 1);
+        read_coord2 adapter = hardClipByReferenceCoordinates(read_index, -1, refStop);
+        read_window_clipped.x = max<read_coord>(read_window_clipped.x, adapter.y + 1);
     }
 
     CUDA_HOST_DEVICE void hardClipByReferenceCoordinates_RightTail(const uint32 read_index, int refStart)
     {
         auto& read_window_clipped = ctx.cigar.read_window_clipped[read_index];
 
-        ushort2 adapter = hardClipByReferenceCoordinates(read_index, refStart, -1);
-        read_window_clipped.y = min<uint16>(read_window_clipped.y, adapter.x - 1);
+        read_coord2 adapter = hardClipByReferenceCoordinates(read_index, refStart, -1);
+        read_window_clipped.y = min<read_coord>(read_window_clipped.y, adapter.x - 1);
     }
 
     // this is essentially a copy of the compute_reference_window functor, except it uses the current read window (with indels)
     // we need to compute this early for adapter clipping, but the results will be out of date as soon as we're finished
-    CUDA_HOST_DEVICE ushort2 get_current_reference_window(const uint32 read_index)
+    CUDA_HOST_DEVICE read_coord2 get_current_reference_window(const uint32 read_index)
     {
         const auto& read_window_clipped = ctx.cigar.read_window_clipped[read_index];
-        ushort2 reference_window_clipped;
+        read_coord2 reference_window_clipped;
 
         auto idx = batch.crq_index(read_index);
-        const uint32 cigar_start = ctx.cigar.cigar_offsets[idx.cigar_start];
-        const uint32 cigar_end = ctx.cigar.cigar_offsets[idx.cigar_start + idx.cigar_len];
+        const uint32 cigar_start = ctx.cigar.cigar_event_range[read_index].x;
+        const uint32 cigar_end = ctx.cigar.cigar_event_range[read_index].y;
+        auto events = ctx.cigar.events(batch, read_index);
 
         // do a linear search for the read offset
         // (this could be smarter, but it doesn't seem to matter)
         for(uint32 i = cigar_start; i < cigar_end; i++)
         {
-            if (ctx.cigar.cigar_event_read_coordinates[i] == read_window_clipped.x)
+            if (events.read_coordinate(i) == read_window_clipped.x)
             {
-                while(ctx.cigar.cigar_event_reference_coordinates[i] == uint16(-1) &&
-                        i < cigar_end)
+                while(i < cigar_end &&
+                      events.reference_coordinate(i) == read_coord(-1))
                 {
                     i++;
                 }
@@ -285,20 +278,20 @@ struct remove_adapters : public lambda<system>
                 if (i == cigar_end)
                 {
                     // should never happen
-                    reference_window_clipped = make_ushort2(uint16(-1), uint16(-1));
+                    reference_window_clipped = make_read_coord2(read_coord(-1), read_coord(-1));
                     return reference_window_clipped;
                 }
 
-                reference_window_clipped.x = ctx.cigar.cigar_event_reference_coordinates[i];
+                reference_window_clipped.x = events.reference_coordinate(i);
                 break;
             }
         }
 
         for(uint32 i = cigar_end - 1; i >= cigar_start; i--)
         {
-            if (ctx.cigar.cigar_event_read_coordinates[i] == read_window_clipped.y)
+            if (events.read_coordinate(i) == read_window_clipped.y)
             {
-                while(ctx.cigar.cigar_event_reference_coordinates[i] == uint16(-1) &&
+                while(events.reference_coordinate(i) == read_coord(-1) &&
                         i > cigar_start)
                 {
                     i--;
@@ -307,11 +300,11 @@ struct remove_adapters : public lambda<system>
                 if (i == cigar_start)
                 {
                     // should never happen
-                    reference_window_clipped = make_ushort2(uint16(-1), uint16(-1));
+                    reference_window_clipped = make_read_coord2(read_coord(-1), read_coord(-1));
                     return reference_window_clipped;
                 }
 
-                reference_window_clipped.y = ctx.cigar.cigar_event_reference_coordinates[i];
+                reference_window_clipped.y = events.reference_coordinate(i);
                 break;
             }
         }
@@ -370,7 +363,7 @@ struct remove_soft_clips : public lambda<system>
             {
                 if (read_offset + op.len > read_window_clipped.x)
                 {
-                    read_window_clipped.x = min<uint16>(read_offset + op.len, read_window_clipped.y);
+                    read_window_clipped.x = min<read_coord>(read_offset + op.len, read_window_clipped.y);
                 }
 
                 read_offset += op.len;
@@ -393,7 +386,7 @@ struct remove_soft_clips : public lambda<system>
             {
                 if (read_offset - op.len < read_window_clipped.y)
                 {
-                    read_window_clipped.y = max<uint16>(read_offset - op.len, read_window_clipped.x);
+                    read_window_clipped.y = max<read_coord>(read_offset - op.len, read_window_clipped.x);
                 }
 
                 read_offset -= op.len;
@@ -419,8 +412,9 @@ struct compute_no_insertions_window : public lambda<system>
         const auto& read_window_clipped = ctx.cigar.read_window_clipped[read_index];
         auto& read_window_clipped_no_insertions = ctx.cigar.read_window_clipped_no_insertions[read_index];
 
-        const uint32 cigar_start = ctx.cigar.cigar_offsets[idx.cigar_start];
-        const uint32 cigar_end = ctx.cigar.cigar_offsets[idx.cigar_start + idx.cigar_len];
+        const uint32 cigar_start = ctx.cigar.cigar_event_range[read_index].x;
+        const uint32 cigar_end = ctx.cigar.cigar_event_range[read_index].y;
+        auto events = ctx.cigar.events(batch, read_index);
 
         uint32 ev;
 
@@ -428,15 +422,15 @@ struct compute_no_insertions_window : public lambda<system>
         ev = cigar_start;
         while(ev < cigar_end)
         {
-            const uint16 read_offset = ctx.cigar.cigar_event_read_coordinates[ev];
+            const read_coord read_offset = events.read_coordinate(ev);
             // skip bases without a read offset and bases behind the current clipping window
-            if (read_offset == uint16(-1) || read_offset < read_window_clipped.x)
+            if (read_offset == read_coord(-1) || read_offset < read_window_clipped.x)
             {
                 ev++;
                 continue;
             }
 
-            if (ctx.cigar.cigar_events[ev] == cigar_event::I)
+            if (events.event(ev) == cigar_event::I)
             {
                 ev++;
                 continue;
@@ -450,15 +444,15 @@ struct compute_no_insertions_window : public lambda<system>
         ev = cigar_end - 1;
         while(ev >= cigar_start && ev < cigar_end)
         {
-            const uint16 read_offset = ctx.cigar.cigar_event_read_coordinates[ev];
+            const read_coord read_offset = events.read_coordinate(ev);
             // skip bases without a read offset and bases beyond the current clipping window
-            if (read_offset == uint16(-1) || read_offset > read_window_clipped.y)
+            if (read_offset == read_coord(-1) || read_offset > read_window_clipped.y)
             {
                 ev--;
                 continue;
             }
 
-            if (ctx.cigar.cigar_events[ev] == cigar_event::I)
+            if (events.event(ev) == cigar_event::I)
             {
                 ev--;
                 continue;
@@ -482,17 +476,18 @@ struct compute_reference_window : public lambda<system>
         const auto& read_window_clipped_no_insertions = ctx.cigar.read_window_clipped_no_insertions[read_index];
         auto& reference_window_clipped = ctx.cigar.reference_window_clipped[read_index];
 
-        const uint32 cigar_start = ctx.cigar.cigar_offsets[idx.cigar_start];
-        const uint32 cigar_end = ctx.cigar.cigar_offsets[idx.cigar_start + idx.cigar_len];
+        const uint32 cigar_start = ctx.cigar.cigar_event_range[read_index].x;
+        const uint32 cigar_end = ctx.cigar.cigar_event_range[read_index].y;
+        auto events = ctx.cigar.events(batch, read_index);
 
         // do a linear search for the read offset
         // (this could be smarter, but it doesn't seem to matter)
         for(uint32 i = cigar_start; i < cigar_end; i++)
         {
-            if (ctx.cigar.cigar_event_read_coordinates[i] == read_window_clipped_no_insertions.x)
+            if (events.read_coordinate(i) == read_window_clipped_no_insertions.x)
             {
-                while(ctx.cigar.cigar_event_reference_coordinates[i] == uint16(-1) &&
-                        i < cigar_end)
+                while(i < cigar_end &&
+                      events.reference_coordinate(i) == read_coord(-1))
                 {
                     i++;
                 }
@@ -500,20 +495,20 @@ struct compute_reference_window : public lambda<system>
                 if (i == cigar_end)
                 {
                     // should never happen
-                    reference_window_clipped = make_ushort2(uint16(-1), uint16(-1));
+                    reference_window_clipped = make_read_coord2(read_coord(-1), read_coord(-1));
                     return;
                 }
 
-                reference_window_clipped.x = ctx.cigar.cigar_event_reference_coordinates[i];
+                reference_window_clipped.x = events.reference_coordinate(i);
                 break;
             }
         }
 
         for(uint32 i = cigar_end - 1; i >= cigar_start; i--)
         {
-            if (ctx.cigar.cigar_event_read_coordinates[i] == read_window_clipped_no_insertions.y)
+            if (events.read_coordinate(i) == read_window_clipped_no_insertions.y)
             {
-                while(ctx.cigar.cigar_event_reference_coordinates[i] == uint16(-1) &&
+                while(events.reference_coordinate(i) == read_coord(-1) &&
                         i > cigar_start)
                 {
                     i--;
@@ -522,92 +517,12 @@ struct compute_reference_window : public lambda<system>
                 if (i == cigar_start)
                 {
                     // should never happen
-                    reference_window_clipped = make_ushort2(uint16(-1), uint16(-1));
+                    reference_window_clipped = make_read_coord2(read_coord(-1), read_coord(-1));
                     return;
                 }
 
-                reference_window_clipped.y = ctx.cigar.cigar_event_reference_coordinates[i];
-                break;
-            }
-        }
-    }
-};
-
-// expand cigar coordinates for a read
-// xxxnsubtil: this is very similar to compute_alignment_window, should merge
-template <target_system system>
-struct cigar_coordinates_expand : public lambda<system>
-{
-    LAMBDA_INHERIT;
-
-    CUDA_HOST_DEVICE void operator() (const uint32 read_index)
-    {
-        const CRQ_index idx = batch.crq_index(read_index);
-        const cigar_op *cigar = &batch.cigars[idx.cigar_start];
-
-        uint32 base = ctx.cigar.cigar_offsets[idx.cigar_start];
-        uint32 *output_read_index = &ctx.cigar.cigar_event_read_index[base];
-        uint16 *output_read_coordinates = &ctx.cigar.cigar_event_read_coordinates[base];
-        uint16 *output_reference_coordinates = &ctx.cigar.cigar_event_reference_coordinates[base];
-
-        uint16 read_offset = 0;
-        uint16 reference_offset = 0;
-
-        for(uint32 c = 0; c < idx.cigar_len; c++)
-        {
-            switch(cigar[c].op)
-            {
-            case cigar_op::OP_M:
-            case cigar_op::OP_MATCH:
-            case cigar_op::OP_X:
-                for(uint32 i = 0; i < cigar[c].len; i++)
-                {
-                    *output_read_index++ = read_index;
-                    *output_read_coordinates++ = read_offset;
-                    *output_reference_coordinates++ = reference_offset;
-
-                    read_offset++;
-                    reference_offset++;
-                }
-
-                break;
-
-            case cigar_op::OP_S:
-                for(uint32 i = 0; i < cigar[c].len; i++)
-                {
-                    *output_read_index++ = read_index;
-                    *output_read_coordinates++ = read_offset;
-                    *output_reference_coordinates++ = uint16(-1);
-
-                    read_offset++;
-                }
-
-                break;
-
-            case cigar_op::OP_N: // xxxnsubtil: N is really not supported and shouldn't be here
-            case cigar_op::OP_I:
-                for(uint32 i = 0; i < cigar[c].len; i++)
-                {
-                    *output_read_index++ = read_index;
-                    *output_read_coordinates++ = read_offset;
-                    *output_reference_coordinates++ = uint16(-1);
-
-                    read_offset++;
-                }
-
+                reference_window_clipped.y = events.reference_coordinate(i);
                 break;
-
-            case cigar_op::OP_D:
-            case cigar_op::OP_H:
-            case cigar_op::OP_P: // xxxnsubtil: not sure how to handle P
-                for(uint32 i = 0; i < cigar[c].len; i++)
-                {
-                    *output_read_index++ = read_index;
-                    *output_read_coordinates++ = uint16(-1);
-                    *output_reference_coordinates++ = reference_offset;
-
-                    reference_offset++;
-                }
             }
         }
     }
@@ -644,15 +559,19 @@ struct compute_error_vectors : public lambda<system>
         const auto read_window_clipped = ctx.cigar.read_window_clipped[read_index];
         const auto reference_window_clipped = ctx.cigar.reference_window_clipped[read_index];
 
-        uint16 current_bp_idx = 0;
-        uint16 num_errors = 0;
+        auto events = ctx.cigar.events(batch, read_index);
+
+        read_coord current_bp_idx = 0;
+        read_coord num_errors = 0;
+
+        uint32 cigar_end = ctx.cigar.cigar_event_range[read_index].x;
 
         // go through the cigar events looking for the event we're interested in
         for(uint32 event = idx.cigar_start; event < idx.cigar_start + idx.cigar_len; event++)
         {
             // figure out the cigar event range for this event
-            const uint32 cigar_start = ctx.cigar.cigar_offsets[event];
-            const uint32 cigar_end = ctx.cigar.cigar_offsets[event+1];
+            const uint32 cigar_start = cigar_end;
+            cigar_end += batch.cigars[event].len;
 
             switch(batch.cigars[event].op)
             {
@@ -661,12 +580,12 @@ struct compute_error_vectors : public lambda<system>
                 for(uint32 i = cigar_start; i < cigar_end; i++)
                 {
                     // update the current read bp index
-                    current_bp_idx = ctx.cigar.cigar_event_read_coordinates[i];
+                    current_bp_idx = events.read_coordinate(i);
                     // load the read bp
                     const uint8 read_bp = batch.reads[idx.read_start + current_bp_idx];
 
                     // load the corresponding sequence bp
-                    const uint32 reference_bp_idx = ctx.cigar.cigar_event_reference_coordinates[i];
+                    const uint32 reference_bp_idx = events.reference_coordinate(i);
                     const uint8 reference_bp = reference[reference_bp_idx];
 
                     if (reference_bp != read_bp)
@@ -683,7 +602,7 @@ struct compute_error_vectors : public lambda<system>
 
             case cigar_event::I:
                 // mark the read bp where an insertion begins
-                current_bp_idx = ctx.cigar.cigar_event_read_coordinates[cigar_start];
+                current_bp_idx = events.read_coordinate(cigar_start);
 
                 if (current_bp_idx >= read_window_clipped.x && current_bp_idx <= read_window_clipped.y)
                 {
@@ -708,7 +627,7 @@ struct compute_error_vectors : public lambda<system>
             case cigar_event::D:
                 // note: deletions do not exist in the read, so current_bp_idx is not updated here
                 // also, because of this, we need to test against reference coordinates instead
-                uint16 current_ref_idx = ctx.cigar.cigar_event_reference_coordinates[cigar_start];
+                read_coord current_ref_idx = events.reference_coordinate(cigar_start);
 
                 if (current_ref_idx >= reference_window_clipped.x && current_ref_idx <= reference_window_clipped.y)
                 {
@@ -718,7 +637,7 @@ struct compute_error_vectors : public lambda<system>
                         del_vector[idx.read_start + current_bp_idx] = 1;
                         num_errors++;
                     } else {
-                        uint16 off = current_bp_idx + 1;
+                        read_coord off = current_bp_idx + 1;
                         if (off < idx.read_len)
                         {
                             del_vector[idx.read_start + off] = 1;
@@ -736,111 +655,33 @@ struct compute_error_vectors : public lambda<system>
     }
 };
 
-#ifdef CUDA_DEBUG
-// debug aid: sanity check that the expanded cigar events match what we expect
-template <target_system system>
-struct sanity_check_cigar_events : public lambda<system>
-{
-    LAMBDA_INHERIT;
-
-    CUDA_HOST_DEVICE void operator() (const uint32 read_index)
-    {
-        const CRQ_index idx = batch.crq_index(read_index);
-        const cigar_op *cigar = &batch.cigars[idx.cigar_start];
-
-        const uint32 cigar_start = ctx.cigar.cigar_offsets[idx.cigar_start];
-        uint32 cigar_event_idx = 0;
-
-        for(uint32 c = 0; c < idx.cigar_len; c++)
-        {
-            for(uint32 i = 0; i < cigar[c].len; i++)
-            {
-                switch(cigar[c].op)
-                {
-                case cigar_op::OP_M:
-                case cigar_op::OP_MATCH:
-                case cigar_op::OP_X:
-                    if (ctx.cigar.cigar_events[cigar_start + cigar_event_idx] != cigar_event::M)
-                    {
-                        printf("*** failed sanity check: read %u cigar op %u %u event offset %u: expected M, got %c\n",
-                                read_index, c, i, cigar_start + cigar_event_idx, cigar_event::ascii(ctx.cigar.cigar_events[cigar_start + cigar_event_idx]));
-                        return;
-                    }
-
-                    cigar_event_idx++;
-                    break;
-
-                case cigar_op::OP_N: // xxxnsubtil: N is really not supported and shouldn't be here
-                case cigar_op::OP_I:
-                    if (ctx.cigar.cigar_events[cigar_start + cigar_event_idx] != cigar_event::I)
-                    {
-                        printf("*** failed sanity check: read %u cigar op %u %u event offset %u: expected I, got %c\n",
-                                read_index, c, i, cigar_start + cigar_event_idx, cigar_event::ascii(ctx.cigar.cigar_events[cigar_start + cigar_event_idx]));
-                        return;
-                    }
-
-                    cigar_event_idx++;
-                    break;
-
-                case cigar_op::OP_D:
-                case cigar_op::OP_H:
-                case cigar_op::OP_P: // xxxnsubtil: not sure how to handle P
-                    if (ctx.cigar.cigar_events[cigar_start + cigar_event_idx] != cigar_event::D)
-                    {
-                        printf("*** failed sanity check: read %u cigar op %u %u event offset %u: expected D, got %c\n",
-                                read_index, c, i, cigar_start + cigar_event_idx, cigar_event::ascii(ctx.cigar.cigar_events[cigar_start + cigar_event_idx]));
-                        return;
-                    }
-
-                    cigar_event_idx++;
-                    break;
-
-                case cigar_op::OP_S:
-                    if (ctx.cigar.cigar_events[cigar_start + cigar_event_idx] != cigar_event::S)
-                    {
-                        printf("*** failed sanity check: read %u cigar op %u %u event offset %u: expected S, got %c\n",
-                                read_index, c, i, cigar_start + cigar_event_idx, cigar_event::ascii(ctx.cigar.cigar_events[cigar_start + cigar_event_idx]));
-                        return;
-                    }
-
-                    cigar_event_idx++;
-                    break;
-                }
-            }
-        }
-    }
-};
-#endif
-
 template <target_system system>
 void expand_cigars(firepony_context<system>& context, const alignment_batch<system>& batch)
 {
     auto& ctx = context.cigar;
 
-    // compute the offsets of each expanded cigar op
-    // xxxnsubtil: we ignore the active read list here, so we do unnecessary work
-    // might want to revisit this
-    ctx.cigar_offsets.resize(batch.device.cigars.size() + 1);
+    // assign cigar event ranges to the active reads
+    // (inactive reads don't get an event range, so this only does work for reads that survived filtering)
+    persistent_allocation<system, uint32>& event_offsets = context.temp_u32;
+    const uint32 num_active = context.active_read_list.size();
+
+    event_offsets.resize(num_active + 1);
 
     // mark the first offset as 0
-    thrust::fill_n(lift::backend_policy<system>::execution_policy(), ctx.cigar_offsets.begin(), 1, 0);
+    thrust::fill_n(lift::backend_policy<system>::execution_policy(), event_offsets.begin(), 1, 0);
     // do an inclusive scan to compute all offsets + the total size
-    parallel<system>::inclusive_scan(thrust::make_transform_iterator(batch.device.cigars.begin(), cigar_op_len()),
-                                     batch.device.cigars.size(),
-                                     ctx.cigar_offsets.begin() + 1,
+    parallel<system>::inclusive_scan(thrust::make_transform_iterator(context.active_read_list.begin(),
+                                                                     read_event_count<system>(context, batch.device)),
+                                     num_active,
+                                     event_offsets.begin() + 1,
                                      thrust::plus<uint32>());
 
-    // read back the last element, which contains the size of the buffer required
-    uint32 expanded_cigar_len = ctx.cigar_offsets.peek(batch.device.cigars.size());
-
-    // make sure we have enough room for the expanded cigars
-    // note: temporary storage must be padded to a multiple of the word size, since we'll pack whole words at a time
-    pack_prepare_storage_2bit(context.temp_storage, expanded_cigar_len);
-    ctx.cigar_events.resize(expanded_cigar_len);
+    ctx.cigar_event_range.resize(batch.device.num_reads);
+    parallel<system>::for_each(thrust::make_counting_iterator(0u),
+                               thrust::make_counting_iterator(0u) + num_active,
+                               store_event_range<system>(context, batch.device, event_offsets));
 
-    ctx.cigar_event_read_index.resize(expanded_cigar_len);
-    ctx.cigar_event_reference_coordinates.resize(expanded_cigar_len);
-    ctx.cigar_event_read_coordinates.resize(expanded_cigar_len);
+    // note: cigar events are not expanded per base, stages downstream walk the cigar ops through cigar_event_view
 
     ctx.read_window_clipped.resize(batch.device.num_reads);
     ctx.read_window_clipped_no_insertions.resize(batch.device.num_reads);
@@ -854,30 +695,6 @@ void expand_cigars(firepony_context<system>& context, const alignment_batch<syst
     // initialize num_errors to zero
     thrust::fill(lift::backend_policy<system>::execution_policy(), ctx.num_errors.begin(), ctx.num_errors.end(), 0);
 
-    // cigar_events_read_index is initialized to -1; this means that all reads are considered inactive
-    // it will be filled in during cigar coordinate expansion to mark active reads
-    thrust::fill(lift::backend_policy<system>::execution_policy(), ctx.cigar_event_read_index.begin(), ctx.cigar_event_read_index.end(), uint32(-1));
-
-    // expand the cigar ops into temp storage (xxxnsubtil: same as above, active read list is ignored)
-    parallel<system>::for_each(thrust::make_counting_iterator(0),
-                               thrust::make_counting_iterator(0) + batch.device.cigars.size(),
-                               cigar_op_expand<system>(context, batch.device));
-
-    // pack the cigar into a 2-bit vector
-    pack_to_2bit(ctx.cigar_events, context.temp_storage);
-
-#ifdef CUDA_DEBUG
-    parallel<system>::for_each(firepony_context.active_read_list.begin(),
-                               firepony_context.active_read_list.end(),
-                               sanity_check_cigar_events<system>(firepony_context, batch.device));
-#endif
-
-    // now expand the coordinates per read
-    // this avoids having to deal with boundary conditions within reads
-    parallel<system>::for_each(context.active_read_list.begin(),
-                               context.active_read_list.end(),
-                               cigar_coordinates_expand<system>(context, batch.device));
-
     // initialize read windows
     parallel<system>::for_each(context.active_read_list.begin(),
                                context.active_read_list.end(),
@@ -907,12 +724,14 @@ void expand_cigars(firepony_context<system>& context, const alignment_batch<syst
     // this also counts the number of errors in each read
     // note: we compute the error bit vectors into uint8 then pack these into 1-bit-per-bp vectors
     // this is to avoid RMW hazards across threads, as the number of symbols per word won't match that of the read vectors themselves
+    size_t len = batch.device.reads.size();
+    pooled_allocation<system, uint8> del_error_storage(context.pool, len);
+
     allocation<system, uint8>& snp_error = context.temp_storage;
     allocation<system, uint8>& ins_error = context.temp_u8;
-    scoped_allocation<system, uint8> del_error;
+    allocation<system, uint8>& del_error = del_error_storage;
 
     // set up the temp storage for packing into 1bit
-    size_t len = batch.device.reads.size();
     pack_prepare_storage_1bit(snp_error, len);
     pack_prepare_storage_1bit(ins_error, len);
     pack_prepare_storage_1bit(del_error, len);
@@ -943,7 +762,7 @@ void debug_cigar(firepony_context<system>& context, const alignment_batch<system
     const CRQ_index idx = h_batch.crq_index(read_index);
     const auto& ctx = context.cigar;
 
-    ushort2 read_window_clipped = ctx.read_window_clipped[read_index];
+    read_coord2 read_window_clipped = ctx.read_window_clipped[read_index];
 
     fprintf(stderr, "  cigar info:\n");
 
@@ -955,8 +774,10 @@ void debug_cigar(firepony_context<system>& context, const alignment_batch<system
     }
     fprintf(stderr, "]\n");
 
-    uint32 cigar_start = ctx.cigar_offsets[idx.cigar_start];
-    uint32 cigar_end = ctx.cigar_offsets[idx.cigar_start + idx.cigar_len];
+    const uint2 event_range = ctx.cigar_event_range[read_index];
+    uint32 cigar_start = event_range.x;
+    uint32 cigar_end = event_range.y;
+    cigar_event_view events(&h_batch.cigars[idx.cigar_start], idx.cigar_len, cigar_start);
     fprintf(stderr, "    offset range                = [% 3d, % 3d]\n", cigar_start, cigar_end);
 
     fprintf(stderr, "                                    ");
@@ -969,21 +790,21 @@ void debug_cigar(firepony_context<system>& context, const alignment_batch<system
     fprintf(stderr, "    event list                  = [ ");
     for(uint32 i = cigar_start; i < cigar_end; i++)
     {
-        fprintf(stderr, "   %c ", cigar_event::ascii(ctx.cigar_events[i]));
+        fprintf(stderr, "   %c ", cigar_event::ascii(events.event(i)));
     }
     fprintf(stderr, "]\n");
 
     fprintf(stderr, "    event idx -> read coords    = [ ");
     for(uint32 i = cigar_start; i < cigar_end; i++)
     {
-        fprintf(stderr, "% 4d ", (int16) ctx.cigar_event_read_coordinates[i]);
+        fprintf(stderr, "% 4d ", (signed_read_coord) events.read_coordinate(i));
     }
     fprintf(stderr, "]\n");
 
     fprintf(stderr, "             ... clipped        = [ ");
     for(uint32 i = cigar_start; i < cigar_end; i++)
     {
-        int16 coord = ctx.cigar_event_read_coordinates[i] - read_window_clipped.x;
+        signed_read_coord coord = events.read_coordinate(i) - read_window_clipped.x;
 
         if (coord >= 0)
         {
@@ -998,15 +819,15 @@ void debug_cigar(firepony_context<system>& context, const alignment_batch<system
     fprintf(stderr, "    event reference coordinates = [ ");
     for(uint32 i = cigar_start; i < cigar_end; i++)
     {
-        fprintf(stderr, "% 4d ", (int16) ctx.cigar_event_reference_coordinates[i]);
+        fprintf(stderr, "% 4d ", (signed_read_coord) events.reference_coordinate(i));
     }
     fprintf(stderr, "]\n");
 
     fprintf(stderr, "    is snp                      = [ ");
     for(uint32 i = cigar_start; i < cigar_end; i++)
     {
-        uint16 read_bp_idx = ctx.cigar_event_read_coordinates[i];
-        if (read_bp_idx == uint16(-1))
+        read_coord read_bp_idx = events.read_coordinate(i);
+        if (read_bp_idx == read_coord(-1))
         {
             fprintf(stderr, "   - ");
         } else {
@@ -1018,8 +839,8 @@ void debug_cigar(firepony_context<system>& context, const alignment_batch<system
     fprintf(stderr, "    is insertion                = [ ");
     for(uint32 i = cigar_start; i < cigar_end; i++)
     {
-        uint16 read_bp_idx = ctx.cigar_event_read_coordinates[i];
-        if (read_bp_idx == uint16(-1))
+        read_coord read_bp_idx = events.read_coordinate(i);
+        if (read_bp_idx == read_coord(-1))
         {
             fprintf(stderr, "   - ");
         } else {
@@ -1031,8 +852,8 @@ void debug_cigar(firepony_context<system>& context, const alignment_batch<system
     fprintf(stderr, "    is deletion                 = [ ");
     for(uint32 i = cigar_start; i < cigar_end; i++)
     {
-        uint16 read_bp_idx = ctx.cigar_event_read_coordinates[i];
-        if (read_bp_idx == uint16(-1))
+        read_coord read_bp_idx = events.read_coordinate(i);
+        if (read_bp_idx == read_coord(-1))
         {
             fprintf(stderr, "   - ");
         } else {
@@ -1046,8 +867,8 @@ void debug_cigar(firepony_context<system>& context, const alignment_batch<system
     fprintf(stderr, "    skip list                   = [ ");
     for(uint32 i = cigar_start; i < cigar_end; i++)
     {
-        uint16 bp_offset = ctx.cigar_event_read_coordinates[i];
-        if (bp_offset == uint16(-1))
+        read_coord bp_offset = events.read_coordinate(i);
+        if (bp_offset == read_coord(-1))
         {
             fprintf(stderr, "   - ");
         } else {
@@ -1064,12 +885,14 @@ void debug_cigar(firepony_context<system>& context, const alignment_batch<system
     fprintf(stderr, "    fractional snp error        = [ ");
     for(uint32 i = cigar_start; i < cigar_end; i++)
     {
-        uint16 bp_offset = ctx.cigar_event_read_coordinates[i];
-        if (bp_offset == uint16(-1))
+        read_coord bp_offset = events.read_coordinate(i);
+        if (bp_offset == read_coord(-1))
         {
             fprintf(stderr, "   - ");
         } else {
-            double err = context.fractional_error.snp_errors[idx.qual_start + bp_offset];
+            // fractional errors are only computed inside the clipped read window
+            const bool in_window = (bp_offset >= read_window_clipped.x && bp_offset <= read_window_clipped.y);
+            double err = in_window ? mismatch_to_double(context.fractional_error.snp_errors[idx.qual_start + bp_offset]) : 0.0;
             if (err == 0.0)
                 fprintf(stderr, "   . ");
             else
@@ -1081,12 +904,14 @@ void debug_cigar(firepony_context<system>& context, const alignment_batch<system
     fprintf(stderr, "           ... ins error        = [ ");
     for(uint32 i = cigar_start; i < cigar_end; i++)
     {
-        uint16 bp_offset = ctx.cigar_event_read_coordinates[i];
-        if (bp_offset == uint16(-1))
+        read_coord bp_offset = events.read_coordinate(i);
+        if (bp_offset == read_coord(-1))
         {
             fprintf(stderr, "   - ");
         } else {
-            double err = context.fractional_error.insertion_errors[idx.qual_start + bp_offset];
+            // fractional errors are only computed inside the clipped read window
+            const bool in_window = (bp_offset >= read_window_clipped.x && bp_offset <= read_window_clipped.y);
+            double err = in_window ? mismatch_to_double(context.fractional_error.insertion_errors[idx.qual_start + bp_offset]) : 0.0;
             if (err == 0.0)
                 fprintf(stderr, "   . ");
             else
@@ -1098,12 +923,14 @@ void debug_cigar(firepony_context<system>& context, const alignment_batch<system
     fprintf(stderr, "           ... del error        = [ ");
     for(uint32 i = cigar_start; i < cigar_end; i++)
     {
-        uint16 bp_offset = ctx.cigar_event_read_coordinates[i];
-        if (bp_offset == uint16(-1))
+        read_coord bp_offset = events.read_coordinate(i);
+        if (bp_offset == read_coord(-1))
         {
             fprintf(stderr, "   - ");
         } else {
-            double err = context.fractional_error.deletion_errors[idx.qual_start + bp_offset];
+            // fractional errors are only computed inside the clipped read window
+            const bool in_window = (bp_offset >= read_window_clipped.x && bp_offset <= read_window_clipped.y);
+            double err = in_window ? mismatch_to_double(context.fractional_error.deletion_errors[idx.qual_start + bp_offset]) : 0.0;
             if (err == 0.0)
                 fprintf(stderr, "   . ");
             else
@@ -1119,23 +946,23 @@ void debug_cigar(firepony_context<system>& context, const alignment_batch<system
     fprintf(stderr, "    reference sequence data     = [ ");
     for(uint32 i = cigar_start; i < cigar_end; i++)
     {
-        const uint16 ref_bp = ctx.cigar_event_reference_coordinates[i];
-        fprintf(stderr, "   %c ", ref_bp == uint16(-1) ? '-' : from_nvbio::iupac16_to_char(reference[ref_bp]));
+        const read_coord ref_bp = events.reference_coordinate(i);
+        fprintf(stderr, "   %c ", ref_bp == read_coord(-1) ? '-' : from_nvbio::iupac16_to_char(reference[ref_bp]));
     }
     fprintf(stderr, "]\n");
 
     fprintf(stderr, "    read sequence data          = [ ");
     for(uint32 i = cigar_start; i < cigar_end; i++)
     {
-        const uint16 read_bp = ctx.cigar_event_read_coordinates[i];
+        const read_coord read_bp = events.read_coordinate(i);
         char base;
 
-        if (read_bp == uint16(-1))
+        if (read_bp == read_coord(-1))
         {
             base = '-';
         } else {
             base = from_nvbio::iupac16_to_char(h_batch.reads[idx.read_start + read_bp]);
-            if (ctx.cigar_events[i] == cigar_event::S)
+            if (events.event(i) == cigar_event::S)
             {
                 // display soft-clipped bases in lowercase
                 base = tolower(base);
@@ -1149,9 +976,9 @@ void debug_cigar(firepony_context<system>& context, const alignment_batch<system
     fprintf(stderr, "    read quality data           = [ ");
     for(uint32 i = cigar_start; i < cigar_end; i++)
     {
-        const uint16 read_bp = ctx.cigar_event_read_coordinates[i];
+        const read_coord read_bp = events.read_coordinate(i);
 
-        if (read_bp == uint16(-1))
+        if (read_bp == read_coord(-1))
         {
             fprintf(stderr, "   - ");
         } else {
@@ -1163,9 +990,9 @@ void debug_cigar(firepony_context<system>& context, const alignment_batch<system
     fprintf(stderr, "    ... in ascii                = [ ");
     for(uint32 i = cigar_start; i < cigar_end; i++)
     {
-        const uint16 read_bp = ctx.cigar_event_read_coordinates[i];
+        const read_coord read_bp = events.read_coordinate(i);
 
-        if (read_bp == uint16(-1))
+        if (read_bp == read_coord(-1))
         {
             fprintf(stderr, "   - ");
         } else {
@@ -1176,15 +1003,15 @@ void debug_cigar(firepony_context<system>& context, const alignment_batch<system
 
     fprintf(stderr, "    clipped read window         = [ % 3d, % 3d ]\n", read_window_clipped.x, read_window_clipped.y);
 
-    ushort2 read_window_clipped_no_insertions = ctx.read_window_clipped_no_insertions[read_index];
+    read_coord2 read_window_clipped_no_insertions = ctx.read_window_clipped_no_insertions[read_index];
     fprintf(stderr, "    ... lead/trail insertions   = [ % 3d, % 3d ]\n",
                 read_window_clipped_no_insertions.x, read_window_clipped_no_insertions.y);
 
-    ushort2 reference_window_clipped = ctx.reference_window_clipped[read_index];
+    read_coord2 reference_window_clipped = ctx.reference_window_clipped[read_index];
     fprintf(stderr, "    clipped reference window    = [ % 3d, % 3d ]\n",
                 reference_window_clipped.x, reference_window_clipped.y);
 
-    uint16 err = ctx.num_errors[read_index];
+    read_coord err = ctx.num_errors[read_index];
     fprintf(stderr, "    errors in clipped region    = [ % 3d ]\n", err);
 
     fprintf(stderr, "\n");
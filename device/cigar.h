@@ -33,6 +33,7 @@
 #include "device_types.h"
 #include "alignment_data_device.h"
 #include "../sequence_database.h"
+#include "util.h"
 
 namespace firepony
 {
@@ -63,29 +64,122 @@ struct cigar_event
                e == S ? 'S' :
                         '?';
     }
+
+    // the event generated by each base of a cigar op
+    static CUDA_HOST_DEVICE Event from_cigar_op(uint32 op)
+    {
+        switch(op)
+        {
+        case cigar_op::OP_I:
+        case cigar_op::OP_N: // xxxnsubtil: N is really not supported and shouldn't be here
+            return I;
+
+        case cigar_op::OP_D:
+        case cigar_op::OP_H:
+        case cigar_op::OP_P: // xxxnsubtil: not sure how to handle P
+            return D;
+
+        case cigar_op::OP_S:
+            return S;
+
+        default:
+            return M;
+        }
+    }
+
+    // number of read bases covered by a cigar op
+    static CUDA_HOST_DEVICE uint32 read_len(const cigar_op& op)
+    {
+        return (from_cigar_op(op.op) == D ? 0 : op.len);
+    }
+
+    // number of reference bases covered by a cigar op
+    static CUDA_HOST_DEVICE uint32 reference_len(const cigar_op& op)
+    {
+        const Event e = from_cigar_op(op.op);
+        return (e == M || e == D ? op.len : 0);
+    }
+};
+
+// run-length view of the cigar events for a read
+// each cigar op expands into op.len events, addressed with the indices in cigar_context::cigar_event_range;
+// the event type and read/reference coordinates for each event are computed from the cigar ops instead of being stored per base
+// the view tracks the op containing the last event accessed, so walking a read in either direction costs O(1) per event
+struct cigar_event_view
+{
+    const cigar_op *cigar;
+    uint32 cigar_len;
+
+    // the current cigar op, along with the event index and read/reference offsets at which it starts
+    uint32 op;
+    uint32 op_event;
+    read_coord op_read_offset;
+    read_coord op_reference_offset;
+
+    CUDA_HOST_DEVICE cigar_event_view(const cigar_op *cigar, uint32 cigar_len, uint32 event_start)
+        : cigar(cigar),
+          cigar_len(cigar_len),
+          op(0),
+          op_event(event_start),
+          op_read_offset(0),
+          op_reference_offset(0)
+    { }
+
+    CUDA_HOST_DEVICE cigar_event::Event event(const uint32 ev)
+    {
+        seek(ev);
+        return cigar_event::from_cigar_op(cigar[op].op);
+    }
+
+    // the read coordinate for an event, or read_coord(-1) if the event has no read base
+    CUDA_HOST_DEVICE read_coord read_coordinate(const uint32 ev)
+    {
+        seek(ev);
+        return (cigar_event::read_len(cigar[op]) ? read_coord(op_read_offset + (ev - op_event)) : read_coord(-1));
+    }
+
+    // the reference coordinate for an event relative to the start of the alignment window,
+    // or read_coord(-1) if the event has no reference base
+    CUDA_HOST_DEVICE read_coord reference_coordinate(const uint32 ev)
+    {
+        seek(ev);
+        return (cigar_event::reference_len(cigar[op]) ? read_coord(op_reference_offset + (ev - op_event)) : read_coord(-1));
+    }
+
+    // move to the cigar op that contains a given event
+    CUDA_HOST_DEVICE void seek(const uint32 ev)
+    {
+        while(op > 0 && ev < op_event)
+        {
+            op--;
+            op_event -= cigar[op].len;
+            op_read_offset -= cigar_event::read_len(cigar[op]);
+            op_reference_offset -= cigar_event::reference_len(cigar[op]);
+        }
+
+        while(op + 1 < cigar_len && ev >= op_event + cigar[op].len)
+        {
+            op_event += cigar[op].len;
+            op_read_offset += cigar_event::read_len(cigar[op]);
+            op_reference_offset += cigar_event::reference_len(cigar[op]);
+            op++;
+        }
+    }
 };
 
 template <target_system system>
 struct cigar_context
 {
-    // prefix sum of cigar offsets
-    persistent_allocation<system, uint32> cigar_offsets;
-
-    // a vector of cigar "events"
-    packed_vector<system, 2> cigar_events;
-    // the read index for each cigar event
-    persistent_allocation<system, uint32> cigar_event_read_index;
-    // the read coordinate for each cigar event
-    persistent_allocation<system, uint16> cigar_event_read_coordinates;
-    // the reference coordinate for each cigar event, relative to the start of the alignment window
-    persistent_allocation<system, uint16> cigar_event_reference_coordinates;
+    // range of cigar event indices [x, y) for each read
+    // indices are assigned contiguously over the active reads only; events themselves are not stored (see cigar_event_view)
+    persistent_allocation<system, uint2> cigar_event_range;
 
     // alignment window in the read, not including clipped bases
-    persistent_allocation<system, ushort2> read_window_clipped;
+    persistent_allocation<system, read_coord2> read_window_clipped;
     // alignment window in the read, not including clipped bases or leading/trailing insertions
-    persistent_allocation<system, ushort2> read_window_clipped_no_insertions;
+    persistent_allocation<system, read_coord2> read_window_clipped_no_insertions;
     // alignment window in the reference, not including clipped bases (relative to base alignment position)
-    persistent_allocation<system, ushort2> reference_window_clipped;
+    persistent_allocation<system, read_coord2> reference_window_clipped;
 
     // bit vector representing SNPs, one per read bp
     // (1 means reference mismatch, 0 means match or non-M cigar event)
@@ -98,7 +192,27 @@ struct cigar_context
     packed_vector<system, 1> is_deletion;
 
     // number of errors for each read
-    persistent_allocation<system, uint16> num_errors;
+    persistent_allocation<system, read_coord> num_errors;
+
+    // number of bytes held by this context
+    size_t footprint(footprint_tracker& tracker) const
+    {
+        return firepony::footprint(tracker, cigar_event_range) +
+               firepony::footprint(tracker, read_window_clipped) +
+               firepony::footprint(tracker, read_window_clipped_no_insertions) +
+               firepony::footprint(tracker, reference_window_clipped) +
+               firepony::footprint(tracker, is_snp) +
+               firepony::footprint(tracker, is_insertion) +
+               firepony::footprint(tracker, is_deletion) +
+               firepony::footprint(tracker, num_errors);
+    }
+
+    // returns a view of the cigar events for a read
+    CUDA_HOST_DEVICE cigar_event_view events(const alignment_batch_device<system>& batch, const uint32 read_index) const
+    {
+        const CRQ_index idx = batch.crq_index(read_index);
+        return cigar_event_view(&batch.cigars[idx.cigar_start], idx.cigar_len, cigar_event_range[read_index].x);
+    }
 };
 
 template <target_system system> void expand_cigars(firepony_context<system>& context, const alignment_batch<system>& batch);
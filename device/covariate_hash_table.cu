@@ -0,0 +1,150 @@
+/*
+ * Firepony
+ *
+ * Copyright (c) 2014-2015, NVIDIA CORPORATION
+ * Copyright (c) 2015, Nuno Subtil <subtil@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the copyright holders nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../types.h"
+#include "firepony_context.h"
+#include "covariate_hash_table.h"
+
+#include <thrust/fill.h>
+
+#include <lift/parallel.h>
+
+namespace firepony {
+
+// re-inserts the contents of a hash table into another, larger table
+template <target_system system>
+struct covariate_hash_rehash
+{
+    typename covariate_observation_table<system>::view old_table;
+    typename covariate_hash_table<system>::view new_table;
+
+    covariate_hash_rehash(typename covariate_observation_table<system>::view old_table,
+                          typename covariate_hash_table<system>::view new_table)
+        : old_table(old_table), new_table(new_table)
+    { }
+
+    CUDA_HOST_DEVICE void operator() (const uint32 slot)
+    {
+        const covariate_key key = old_table.keys[slot];
+        if (key != covariate_hash_table<system>::empty_key)
+        {
+            new_table.insert(key, old_table.values[slot]);
+        }
+    }
+};
+
+template <typename Tuple>
+struct covariate_hash_slot_occupied : public thrust::unary_function<Tuple, bool>
+{
+    CUDA_HOST_DEVICE bool operator() (const Tuple& T)
+    {
+        return thrust::get<0>(T) != covariate_key(-1);
+    }
+};
+
+template <target_system system>
+void covariate_hash_table<system>::clear(void)
+{
+    thrust::fill(lift::backend_policy<system>::execution_policy(), keys.begin(), keys.end(), covariate_key(empty_key));
+    thrust::fill(lift::backend_policy<system>::execution_policy(), values.begin(), values.end(), covariate_observation_value { 0, 0 });
+
+    num_entries.resize(1);
+    num_entries.poke(0, 0);
+}
+
+template <target_system system>
+uint32 covariate_hash_table<system>::size(void)
+{
+    if (num_entries.size() == 0)
+        return 0;
+
+    return num_entries.peek(0);
+}
+METHOD_INSTANTIATE(covariate_hash_table, size);
+
+template <target_system system>
+void covariate_hash_table<system>::reserve(size_t num_new_keys)
+{
+    const size_t required = (size_t(size()) + num_new_keys) * max_load_factor_inv;
+
+    if (required <= capacity())
+    {
+        return;
+    }
+
+    size_t new_capacity = max<size_t>(capacity(), min_capacity);
+    while(new_capacity < required)
+    {
+        new_capacity *= 2;
+    }
+
+    // move the current contents out of the way
+    covariate_observation_table<system> old_table;
+    old_table.keys.copy(keys);
+    old_table.values.copy(values);
+
+    keys.resize(new_capacity);
+    values.resize(new_capacity);
+    clear();
+
+    // reinsert the old entries
+    parallel<system>::for_each(thrust::make_counting_iterator(0u),
+                               thrust::make_counting_iterator(0u) + old_table.size(),
+                               covariate_hash_rehash<system>(old_table, *this));
+}
+METHOD_INSTANTIATE(covariate_hash_table, reserve);
+
+template <target_system system>
+void covariate_hash_table<system>::flush(covariate_observation_table<system>& out, allocation<system, uint8>& temp_storage)
+{
+    const uint32 num_keys = size();
+
+    if (num_keys)
+    {
+        size_t off = out.size();
+        out.resize(out.size() + num_keys);
+
+        parallel<system>::copy_if(thrust::make_zip_iterator(thrust::make_tuple(keys.begin(),
+                                                                               values.begin())),
+                                  capacity(),
+                                  thrust::make_zip_iterator(thrust::make_tuple(out.keys.begin() + off,
+                                                                               out.values.begin() + off)),
+                                  covariate_hash_slot_occupied<thrust::tuple<const covariate_key&, const covariate_observation_value&> >(),
+                                  temp_storage);
+    }
+
+    if (capacity())
+    {
+        clear();
+    }
+}
+METHOD_INSTANTIATE(covariate_hash_table, flush);
+
+} // namespace firepony
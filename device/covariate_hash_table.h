@@ -0,0 +1,155 @@
+/*
+ * Firepony
+ *
+ * Copyright (c) 2014-2015, NVIDIA CORPORATION
+ * Copyright (c) 2015, Nuno Subtil <subtil@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the copyright holders nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "../types.h"
+#include "covariate_table.h"
+#include "primitives/atomics.h"
+
+namespace firepony {
+
+// open-addressing hash table used to accumulate observations for the sparse covariate tables
+// keys are inserted concurrently using linear probing and values are accumulated with atomics,
+// so the cost of adding a batch depends only on the batch size and not on the size of the table
+template <target_system system>
+struct covariate_hash_table
+{
+    enum {
+        // smallest number of slots we allocate
+        min_capacity = 1 << 16,
+        // we grow the table whenever it would become more than 1/max_load_factor_inv full
+        max_load_factor_inv = 2,
+    };
+
+    // marks an empty slot
+    // note: valid keys never have all bits set, as covariate chains use fewer bits than covariate_key holds
+    static constexpr covariate_key empty_key = covariate_key(-1);
+
+    persistent_allocation<system, covariate_key> keys;
+    persistent_allocation<system, covariate_observation_value> values;
+    // number of occupied slots (a single element, updated atomically during insertion)
+    persistent_allocation<system, uint32> num_entries;
+
+    size_t capacity(void) const
+    {
+        return keys.size();
+    }
+
+    // number of bytes held by this table
+    size_t footprint(footprint_tracker& tracker) const
+    {
+        return firepony::footprint(tracker, keys) +
+               firepony::footprint(tracker, values) +
+               firepony::footprint(tracker, num_entries);
+    }
+
+    // returns the number of occupied slots
+    uint32 size(void);
+
+    // make sure we have room for num_new_keys additional keys, growing and rehashing if required
+    void reserve(size_t num_new_keys);
+
+    // appends all entries to the (unsorted) observation table and empties the hash table
+    void flush(covariate_observation_table<system>& out, allocation<system, uint8>& temp_storage);
+
+    struct view
+    {
+        pointer<system, covariate_key> keys;
+        pointer<system, covariate_observation_value> values;
+        pointer<system, uint32> num_entries;
+
+        // murmur3 finalizer
+        static CUDA_HOST_DEVICE uint32 hash(covariate_key key)
+        {
+#if FIREPONY_LONG_READS
+            // fold the upper half of wide keys in
+            uint32 h = uint32(key) ^ uint32(key >> 32);
+#else
+            uint32 h = key;
+#endif
+            h ^= h >> 16;
+            h *= 0x85ebca6b;
+            h ^= h >> 13;
+            h *= 0xc2b2ae35;
+            h ^= h >> 16;
+            return h;
+        }
+
+        CUDA_HOST_DEVICE void insert(const covariate_key key, const covariate_observation_value& value)
+        {
+            // capacity is always a power of two
+            const uint32 mask = uint32(keys.size()) - 1;
+            uint32 slot = hash(key) & mask;
+
+            for(;;)
+            {
+                covariate_key current = keys[slot];
+
+                if (current == empty_key)
+                {
+                    // try to claim this slot
+                    current = atomic_cas(&keys[slot], empty_key, key);
+                    if (current == empty_key)
+                    {
+                        atomic_add(&num_entries[0], 1u);
+                        current = key;
+                    }
+                }
+
+                if (current == key)
+                {
+                    atomic_add(&values[slot].observations, value.observations);
+                    // mismatches are fixed point, so the totals do not depend on insertion order
+                    atomic_add(&values[slot].mismatches, value.mismatches);
+                    return;
+                }
+
+                slot = (slot + 1) & mask;
+            }
+        }
+    };
+
+    operator view()
+    {
+        struct view v = {
+            keys,
+            values,
+            num_entries,
+        };
+
+        return v;
+    }
+
+private:
+    void clear(void);
+};
+
+} // namespace firepony
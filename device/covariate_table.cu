@@ -106,12 +106,121 @@ void covariate_table<system, covariate_value>::pack(allocation<system, covariate
 METHOD_INSTANTIATE(covariate_observation_table, pack);
 METHOD_INSTANTIATE(covariate_empirical_table, pack);
 
+// merges two sorted tables using merge path partitioning
+// each invocation finds where the merge path crosses the start of its tile along the output diagonal,
+// then merges tile_size elements sequentially from that point
+// on equal keys, elements from a are placed first
+template <target_system system, typename covariate_value>
+struct covariate_table_merge_path
+{
+    enum {
+        tile_size = 128,
+    };
+
+    typename covariate_table<system, covariate_value>::view a;
+    typename covariate_table<system, covariate_value>::view b;
+    pointer<system, covariate_key> out_keys;
+    pointer<system, covariate_value> out_values;
+    uint32 a_size;
+    uint32 b_size;
+
+    covariate_table_merge_path(typename covariate_table<system, covariate_value>::view a, uint32 a_size,
+                               typename covariate_table<system, covariate_value>::view b, uint32 b_size,
+                               pointer<system, covariate_key> out_keys,
+                               pointer<system, covariate_value> out_values)
+        : a(a), b(b), out_keys(out_keys), out_values(out_values), a_size(a_size), b_size(b_size)
+    { }
+
+    CUDA_HOST_DEVICE void operator() (const uint32 tile)
+    {
+        const uint32 diag = tile * tile_size;
+        const uint32 diag_end = min<uint32>(diag + tile_size, a_size + b_size);
+
+        // binary search along the diagonal for the number of elements from a that precede it
+        uint32 lo = diag > b_size ? diag - b_size : 0;
+        uint32 hi = min<uint32>(diag, a_size);
+
+        while(lo < hi)
+        {
+            const uint32 mid = (lo + hi) / 2;
+
+            if (a.keys[mid] <= b.keys[diag - 1 - mid])
+            {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        uint32 i = lo;
+        uint32 j = diag - lo;
+
+        for(uint32 d = diag; d < diag_end; d++)
+        {
+            if (j >= b_size || (i < a_size && a.keys[i] <= b.keys[j]))
+            {
+                out_keys[d] = a.keys[i];
+                out_values[d] = a.values[i];
+                i++;
+            } else {
+                out_keys[d] = b.keys[j];
+                out_values[d] = b.values[j];
+                j++;
+            }
+        }
+    }
+};
+
+template <target_system system, typename covariate_value>
+void covariate_table<system, covariate_value>::merge(covariate_table<system, covariate_value>& other,
+                                                     allocation<system, covariate_key>& temp_keys,
+                                                     allocation<system, covariate_value>& temp_values,
+                                                     allocation<system, uint8>& temp_storage)
+{
+    typedef covariate_table_merge_path<system, covariate_value> merge_path;
+
+    if (other.size() == 0)
+    {
+        return;
+    }
+
+    if (this->size() == 0)
+    {
+        this->keys.copy(other.keys);
+        this->values.copy(other.values);
+        return;
+    }
+
+    const uint32 merged_size = this->size() + other.size();
+    const uint32 num_tiles = (merged_size + merge_path::tile_size - 1) / merge_path::tile_size;
+
+    temp_keys.resize(merged_size);
+    temp_values.resize(merged_size);
+
+    parallel<system>::for_each(thrust::make_counting_iterator(0u),
+                               thrust::make_counting_iterator(0u) + num_tiles,
+                               merge_path(*this, this->size(), other, other.size(), temp_keys, temp_values));
+
+    // since both inputs are packed, each key shows up at most twice in the merged output, in adjacent slots
+    // fold those pairs together on the way back into this table
+    this->resize(merged_size);
+
+    uint32 new_size = parallel<system>::reduce_by_key(temp_keys, temp_values,
+                                                      this->keys, this->values,
+                                                      temp_storage,
+                                                      covariate_value_sum<covariate_value>());
+
+    this->resize(new_size);
+}
+METHOD_INSTANTIATE(covariate_observation_table, merge);
+METHOD_INSTANTIATE(covariate_empirical_table, merge);
+
 struct convert_observation_to_empirical
 {
     CUDA_HOST_DEVICE covariate_empirical_value operator() (const covariate_observation_value& in)
     {
         return { in.observations,
-                 in.mismatches,
+                 mismatch_to_double(in.mismatches),
                  0.0,
                  0.0,
                  0.0 };
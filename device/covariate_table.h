@@ -31,16 +31,45 @@
 #pragma once
 
 #include "../types.h"
+#include "util.h"
 
 namespace firepony {
 
+#if FIREPONY_LONG_READS
+// the wider cycle covariate used for long reads does not fit in 32-bit keys
+typedef uint64 covariate_key;
+#else
 typedef uint32 covariate_key;
+#endif
+
+// mismatch counts in observation tables are fixed point numbers with MISMATCH_FRACTION_BITS fractional bits
+// fractional errors are quantized once, straight from double precision, when they are computed for each base;
+// from then on all accumulation is integer, which makes it exact and associative: tables come out bit-identical
+// regardless of reduction order, thread count or how the work was split across devices
+// 24 fractional bits matches single precision and still leaves room for 2^40 mismatches per table entry
+typedef uint64 covariate_mismatch;
+#define MISMATCH_FRACTION_BITS 24
+
+CUDA_HOST_DEVICE inline covariate_mismatch mismatch_from_error(const double error)
+{
+    return covariate_mismatch(error * double(covariate_mismatch(1) << MISMATCH_FRACTION_BITS) + 0.5);
+}
+
+CUDA_HOST_DEVICE inline double mismatch_to_double(const covariate_mismatch mismatches)
+{
+    return double(mismatches) / double(covariate_mismatch(1) << MISMATCH_FRACTION_BITS);
+}
+
+// the fixed point error for a single base, in the same format as covariate_mismatch
+// per-base errors are at most 1, so they fit in 32 bits
+typedef uint32 base_mismatch;
 
 // the value for each row of a covariate observation table
 struct covariate_observation_value
 {
     uint64 observations;
-    float mismatches;
+    // fixed point, see covariate_mismatch
+    covariate_mismatch mismatches;
 };
 
 // the value for each row of a covariate empirical table
@@ -76,6 +105,12 @@ struct covariate_table
         return keys.size();
     }
 
+    // number of bytes held by this table
+    size_t footprint(footprint_tracker& tracker) const
+    {
+        return firepony::footprint(tracker, keys) + firepony::footprint(tracker, values);
+    }
+
     template <target_system other_system>
     void copyfrom(covariate_table<other_system, covariate_value>& other)
     {
@@ -112,9 +147,30 @@ struct covariate_table
               allocation<system, covariate_value>& temp_values,
               allocation<system, uint8>& temp_storage);
 
+    // merges another table into this one, adding up values for keys present in both
+    // both tables must be sorted and packed; the result is also sorted and packed
+    void merge(covariate_table<system, covariate_value>& other,
+               allocation<system, covariate_key>& temp_keys,
+               allocation<system, covariate_value>& temp_values,
+               allocation<system, uint8>& temp_storage);
+
+    // cross-device merge
+    template <target_system other_system>
+    void merge(const lift::compute_device& my_device, const lift::compute_device& other_device,
+               covariate_table<other_system, covariate_value>& other,
+               allocation<system, covariate_key>& temp_keys,
+               allocation<system, covariate_value>& temp_values,
+               allocation<system, uint8>& temp_storage)
+    {
+        covariate_table<system, covariate_value> local;
+        local.concat(my_device, other_device, other);
+
+        merge(local, temp_keys, temp_values, temp_storage);
+    }
+
     struct view
     {
-        pointer<system, uint32> keys;
+        pointer<system, covariate_key> keys;
         pointer<system, covariate_value> values;
     };
 
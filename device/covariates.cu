@@ -44,171 +44,343 @@
 #include "../table_formatter.h"
 
 #include <thrust/functional.h>
+#include <thrust/iterator/transform_iterator.h>
 
 namespace firepony {
 
-// accumulates events from a read batch into a given covariate table
+// functor that determines if a key is valid
+// note: operator() returns a uint32 to allow for composition of this functor with reduction operators
 template <target_system system, typename covariate_packer>
-struct covariate_gatherer : public lambda<system>
+struct is_key_valid : public thrust::unary_function<covariate_key, uint32>
 {
-    LAMBDA_INHERIT;
-
-    CUDA_HOST_DEVICE void operator()(const uint32 cigar_event_index)
+    CUDA_HOST_DEVICE uint32 operator() (const covariate_key key)
     {
-        const uint32 read_index = ctx.cigar.cigar_event_read_index[cigar_event_index];
+        constexpr bool sparse = covariate_packer::chain::is_sparse(covariate_packer::TargetCovariate);
 
-        if (read_index == uint32(-1))
+        if (key == covariate_key(-1) ||
+            (sparse && covariate_packer::decode(key, covariate_packer::TargetCovariate) == covariate_packer::chain::invalid_key(covariate_packer::TargetCovariate)))
         {
-            // inactive read
-            return;
+            return 0;
+        } else {
+            return 1;
         }
+    }
+};
 
-        const CRQ_index idx = batch.crq_index(read_index);
-        const uint16 read_bp_offset = ctx.cigar.cigar_event_read_coordinates[cigar_event_index];
-        if (read_bp_offset == uint16(-1))
+// walks the cigar events for a read and generates covariate keys for all three tables
+// this is shared between the counting and emit passes, which guarantees both see exactly the same set of keys
+template <target_system system>
+struct covariate_event_walker : public lambda<system>
+{
+    LAMBDA_INHERIT;
+
+    // returns true if a cigar event generates covariate observations
+    CUDA_HOST_DEVICE bool is_event_active(const CRQ_index& idx, const uint32 read_index, cigar_event_view& events, const uint32 cigar_event_index)
+    {
+        const read_coord read_bp_offset = events.read_coordinate(cigar_event_index);
+        if (read_bp_offset == read_coord(-1))
         {
-            return;
+            return false;
         }
 
         if (read_bp_offset < ctx.cigar.read_window_clipped[read_index].x ||
             read_bp_offset > ctx.cigar.read_window_clipped[read_index].y)
         {
-            return;
+            return false;
         }
 
         if (ctx.active_location_list[idx.read_start + read_bp_offset] == 0)
         {
-            return;
+            return false;
+        }
+
+        if (events.event(cigar_event_index) == cigar_event::S)
+        {
+            return false;
         }
 
-        if (ctx.cigar.cigar_events[cigar_event_index] == cigar_event::S)
+        return true;
+    }
+
+    // calls op(table, key, error_index) for every valid key generated by the read
+    // table is 0 for quality, 1 for cycle and 2 for context
+    template <typename Op>
+    CUDA_HOST_DEVICE void walk(const uint32 read_index, Op& op)
+    {
+        const CRQ_index idx = batch.crq_index(read_index);
+        const uint32 cigar_start = ctx.cigar.cigar_event_range[read_index].x;
+        const uint32 cigar_end = ctx.cigar.cigar_event_range[read_index].y;
+        auto events = ctx.cigar.events(batch, read_index);
+
+        // the read group, quality score and event type covariates are shared by all tables
+        // compute them once here and let each chain reuse them
+        covariate_event_values values;
+        values.read_group = covariate_ReadGroup<system>::value(batch, read_index);
+
+        // cycle and context keys are generated sequentially as we move along the read
+        // (events for a read are visited in read order, so the context window only moves forward)
+        typename covariate_Cycle_Illumina<system>::read_state cycle_state(ctx, batch, read_index);
+        typename covariate_Context<system,
+                                   covariate_packer_context<system>::num_bases_mismatch,
+                                   covariate_packer_context<system>::num_bases_indel>::read_state context_state(ctx, batch, read_index);
+
+        for(uint32 ev = cigar_start; ev < cigar_end; ev++)
         {
-            return;
+            if (!is_event_active(idx, read_index, events, ev))
+            {
+                continue;
+            }
+
+            const read_coord read_bp_offset = events.read_coordinate(ev);
+            const uint32 error_index = idx.qual_start + read_bp_offset;
+
+            values.quality = covariate_QualityScore<system>::value(batch, read_index, read_bp_offset);
+            values.cycle = cycle_state.value(read_bp_offset);
+            values.context = context_state.value(read_bp_offset);
+
+            walk_keys<covariate_packer_quality_score<system> >(0, read_index, read_bp_offset, ev, values, error_index, op);
+            walk_keys<covariate_packer_cycle_illumina<system> >(1, read_index, read_bp_offset, ev, values, error_index, op);
+            walk_keys<covariate_packer_context<system> >(2, read_index, read_bp_offset, ev, values, error_index, op);
         }
+    }
 
-        covariate_key_set keys = covariate_packer::chain::encode(ctx, batch, read_index, read_bp_offset, cigar_event_index, covariate_key_set{0, 0, 0});
+private:
+    template <typename covariate_packer, typename Op>
+    CUDA_HOST_DEVICE void walk_keys(const uint32 table, const uint32 read_index, const read_coord read_bp_offset,
+                                    const uint32 cigar_event_index, const covariate_event_values& values,
+                                    const uint32 error_index, Op& op)
+    {
+        covariate_key_set keys = covariate_packer::chain::encode(ctx, batch, read_index, read_bp_offset, cigar_event_index, values, covariate_key_set{0, 0, 0});
 
-        ctx.covariates.scratch_table_space.keys  [cigar_event_index * 3 + 0] = keys.M;
-        ctx.covariates.scratch_table_space.values[cigar_event_index * 3 + 0].observations = 1;
-        ctx.covariates.scratch_table_space.values[cigar_event_index * 3 + 0].mismatches = ctx.fractional_error.snp_errors[idx.qual_start + read_bp_offset];
+        if (is_key_valid<system, covariate_packer>()(keys.M))
+            op(table, keys.M, ctx.fractional_error.snp_errors[error_index]);
 
-        ctx.covariates.scratch_table_space.keys  [cigar_event_index * 3 + 1] = keys.I;
-        ctx.covariates.scratch_table_space.values[cigar_event_index * 3 + 1].observations = 1;
-        ctx.covariates.scratch_table_space.values[cigar_event_index * 3 + 1].mismatches = ctx.fractional_error.insertion_errors[idx.qual_start + read_bp_offset];
+        if (is_key_valid<system, covariate_packer>()(keys.I))
+            op(table, keys.I, ctx.fractional_error.insertion_errors[error_index]);
 
-        ctx.covariates.scratch_table_space.keys  [cigar_event_index * 3 + 2] = keys.D;
-        ctx.covariates.scratch_table_space.values[cigar_event_index * 3 + 2].observations = 1;
-        ctx.covariates.scratch_table_space.values[cigar_event_index * 3 + 2].mismatches = ctx.fractional_error.deletion_errors[idx.qual_start + read_bp_offset];
+        if (is_key_valid<system, covariate_packer>()(keys.D))
+            op(table, keys.D, ctx.fractional_error.deletion_errors[error_index]);
     }
 };
 
-// functor that determines if a key is valid
-// note: operator() returns a uint32 to allow for composition of this functor with reduction operators
-template <target_system system, typename covariate_packer>
-struct is_key_valid : public thrust::unary_function<covariate_key, uint32>
+// counts the number of valid observations generated by each active read for each table
+template <target_system system>
+struct covariate_observation_counter : public covariate_event_walker<system>
 {
-    CUDA_HOST_DEVICE uint32 operator() (const covariate_key key)
+    using covariate_event_walker<system>::covariate_event_walker;
+    using covariate_event_walker<system>::ctx;
+
+    struct counter
     {
-        constexpr bool sparse = covariate_packer::chain::is_sparse(covariate_packer::TargetCovariate);
+        uint32 count[3];
 
-        if (key == covariate_key(-1) ||
-            (sparse && covariate_packer::decode(key, covariate_packer::TargetCovariate) == covariate_packer::chain::invalid_key(covariate_packer::TargetCovariate)))
+        CUDA_HOST_DEVICE void operator() (const uint32 table, const covariate_key key, const base_mismatch error)
         {
-            return 0;
-        } else {
-            return 1;
+            count[table]++;
         }
+    };
+
+    CUDA_HOST_DEVICE void operator() (const uint32 active_read_id)
+    {
+        const uint32 read_index = ctx.active_read_list[active_read_id];
+
+        counter c = { { 0, 0, 0 } };
+        this->walk(read_index, c);
+
+        ctx.covariates.batch_quality.counts[active_read_id] = c.count[0];
+        ctx.covariates.batch_cycle.counts[active_read_id] = c.count[1];
+        ctx.covariates.batch_context.counts[active_read_id] = c.count[2];
     }
 };
 
-template <target_system system, typename covariate_packer, typename Tuple>
-struct is_key_value_pair_valid : public thrust::unary_function<Tuple, bool>
+// writes out the valid observations for each active read at their final positions in the batch tables
+template <target_system system>
+struct covariate_observation_emitter : public covariate_event_walker<system>
 {
-    CUDA_HOST_DEVICE uint32 operator() (const Tuple& T)
+    using covariate_event_walker<system>::covariate_event_walker;
+    using covariate_event_walker<system>::ctx;
+
+    struct emitter
+    {
+        typename covariate_observation_table<system>::view tables[3];
+        uint32 out[3];
+
+        CUDA_HOST_DEVICE void operator() (const uint32 table, const covariate_key key, const base_mismatch error)
+        {
+            const uint32 i = out[table]++;
+
+            tables[table].keys[i] = key;
+            tables[table].values[i].observations = 1;
+            tables[table].values[i].mismatches = error;
+        }
+    };
+
+    CUDA_HOST_DEVICE void operator() (const uint32 active_read_id)
     {
-        covariate_key key = thrust::get<0>(T);
-        return is_key_valid<system, covariate_packer>()(key) ? true : false;
+        const uint32 read_index = ctx.active_read_list[active_read_id];
+        auto& cv = ctx.covariates;
+
+        emitter e = { { cv.batch_quality.table, cv.batch_cycle.table, cv.batch_context.table },
+                      { cv.batch_quality.offsets[active_read_id],
+                        cv.batch_cycle.offsets[active_read_id],
+                        cv.batch_context.offsets[active_read_id] } };
+
+        this->walk(read_index, e);
     }
 };
 
-// processes a batch of reads and updates covariate table data for a given table
-template <typename covariate_packer, target_system system>
-static void build_covariates_table(covariate_observation_table<system>& table, firepony_context<system>& context, const alignment_batch<system>& batch)
+// computes the offsets for each read in a batch table from the per-read counts and sizes the table accordingly
+template <target_system system>
+static void prepare_batch_observations(covariate_batch_observations<system>& obs, const uint32 num_active)
 {
-    auto& cv = context.covariates;
-    auto& scratch_table = cv.scratch_table_space;
+    obs.offsets.resize(num_active + 1);
 
-    scoped_allocation<system, covariate_observation_value> temp_values;
-    scoped_allocation<system, covariate_key> temp_keys;
+    // first offset is zero
+    thrust::fill_n(lift::backend_policy<system>::execution_policy(), obs.offsets.begin(), 1, 0);
+    // do an inclusive scan to compute all offsets + the total size
+    parallel<system>::inclusive_scan(obs.counts.begin(),
+                                     num_active,
+                                     obs.offsets.begin() + 1,
+                                     thrust::plus<uint32>());
 
-    timer<system> covariates_gather, covariates_filter, covariates_sort, covariates_pack;
+    obs.table.resize(obs.offsets.peek(num_active));
+}
 
-    covariates_gather.start();
+// generates the covariate observations for all tables in a single traversal of the cigar events
+// a first pass counts the valid observations per read, a second pass writes them out compacted
+template <target_system system>
+static void gather_covariate_observations(firepony_context<system>& context, const alignment_batch<system>& batch)
+{
+    auto& cv = context.covariates;
+    const uint32 num_active = context.active_read_list.size();
+
+    timer<system> covariates_gather, covariates_filter;
 
-    // set up a scratch table space with enough room for 3 keys per cigar event
-    scratch_table.resize(context.cigar.cigar_events.size() * 3);
+    covariates_gather.start();
 
-    // mark all keys as invalid
-    thrust::fill(lift::backend_policy<system>::execution_policy(),
-                 scratch_table.keys.begin(),
-                 scratch_table.keys.end(),
-                 covariate_key(-1));
+    cv.batch_quality.counts.resize(num_active);
+    cv.batch_cycle.counts.resize(num_active);
+    cv.batch_context.counts.resize(num_active);
 
-    // generate keys into the scratch table
     parallel<system>::for_each(thrust::make_counting_iterator(0u),
-                               thrust::make_counting_iterator(0u) + context.cigar.cigar_event_read_coordinates.size(),
-                               covariate_gatherer<system, covariate_packer>(context, batch.device));
+                               thrust::make_counting_iterator(0u) + num_active,
+                               covariate_observation_counter<system>(context, batch.device));
 
     covariates_gather.stop();
 
     covariates_filter.start();
 
-    // count valid keys
-    uint32 valid_keys = parallel<system>::sum(thrust::make_transform_iterator(scratch_table.keys.begin(),
-                                                                              is_key_valid<system, covariate_packer>()),
-                                              scratch_table.keys.size(),
-                                              context.temp_storage);
+    prepare_batch_observations(cv.batch_quality, num_active);
+    prepare_batch_observations(cv.batch_cycle, num_active);
+    prepare_batch_observations(cv.batch_context, num_active);
+
+    covariates_filter.stop();
+
+    covariates_gather.start();
+
+    parallel<system>::for_each(thrust::make_counting_iterator(0u),
+                               thrust::make_counting_iterator(0u) + num_active,
+                               covariate_observation_emitter<system>(context, batch.device));
+
+    covariates_gather.stop();
+
+    parallel<system>::synchronize();
 
-    if (valid_keys)
+    context.stats.covariates_gather.add(covariates_gather);
+    context.stats.covariates_filter.add(covariates_filter);
+}
+
+// inserts the observations from a batch table into a covariate hash table
+template <target_system system>
+struct covariate_hash_inserter
+{
+    typename covariate_observation_table<system>::view batch_table;
+    typename covariate_hash_table<system>::view table;
+
+    covariate_hash_inserter(typename covariate_observation_table<system>::view batch_table,
+                            typename covariate_hash_table<system>::view table)
+        : batch_table(batch_table), table(table)
+    { }
+
+    CUDA_HOST_DEVICE void operator() (const uint32 index)
     {
-        // concatenate valid keys to the end of the output table
-        size_t off = table.size();
-        table.resize(table.size() + valid_keys);
-
-        parallel<system>::copy_if(thrust::make_zip_iterator(thrust::make_tuple(scratch_table.keys.begin(),
-                                                                               scratch_table.values.begin())),
-                                  scratch_table.keys.size(),
-                                  thrust::make_zip_iterator(thrust::make_tuple(table.keys.begin() + off,
-                                                                               table.values.begin() + off)),
-                                  is_key_value_pair_valid<system,
-                                                          covariate_packer,
-                                                          thrust::tuple<const covariate_key&, const typename covariate_observation_table<system>::value_type&> >(),
-                                  context.temp_storage);
+        table.insert(batch_table.keys[index], batch_table.values[index]);
     }
+};
 
-    covariates_filter.stop();
+// updates covariate table data for a given table with the observations for the current batch
+template <typename covariate_packer, target_system system>
+static void build_covariates_table(covariate_observation_table<system>& table, covariate_observation_table<system>& batch_table, firepony_context<system>& context)
+{
+    pooled_allocation<system, covariate_observation_value> temp_values(context.pool);
+    pooled_allocation<system, covariate_key> temp_keys(context.pool);
 
-    if (valid_keys)
+    timer<system> covariates_sort, covariates_pack, covariates_merge;
+
+    if (batch_table.size())
     {
-        // sort and reduce the table by key
+        // sort and reduce the keys for this batch only
         covariates_sort.start();
-        table.sort(temp_keys, temp_values, context.temp_storage, covariate_packer::chain::bits_used);
+        batch_table.sort(temp_keys, temp_values, context.temp_storage, covariate_packer::chain::bits_used);
         covariates_sort.stop();
 
         covariates_pack.start();
-        table.pack(temp_keys, temp_values, context.temp_storage);
+        batch_table.pack(temp_keys, temp_values, context.temp_storage);
         covariates_pack.stop();
+
+        // fold them into the (already sorted) output table
+        covariates_merge.start();
+        table.merge(batch_table, temp_keys, temp_values, context.temp_storage);
+        covariates_merge.stop();
+
+        parallel<system>::synchronize();
+
+        context.stats.covariates_sort.add(covariates_sort);
+        context.stats.covariates_pack.add(covariates_pack);
+        context.stats.covariates_merge.add(covariates_merge);
     }
+}
 
-    parallel<system>::synchronize();
+// accumulates the observations for the current batch into a hash table
+// the batch is reduced to its distinct keys first, so the hash table is sized by the number of distinct keys rather than
+// the number of observations; the hash table itself is only sorted once, when it gets flushed at the end of processing
+template <typename covariate_packer, target_system system>
+static void build_covariates_hash_table(covariate_hash_table<system>& table, covariate_observation_table<system>& batch_table, firepony_context<system>& context)
+{
+    static_assert(covariate_packer::chain::bits_used < sizeof(covariate_key) * 8, "covariate chain must leave room for the empty hash slot pattern");
 
-    context.stats.covariates_gather.add(covariates_gather);
-    context.stats.covariates_filter.add(covariates_filter);
+    pooled_allocation<system, covariate_observation_value> temp_values(context.pool);
+    pooled_allocation<system, covariate_key> temp_keys(context.pool);
+
+    timer<system> covariates_sort, covariates_pack, covariates_hash;
 
-    if (valid_keys)
+    if (batch_table.size())
     {
+        // sort and reduce the keys for this batch only
+        covariates_sort.start();
+        batch_table.sort(temp_keys, temp_values, context.temp_storage, covariate_packer::chain::bits_used);
+        covariates_sort.stop();
+
+        covariates_pack.start();
+        batch_table.pack(temp_keys, temp_values, context.temp_storage);
+        covariates_pack.stop();
+
+        covariates_hash.start();
+
+        // make sure the table can take all keys in this batch, even if they're all new
+        table.reserve(batch_table.size());
+
+        parallel<system>::for_each(thrust::make_counting_iterator(0u),
+                                   thrust::make_counting_iterator(0u) + batch_table.size(),
+                                   covariate_hash_inserter<system>(batch_table, table));
+
+        covariates_hash.stop();
+
+        parallel<system>::synchronize();
+
         context.stats.covariates_sort.add(covariates_sort);
         context.stats.covariates_pack.add(covariates_pack);
+        context.stats.covariates_hash.add(covariates_hash);
     }
 }
 
@@ -217,31 +389,21 @@ struct compute_high_quality_windows : public lambda<system>
 {
     LAMBDA_INHERIT;
 
-    enum {
-        // any bases with q <= LOW_QUAL_TAIL are considered low quality
-        LOW_QUAL_TAIL = 2
-    };
-
     CUDA_HOST_DEVICE void operator() (const uint32 read_index)
     {
-        const CRQ_index idx = batch.crq_index(read_index);
-
-        const auto& window = ctx.cigar.read_window_clipped[read_index];
-        auto& low_qual_window = ctx.covariates.high_quality_window[read_index];
-
-        low_qual_window = window;
+        ctx.covariates.high_quality_window[read_index] = clip_low_quality_tails(batch, read_index, ctx.cigar.read_window_clipped[read_index]);
+    }
+};
 
-        while(batch.qualities[idx.qual_start + low_qual_window.x] <= LOW_QUAL_TAIL &&
-                low_qual_window.x < low_qual_window.y)
-        {
-            low_qual_window.x++;
-        }
+// flags reads with cycles that do not fit in the cycle covariate key
+template <target_system system>
+struct read_exceeds_cycle_limit : public lambda<system>
+{
+    LAMBDA_INHERIT;
 
-        while(batch.qualities[idx.qual_start + low_qual_window.y] <= LOW_QUAL_TAIL &&
-                low_qual_window.y > low_qual_window.x)
-        {
-            low_qual_window.y--;
-        }
+    CUDA_HOST_DEVICE uint32 operator() (const uint32 read_index)
+    {
+        return !typename covariate_Cycle_Illumina<system>::read_state(ctx, batch, read_index).read_fits();
     }
 };
 
@@ -256,36 +418,49 @@ void gather_covariates(firepony_context<system>& context, const alignment_batch<
                                context.active_read_list.end(),
                                compute_high_quality_windows<system>(context, batch.device));
 
-    build_covariates_table<covariate_packer_quality_score<system> >(cv.quality, context, batch);
-    build_covariates_table<covariate_packer_cycle_illumina<system> >(cv.cycle, context, batch);
-    build_covariates_table<covariate_packer_context<system> >(cv.context, context, batch);
+    // bases past the cycle limit are left out of the cycle table; count the reads this affects
+    context.stats.cycle_limited_reads += parallel<system>::sum(thrust::make_transform_iterator(context.active_read_list.begin(),
+                                                                                               read_exceeds_cycle_limit<system>(context, batch.device)),
+                                                               context.active_read_list.size(),
+                                                               context.temp_storage);
+
+    gather_covariate_observations(context, batch);
+
+    build_covariates_table<covariate_packer_quality_score<system> >(cv.quality, cv.batch_quality.table, context);
+    build_covariates_hash_table<covariate_packer_cycle_illumina<system> >(cv.cycle_hash, cv.batch_cycle.table, context);
+    build_covariates_hash_table<covariate_packer_context<system> >(cv.context_hash, cv.batch_context.table, context);
 }
 INSTANTIATE(gather_covariates);
 
-template <target_system system> void postprocess_covariates(firepony_context<system>& context)
+// moves the contents of the hash-based accumulators into the cycle and context tables
+// must be called once all batches have been processed, before any cross-device gathering happens
+template <target_system system>
+void flush_covariates(firepony_context<system>& context)
 {
     auto& cv = context.covariates;
 
-    // sort and pack all tables
-    // this is required because we may have collected results from different devices
-    scoped_allocation<system, covariate_observation_value> temp_values;
-    scoped_allocation<system, covariate_key> temp_keys;
-
-    cv.quality.sort(temp_keys, temp_values, context.temp_storage, covariate_packer_quality_score<system>::chain::bits_used);
-    cv.quality.pack(temp_keys, temp_values, context.temp_storage);
+    pooled_allocation<system, covariate_observation_value> temp_values(context.pool);
+    pooled_allocation<system, covariate_key> temp_keys(context.pool);
 
+    // hash table keys are unique, so the flushed tables only need to be sorted (not packed)
+    cv.cycle_hash.flush(cv.cycle, context.temp_storage);
     cv.cycle.sort(temp_keys, temp_values, context.temp_storage, covariate_packer_cycle_illumina<system>::chain::bits_used);
-    cv.cycle.pack(temp_keys, temp_values, context.temp_storage);
 
+    cv.context_hash.flush(cv.context, context.temp_storage);
     cv.context.sort(temp_keys, temp_values, context.temp_storage, covariate_packer_context<system>::chain::bits_used);
-    cv.context.pack(temp_keys, temp_values, context.temp_storage);
+}
+INSTANTIATE(flush_covariates);
+
+template <target_system system> void postprocess_covariates(firepony_context<system>& context)
+{
+    // nothing to do here: all covariate tables are kept sorted and packed at all times
+    // (per-batch updates, hash table flushes and cross-device gathering all merge into sorted tables)
 }
 INSTANTIATE(postprocess_covariates);
 
-template <target_system system>
-void output_covariates(firepony_context<system>& context)
+void output_covariates(recalibration_report& report)
 {
-    covariate_packer_quality_score<system>::dump_table(context, context.covariates.empirical_quality);
+    covariate_packer_quality_score<host>::dump_table(report.read_groups, report.quality);
 
     table_formatter fmt("RecalTable2");
     fmt.add_column("ReadGroup", table_formatter::FMT_STRING);
@@ -299,17 +474,10 @@ void output_covariates(firepony_context<system>& context)
     fmt.add_column("Observations", table_formatter::FMT_UINT64);
     fmt.add_column("Errors", table_formatter::FMT_FLOAT_2, table_formatter::ALIGNMENT_RIGHT, table_formatter::ALIGNMENT_LEFT);
 
-    // preprocess table data to compute column widths
-    covariate_packer_context<system>::dump_table(context, context.covariates.empirical_context, fmt);
-    covariate_packer_cycle_illumina<system>::dump_table(context, context.covariates.empirical_cycle, fmt);
-    fmt.end_table();
-
-    // output table
-    covariate_packer_context<system>::dump_table(context, context.covariates.empirical_context, fmt);
-    covariate_packer_cycle_illumina<system>::dump_table(context, context.covariates.empirical_cycle, fmt);
+    covariate_packer_context<host>::dump_table(report.read_groups, report.context, fmt);
+    covariate_packer_cycle_illumina<host>::dump_table(report.read_groups, report.cycle, fmt);
     fmt.end_table();
 }
-INSTANTIATE(output_covariates);
 
 template <target_system system, typename covariate_packer>
 static void build_empirical_table(firepony_context<system>& context, covariate_empirical_table<system>& out, covariate_observation_table<system>& in)
@@ -31,32 +31,112 @@
 #pragma once
 
 #include "../types.h"
+#include "alignment_data_device.h"
 #include "covariate_table.h"
+#include "covariate_hash_table.h"
+#include "recalibration_report.h"
 
 namespace firepony {
 
+// valid observations generated by a batch for a given covariate table
+template <target_system system>
+struct covariate_batch_observations
+{
+    // number of observations generated by each active read
+    persistent_allocation<system, uint32> counts;
+    // offset of the first observation for each active read in the table (plus the total size at the end)
+    persistent_allocation<system, uint32> offsets;
+    // the observations, in read order
+    covariate_observation_table<system> table;
+
+    size_t footprint(footprint_tracker& tracker) const
+    {
+        return firepony::footprint(tracker, counts) +
+               firepony::footprint(tracker, offsets) +
+               table.footprint(tracker);
+    }
+};
+
 template <target_system system>
 struct covariates_context
 {
     // read window after clipping low quality ends
-    persistent_allocation<system, ushort2> high_quality_window;
+    persistent_allocation<system, read_coord2> high_quality_window;
 
-    covariate_observation_table<system> scratch_table_space;
+    // observations generated by the current batch for each table
+    covariate_batch_observations<system> batch_quality;
+    covariate_batch_observations<system> batch_cycle;
+    covariate_batch_observations<system> batch_context;
 
     covariate_observation_table<system> quality;
     covariate_observation_table<system> cycle;
     covariate_observation_table<system> context;
 
+    // hash-based accumulators for the sparse tables
+    // these are flushed into cycle and context once all batches have been processed
+    covariate_hash_table<system> cycle_hash;
+    covariate_hash_table<system> context_hash;
+
     covariate_empirical_table<system> empirical_quality;
     covariate_empirical_table<system> empirical_cycle;
     covariate_empirical_table<system> empirical_context;
 
     covariate_empirical_table<system> read_group;
+
+    // number of bytes held by the tables that accumulate over the whole run
+    // this does not depend on the batch size
+    size_t accumulator_footprint(footprint_tracker& tracker) const
+    {
+        return quality.footprint(tracker) +
+               cycle.footprint(tracker) +
+               context.footprint(tracker) +
+               cycle_hash.footprint(tracker) +
+               context_hash.footprint(tracker) +
+               empirical_quality.footprint(tracker) +
+               empirical_cycle.footprint(tracker) +
+               empirical_context.footprint(tracker) +
+               read_group.footprint(tracker);
+    }
+
+    // number of bytes held by this context
+    size_t footprint(footprint_tracker& tracker) const
+    {
+        return firepony::footprint(tracker, high_quality_window) +
+               batch_quality.footprint(tracker) +
+               batch_cycle.footprint(tracker) +
+               batch_context.footprint(tracker) +
+               accumulator_footprint(tracker);
+    }
 };
 
+// any bases with q <= LOW_QUAL_TAIL at the ends of a read are considered low quality
+#define LOW_QUAL_TAIL 2
+
+// clips the low quality ends off a read window
+template <target_system system>
+CUDA_HOST_DEVICE inline read_coord2 clip_low_quality_tails(const alignment_batch_device<system>& batch, const uint32 read_index, read_coord2 window)
+{
+    const CRQ_index idx = batch.crq_index(read_index);
+
+    while(batch.qualities[idx.qual_start + window.x] <= LOW_QUAL_TAIL &&
+            window.x < window.y)
+    {
+        window.x++;
+    }
+
+    while(batch.qualities[idx.qual_start + window.y] <= LOW_QUAL_TAIL &&
+            window.y > window.x)
+    {
+        window.y--;
+    }
+
+    return window;
+}
+
 template <target_system system> void gather_covariates(firepony_context<system>& context, const alignment_batch<system>& batch);
+template <target_system system> void flush_covariates(firepony_context<system>& context);
 template <target_system system> void postprocess_covariates(firepony_context<system>& context);
-template <target_system system> void output_covariates(firepony_context<system>& context);
+void output_covariates(recalibration_report& report);
 template <target_system system> void compute_empirical_quality_scores(firepony_context<system>& context);
 
 } // namespace firepony
@@ -45,8 +45,20 @@ struct covariate_key_set
     covariate_key D;
 };
 
+// covariate values for a given cigar event
+// these are computed by the per-read key generation loop and handed down each chain:
+// covariates shared between chains are computed only once, while per-read covariates
+// (cycle, context) are updated incrementally as the loop moves along the read
+struct covariate_event_values
+{
+    uint32 read_group;
+    covariate_key_set quality;
+    covariate_key_set cycle;
+    covariate_key_set context;
+};
+
 // generates a bit mask with the lowest N_bits set
-#define BITMASK(N_bits) ((1 << (N_bits)) - 1)
+#define BITMASK(N_bits) ((covariate_key(1) << (N_bits)) - 1)
 
 // constexpr versions of min and max for uint32
 constexpr uint32 constexpr_max(uint32 a, uint32 b)
@@ -95,7 +107,8 @@ protected:
     static CUDA_HOST_DEVICE covariate_key_set build_key(covariate_key_set input_key, covariate_key_set data,
                                                         firepony_context<system>& ctx,
                                                         const alignment_batch_device<system>& batch,
-                                                        uint32 read_index, uint16 bp_offset, uint32 cigar_event_index)
+                                                        uint32 read_index, read_coord bp_offset, uint32 cigar_event_index,
+                                                        const covariate_event_values& values)
     {
         // add in our bits
         input_key.M = input_key.M | (data.M << offset);
@@ -103,7 +116,7 @@ protected:
         input_key.D = input_key.D | (data.D << offset);
 
         // pass along to next in chain
-        return PreviousCovariate::encode(ctx, batch, read_index, bp_offset, cigar_event_index, input_key);
+        return PreviousCovariate::encode(ctx, batch, read_index, bp_offset, cigar_event_index, values, input_key);
     }
 
 public:
@@ -128,9 +141,9 @@ public:
         return (target_index == index ? invalid_key_pattern : PreviousCovariate::invalid_key(target_index));
     }
 
-    static constexpr CUDA_HOST_DEVICE uint32 key_mask(const uint32 target_index)
+    static constexpr CUDA_HOST_DEVICE covariate_key key_mask(const uint32 target_index)
     {
-        return (target_index == index ? mask : PreviousCovariate::key_mask(target_index));
+        return (target_index == index ? covariate_key(mask) : PreviousCovariate::key_mask(target_index));
     }
 };
 
@@ -148,7 +161,8 @@ struct covariate_null
 
     static CUDA_HOST_DEVICE covariate_key_set encode(firepony_context<system>& ctx,
                                                      const alignment_batch_device<system>& batch,
-                                                     uint32 read_index, uint16 bp_offset, uint32 cigar_event_index,
+                                                     uint32 read_index, read_coord bp_offset, uint32 cigar_event_index,
+                                                     const covariate_event_values& values,
                                                      covariate_key_set input_key = {0, 0, 0})
     {
         return input_key;
@@ -169,7 +183,7 @@ struct covariate_null
         return 0;
     }
 
-    static constexpr CUDA_HOST_DEVICE uint32 key_mask(const uint32 target_index)
+    static constexpr CUDA_HOST_DEVICE covariate_key key_mask(const uint32 target_index)
     {
         return 0;
     }
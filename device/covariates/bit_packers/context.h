@@ -101,50 +101,134 @@ struct covariate_Context : public covariate<system, PreviousCovariate, 4 + const
         return ((rev & pattern_hi) >> 1) | ((rev & pattern_lo) << 1);
     }
 
+    // per-read state for sequential context key generation
+    // keeps a rolling window of the max_context_bases bases that make up the context at the current offset,
+    // so moving along the read only requires loading one new base
+    //
     // context encoding (MSB to LSB): BB[bp_offset] BB[bp_offset-1] BB[bp_offset-2] ... SSSS
     // B = base pair bit, S = size bit
-    static CUDA_HOST_DEVICE covariate_key_set encode(firepony_context<system>& ctx,
-                                                     const alignment_batch_device<system>& batch,
-                                                     uint32 read_index, uint16 bp_offset, uint32 cigar_event_index,
-                                                     covariate_key_set input_key = {0, 0, 0})
+    // on the negative strand, the context extends towards the end of the read and is complemented
+    struct read_state
     {
-        const auto idx = batch.crq_index(read_index);
-        const auto& window = ctx.covariates.high_quality_window[read_index];
-        const bool negative_strand = batch.flags[read_index] & AlignmentFlags::REVERSE;
-
-        covariate_key context = 0;
-        covariate_key context_mismatch = base::invalid_key_pattern;
-        covariate_key context_indel = base::invalid_key_pattern;
-
-        // which direction do we need to move in the read?
-        const int direction = negative_strand ? 1 : -1;
-        // how many context bases do we have available?
-        const int context_bases = negative_strand ? min<int>(window.y - bp_offset + 1, max_context_bases) : min<int>(bp_offset - window.x + 1, max_context_bases);
-        // where is our starting point?
-        const int start_offset = bp_offset;
-        // where is our stopping point?
-        const int stop_offset = bp_offset + context_bases * direction;
-
-        // do we have enough bases for the smallest context?
-        if (context_bases >= min_context_bases)
+        const alignment_batch_device<system>& batch;
+        uint32 read_start;
+        read_coord2 window;
+        bool negative_strand;
+
+        // the current offset in the read, -1 if not yet initialized
+        int offset;
+        // 2-bit encoded bases in the context window, with the base at the current offset in the top slot
+        covariate_key bases;
+        // one bit per context window slot, set if the base is regular and inside the high quality window
+        uint32 valid;
+
+        CUDA_HOST_DEVICE read_state(firepony_context<system>& ctx,
+                                    const alignment_batch_device<system>& batch,
+                                    uint32 read_index)
+            : read_state(batch, read_index, ctx.covariates.high_quality_window[read_index])
+        { }
+
+        // bases outside window (the read with its low quality ends clipped) are never part of a context
+        CUDA_HOST_DEVICE read_state(const alignment_batch_device<system>& batch,
+                                    uint32 read_index,
+                                    const read_coord2 window)
+            : batch(batch),
+              read_start(batch.crq_index(read_index).read_start),
+              window(window),
+              negative_strand(batch.flags[read_index] & AlignmentFlags::REVERSE),
+              offset(-1),
+              bases(0),
+              valid(0)
+        { }
+
+        // loads the base at a given read offset, returns false if it can not be part of a context
+        CUDA_HOST_DEVICE bool load(const int read_offset, covariate_key& bp_code) const
         {
-            int num_bases = 0;
+            // compare as int: read_offset goes negative near the start of the read, and window is unsigned in long-read builds
+            if (negative_strand ? read_offset > int(window.y) : read_offset < int(window.x))
+            {
+                bp_code = 0;
+                return false;
+            }
+
+            const uint8 bp = batch.reads[read_start + read_offset];
+            if (is_non_regular_base(bp))
+            {
+                bp_code = 0;
+                return false;
+            }
+
+            bp_code = from_nvbio::iupac16_to_dna(bp);
+            return true;
+        }
+
+        // fill the context window from scratch
+        CUDA_HOST_DEVICE void reset(const int read_offset)
+        {
+            const int direction = negative_strand ? 1 : -1;
+
+            bases = 0;
+            valid = 0;
+
+            for(uint32 slot = 0; slot < max_context_bases; slot++)
+            {
+                covariate_key bp_code;
+                const bool bp_valid = load(read_offset + slot * direction, bp_code);
+
+                bases |= bp_code << ((max_context_bases - 1 - slot) * 2);
+                valid |= uint32(bp_valid) << (max_context_bases - 1 - slot);
+            }
+
+            offset = read_offset;
+        }
+
+        // move the context window one base forward in the read
+        CUDA_HOST_DEVICE void step(void)
+        {
+            covariate_key bp_code;
 
-            // gather base pairs over the context region, starting from the context base
-            for(int i = start_offset; i != stop_offset; i += direction)
+            offset++;
+
+            if (negative_strand)
             {
-                const uint8 bp = batch.reads[idx.read_start + i];
+                // drop the current base from the top slot, add the next one at the bottom of the window
+                const bool bp_valid = load(offset + max_context_bases - 1, bp_code);
+
+                bases = ((bases << 2) | bp_code) & BITMASK(base_bits_context);
+                valid = ((valid << 1) | uint32(bp_valid)) & BITMASK(max_context_bases);
+            } else {
+                // the new base goes in the top slot, the oldest one falls off the bottom
+                const bool bp_valid = load(offset, bp_code);
 
-                if (is_non_regular_base(bp))
+                bases = (bases >> 2) | (bp_code << (base_bits_context - 2));
+                valid = (valid >> 1) | (uint32(bp_valid) << (max_context_bases - 1));
+            }
+        }
+
+        CUDA_HOST_DEVICE covariate_key_set value(read_coord bp_offset)
+        {
+            if (offset < 0 || bp_offset < offset || bp_offset - offset > max_context_bases)
+            {
+                reset(bp_offset);
+            } else {
+                while(offset < bp_offset)
                 {
-                    break;
+                    step();
                 }
+            }
 
-                context <<= 2;
-                context |= from_nvbio::iupac16_to_dna(bp);
+            covariate_key context_mismatch = base::invalid_key_pattern;
+            covariate_key context_indel = base::invalid_key_pattern;
+
+            // the context extends over all consecutive valid slots starting at the top
+            int num_bases = 0;
+            while(num_bases < max_context_bases && (valid & (1 << (max_context_bases - 1 - num_bases))))
+            {
                 num_bases++;
             }
 
+            covariate_key context = bases >> ((max_context_bases - num_bases) * 2);
+
             if (negative_strand)
             {
                 // we're on the negative strand, complement the context bits
@@ -166,11 +250,19 @@ struct covariate_Context : public covariate<system, PreviousCovariate, 4 + const
                 // add in the size
                 context_indel = (context_indel << length_bits) | num_bases_indel;
             }
-        }
 
-        return base::build_key(input_key, { context_mismatch, context_indel, context_indel },
-                               ctx, batch, read_index, bp_offset, cigar_event_index);
+            return { context_mismatch, context_indel, context_indel };
+        }
+    };
 
+    static CUDA_HOST_DEVICE covariate_key_set encode(firepony_context<system>& ctx,
+                                                     const alignment_batch_device<system>& batch,
+                                                     uint32 read_index, read_coord bp_offset, uint32 cigar_event_index,
+                                                     const covariate_event_values& values,
+                                                     covariate_key_set input_key = {0, 0, 0})
+    {
+        return base::build_key(input_key, values.context,
+                               ctx, batch, read_index, bp_offset, cigar_event_index, values);
     }
 };
 
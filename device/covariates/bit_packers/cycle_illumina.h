@@ -35,9 +35,9 @@
 namespace firepony {
 
 template <target_system system, typename PreviousCovariate = covariate_null<system> >
-struct covariate_Cycle_Illumina : public covariate<system, PreviousCovariate, 10, true>
+struct covariate_Cycle_Illumina : public covariate<system, PreviousCovariate, CYCLE_COVARIATE_BITS, true>
 {
-    typedef covariate<system, PreviousCovariate, 10, true> base;
+    typedef covariate<system, PreviousCovariate, CYCLE_COVARIATE_BITS, true> base;
 
     enum {
         CUSHION_FOR_INDELS = 4
@@ -57,41 +57,85 @@ struct covariate_Cycle_Illumina : public covariate<system, PreviousCovariate, 10
         return result;
     }
 
-    static CUDA_HOST_DEVICE covariate_key_set encode(firepony_context<system>& ctx,
-                                                     const alignment_batch_device<system>& batch,
-                                                     uint32 read_index, uint16 bp_offset, uint32 cigar_event_index,
-                                                     covariate_key_set input_key = {0, 0, 0})
+    // returns true if a cycle can be encoded in a key
+    static CUDA_HOST_DEVICE bool cycle_fits(const int cycle)
     {
-        const bool paired = batch.flags[read_index] & AlignmentFlags::PAIRED;
-        const bool second_of_pair = batch.flags[read_index] & AlignmentFlags::READ2;
-        const bool negative_strand = batch.flags[read_index] & AlignmentFlags::REVERSE;
-
-        const auto& window = ctx.cigar.read_window_clipped[read_index];
-        const int readLength = window.y - window.x + 1;
-        const int readOrderFactor = (paired && second_of_pair) ? -1 : 1;
-        const int i = bp_offset - window.x;
+        return cycle <= CYCLE_COVARIATE_MAX && cycle > -CYCLE_COVARIATE_MAX;
+    }
 
-        int cycle;
+    // per-read state for sequential cycle key generation
+    // the strand and read order logic only depends on the read, so it is computed once per read
+    struct read_state
+    {
+        int window_start;
+        int max_cycle_for_indels;
+        int cycle_start;
         int increment;
 
-        if (negative_strand)
+        CUDA_HOST_DEVICE read_state(firepony_context<system>& ctx,
+                                    const alignment_batch_device<system>& batch,
+                                    uint32 read_index)
+            : read_state(batch, read_index, ctx.cigar.read_window_clipped[read_index])
+        { }
+
+        // cycles are counted over the given read window, which stands in for the whole read
+        CUDA_HOST_DEVICE read_state(const alignment_batch_device<system>& batch,
+                                    uint32 read_index,
+                                    const read_coord2 window)
+        {
+            const bool paired = batch.flags[read_index] & AlignmentFlags::PAIRED;
+            const bool second_of_pair = batch.flags[read_index] & AlignmentFlags::READ2;
+            const bool negative_strand = batch.flags[read_index] & AlignmentFlags::REVERSE;
+
+            const int readLength = window.y - window.x + 1;
+            const int readOrderFactor = (paired && second_of_pair) ? -1 : 1;
+
+            if (negative_strand)
+            {
+                cycle_start = readLength * readOrderFactor;
+                increment = -1 * readOrderFactor;
+            } else {
+                cycle_start = readOrderFactor;
+                increment = readOrderFactor;
+            }
+
+            window_start = window.x;
+            max_cycle_for_indels = readLength - CUSHION_FOR_INDELS - 1;
+        }
+
+        // returns true if every cycle in the read can be encoded in a key
+        CUDA_HOST_DEVICE bool read_fits(void) const
         {
-            cycle = readLength * readOrderFactor;
-            increment = -1 * readOrderFactor;
-        } else {
-            cycle = readOrderFactor;
-            increment = readOrderFactor;
+            const int last_cycle = cycle_start + (max_cycle_for_indels + CUSHION_FOR_INDELS) * increment;
+            return cycle_fits(cycle_start) && cycle_fits(last_cycle);
         }
 
-        cycle += i * increment;
+        CUDA_HOST_DEVICE covariate_key_set value(read_coord bp_offset) const
+        {
+            const int i = bp_offset - window_start;
+            const int cycle = cycle_start + i * increment;
+
+            if (!cycle_fits(cycle))
+            {
+                // cycles too large for the key would wrap into other cycles' keys, so they are not recorded
+                return { covariate_key(base::invalid_key_pattern), covariate_key(base::invalid_key_pattern), covariate_key(base::invalid_key_pattern) };
+            }
 
-        const int MAX_CYCLE_FOR_INDELS = readLength - CUSHION_FOR_INDELS - 1;
+            const covariate_key substitutionKey = keyFromCycle(cycle);
+            const covariate_key indelKey = (i < CUSHION_FOR_INDELS || i > max_cycle_for_indels) ? base::invalid_key_pattern : substitutionKey;
 
-        const covariate_key substitutionKey = keyFromCycle(cycle);
-        const covariate_key indelKey = (i < CUSHION_FOR_INDELS || i > MAX_CYCLE_FOR_INDELS) ? base::invalid_key_pattern : substitutionKey;
+            return { substitutionKey, indelKey, indelKey };
+        }
+    };
 
-        return base::build_key(input_key, { substitutionKey, indelKey, indelKey },
-                               ctx, batch, read_index, bp_offset, cigar_event_index);
+    static CUDA_HOST_DEVICE covariate_key_set encode(firepony_context<system>& ctx,
+                                                     const alignment_batch_device<system>& batch,
+                                                     uint32 read_index, read_coord bp_offset, uint32 cigar_event_index,
+                                                     const covariate_event_values& values,
+                                                     covariate_key_set input_key = {0, 0, 0})
+    {
+        return base::build_key(input_key, values.cycle,
+                               ctx, batch, read_index, bp_offset, cigar_event_index, values);
     }
 };
 
@@ -40,12 +40,13 @@ struct covariate_EventTracker : public covariate<system, PreviousCovariate, 2>
 {
     static CUDA_HOST_DEVICE covariate_key_set encode(firepony_context<system>& ctx,
                                                      const alignment_batch_device<system>& batch,
-                                                     uint32 read_index, uint16 bp_offset, uint32 cigar_event_index,
+                                                     uint32 read_index, read_coord bp_offset, uint32 cigar_event_index,
+                                                     const covariate_event_values& values,
                                                      covariate_key_set input_key = {0, 0, 0})
     {
         return covariate<system, PreviousCovariate, 2>::build_key(input_key,
                                                                   { cigar_event::M, cigar_event::I, cigar_event::D },
-                                                                  ctx, batch, read_index, bp_offset, cigar_event_index);
+                                                                  ctx, batch, read_index, bp_offset, cigar_event_index, values);
     }
 };
 
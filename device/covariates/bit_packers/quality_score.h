@@ -37,20 +37,25 @@ namespace firepony {
 template <target_system system, typename PreviousCovariate = covariate_null<system> >
 struct covariate_QualityScore : public covariate<system, PreviousCovariate, 8>
 {
-    static CUDA_HOST_DEVICE covariate_key_set encode(firepony_context<system>& ctx,
-                                                     const alignment_batch_device<system>& batch,
-                                                     uint32 read_index, uint16 bp_offset, uint32 cigar_event_index,
-                                                     covariate_key_set input_key = {0, 0, 0})
+    // computes the shared quality score values for a given read bp
+    static CUDA_HOST_DEVICE covariate_key_set value(const alignment_batch_device<system>& batch, uint32 read_index, read_coord bp_offset)
     {
         const CRQ_index idx = batch.crq_index(read_index);
         // xxxnsubtil: 45 is the "default" base quality for when insertion/deletion qualities are not available in the read
         // we should eventually grab these from the alignment data itself if they're present
-        covariate_key_set key = { batch.qualities[idx.qual_start + bp_offset],
-                                  45,
-                                  45 };
+        return covariate_key_set { batch.qualities[idx.qual_start + bp_offset],
+                                   45,
+                                   45 };
+    }
 
-        return covariate<system, PreviousCovariate, 8>::build_key(input_key, key,
-                                                                  ctx, batch, read_index, bp_offset, cigar_event_index);
+    static CUDA_HOST_DEVICE covariate_key_set encode(firepony_context<system>& ctx,
+                                                     const alignment_batch_device<system>& batch,
+                                                     uint32 read_index, read_coord bp_offset, uint32 cigar_event_index,
+                                                     const covariate_event_values& values,
+                                                     covariate_key_set input_key = {0, 0, 0})
+    {
+        return covariate<system, PreviousCovariate, 8>::build_key(input_key, values.quality,
+                                                                  ctx, batch, read_index, bp_offset, cigar_event_index, values);
     }
 };
 
@@ -37,15 +37,22 @@ namespace firepony {
 template<target_system system, typename PreviousCovariate = covariate_null<system> >
 struct covariate_ReadGroup : public covariate<system, PreviousCovariate, 8>
 {
+    // computes the shared read group value for a read
+    static CUDA_HOST_DEVICE uint32 value(const alignment_batch_device<system>& batch, uint32 read_index)
+    {
+        return batch.read_group[read_index];
+    }
+
     static CUDA_HOST_DEVICE covariate_key_set encode(firepony_context<system>& ctx,
                                                      const alignment_batch_device<system>& batch,
-                                                     uint32 read_index, uint16 bp_offset, uint32 cigar_event_index,
+                                                     uint32 read_index, read_coord bp_offset, uint32 cigar_event_index,
+                                                     const covariate_event_values& values,
                                                      covariate_key_set input_key = {0, 0, 0})
     {
-        uint32 read_group = batch.read_group[read_index];
+        const uint32 read_group = values.read_group;
         return covariate<system, PreviousCovariate, 8>::build_key(input_key,
                                                                   { read_group, read_group, read_group },
-                                                                  ctx, batch, read_index, bp_offset, cigar_event_index);
+                                                                  ctx, batch, read_index, bp_offset, cigar_event_index, values);
     }
 };
 
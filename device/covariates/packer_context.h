@@ -27,6 +27,7 @@
 
 #pragma once
 
+#include "../../string_database.h"
 #include "../../table_formatter.h"
 #include "bit_packers/read_group.h"
 #include "bit_packers/quality_score.h"
@@ -79,13 +80,10 @@ struct covariate_packer_context
         return chain::decode(key, id);
     }
 
-    static void dump_table(firepony_context<system>& context,
-                           covariate_empirical_table<system>& d_table,
+    static void dump_table(const string_database& read_groups,
+                           covariate_empirical_table<host>& table,
                            table_formatter& fmt)
     {
-        covariate_empirical_table<host> table;
-        table.copyfrom(d_table);
-
         for(uint32 i = 0; i < table.size(); i++)
         {
             // skip null entries in the table
@@ -93,7 +91,7 @@ struct covariate_packer_context
                 continue;
 
             uint32 rg_id = decode(table.keys[i], ReadGroup);
-            const std::string& rg_name = context.bam_header.host.read_groups_db.lookup(rg_id);
+            const std::string& rg_name = read_groups.lookup(rg_id);
 
             const char ev = cigar_event::ascii(decode(table.keys[i], EventTracker));
             const covariate_empirical_value& val = table.values[i];
@@ -118,8 +116,8 @@ struct covariate_packer_context
 
             fmt.data(rg_name);
             fmt.data_int_as_string(qual);
-            fmt.data(std::string(sequence));
-            fmt.data(std::string("Context"));
+            fmt.data(sequence);
+            fmt.data("Context");
             fmt.data(ev);
             fmt.data(val.empirical_quality);
             fmt.data(val.observations);
@@ -31,6 +31,7 @@
 #include "bit_packers/quality_score.h"
 #include "bit_packers/event_tracker.h"
 
+#include "../../string_database.h"
 #include "../../table_formatter.h"
 
 namespace firepony {
@@ -62,7 +63,7 @@ struct covariate_packer_quality_score
         return chain::decode(key, id);
     }
 
-    static void dump_table_loop(firepony_context<system>& context, covariate_empirical_table<host>& table, table_formatter& fmt)
+    static void dump_table_loop(const string_database& read_groups, covariate_empirical_table<host>& table, table_formatter& fmt)
     {
         for(uint32 i = 0; i < table.size(); i++)
         {
@@ -71,19 +72,17 @@ struct covariate_packer_quality_score
                 continue;
 
             uint32 rg_id = decode(table.keys[i], ReadGroup);
-            const std::string& rg_name = context.bam_header.host.read_groups_db.lookup(rg_id);
+            const std::string& rg_name = read_groups.lookup(rg_id);
 
             const char ev = cigar_event::ascii(decode(table.keys[i], EventTracker));
             const covariate_empirical_value& val = table.values[i];
 
             const uint8 qual = decode(table.keys[i], QualityScore);
-            char qual_str[256];
-            snprintf(qual_str, sizeof(qual_str), "%d", qual);
 
             fmt.start_row();
 
             fmt.data(rg_name);
-            fmt.data(std::string(qual_str));
+            fmt.data_int_as_string(qual);
             fmt.data(ev);
             fmt.data(val.empirical_quality);
             fmt.data(val.observations);
@@ -93,11 +92,8 @@ struct covariate_packer_quality_score
         }
     }
 
-    static void dump_table(firepony_context<system>& context, covariate_empirical_table<system>& d_table)
+    static void dump_table(const string_database& read_groups, covariate_empirical_table<host>& table)
     {
-        covariate_empirical_table<host> table;
-        table.copyfrom(d_table);
-
         table_formatter fmt("RecalTable1");
         fmt.add_column("ReadGroup", table_formatter::FMT_STRING);
         // for some very odd reason, GATK outputs this as a string
@@ -107,12 +103,7 @@ struct covariate_packer_quality_score
         fmt.add_column("Observations", table_formatter::FMT_UINT64);
         fmt.add_column("Errors", table_formatter::FMT_FLOAT_2, table_formatter::ALIGNMENT_RIGHT, table_formatter::ALIGNMENT_LEFT);
 
-        // preprocess table data to compute column widths
-        dump_table_loop(context, table, fmt);
-        fmt.end_table();
-
-        // output table
-        dump_table_loop(context, table, fmt);
+        dump_table_loop(read_groups, table, fmt);
         fmt.end_table();
     }
 };
@@ -52,18 +52,6 @@ static CUDA_HOST_DEVICE double gaussian(double value)
     return GF_a + GF_b * pow(double(M_E), -(pow(value - GF_c, 2.0) / (2 * GF_d * GF_d)));
 }
 
-static CUDA_HOST_DEVICE double log10QempPrior(const double Qempirical, const double Qreported, bool need_rounding)
-{
-    double delta = Qempirical - Qreported;
-    if (need_rounding)
-    {
-        delta = round(delta);
-    }
-
-    int difference = min(abs(int(delta)), MAX_GATK_USABLE_Q_SCORE);
-    return log10(gaussian(double(difference)));
-}
-
 static CUDA_HOST_DEVICE double lnToLog10(const double ln)
 {
     return ln * log10(M_E);
@@ -79,93 +67,168 @@ static CUDA_HOST_DEVICE double log10Factorial(const uint64 x)
     return log10Gamma(x + 1);
 }
 
-static CUDA_HOST_DEVICE double log10BinomialCoefficient(const uint64 n, const uint64 k)
-{
-    return log10Factorial(n) - log10Factorial(k) - log10Factorial(n - k);
-}
-
-static CUDA_HOST_DEVICE double log10BinomialProbability(const uint64 n, const uint64 k, const double log10p)
-{
-    double log10OneMinusP = log10(1 - pow(10.0, log10p));
-    return log10BinomialCoefficient(n, k) + log10p * k + log10OneMinusP * (n - k);
-}
-
 static CUDA_HOST_DEVICE double qualToErrorProbLog10(double qual)
 {
     return qual / -10.0;
 }
 
-static CUDA_HOST_DEVICE double log10QempLikelihood(const double Qempirical, uint64 nObservations, uint64 nErrors)
-{
-    if (nObservations == 0)
-        return 0.0;
+static constexpr int NUM_QEMP_BINS = (MAX_REASONABLE_Q_SCORE + 1) * int(RESOLUTION_BINS_PER_QUAL);
+// number of entries in the log10 factorial cache; larger arguments fall back to lgammaf
+static constexpr uint32 LOG10_FACTORIAL_CACHE_SIZE = 1 << 16;
 
-    // mimic GATK's strange behavior
-    if (nObservations > MAX_NUMBER_OF_OBSERVATIONS)
+// precomputed terms for the Bayesian empirical quality estimate
+// the prior only depends on the (clamped) integer difference between empirical and reported quality,
+// and the per-bin error probabilities are the same for every row, so all of these are computed once per table
+// each entry is computed with the same expressions as the direct evaluation, so results are bit-identical
+template <target_system system>
+struct empirical_quality_tables
+{
+    // log10 prior, indexed by |Qempirical - Qreported|
+    persistent_allocation<system, double> log10_prior;
+    // log10(p) and log10(1 - p) for the error probability of each bin
+    persistent_allocation<system, double> log10_error_prob;
+    persistent_allocation<system, double> log10_one_minus_error_prob;
+    // log10(x!) for x < LOG10_FACTORIAL_CACHE_SIZE
+    persistent_allocation<system, double> log10_factorial;
+
+    struct view
     {
-        double fraction = double(MAX_NUMBER_OF_OBSERVATIONS) / double(nObservations);
-        nErrors = round(double(nErrors) * fraction);
-        nObservations = MAX_NUMBER_OF_OBSERVATIONS;
-    }
+        pointer<system, double> log10_prior;
+        pointer<system, double> log10_error_prob;
+        pointer<system, double> log10_one_minus_error_prob;
+        pointer<system, double> log10_factorial;
 
-    return log10BinomialProbability(nObservations, nErrors, qualToErrorProbLog10(Qempirical));
-}
+        CUDA_HOST_DEVICE double log10Factorial(const uint64 x) const
+        {
+            if (x < LOG10_FACTORIAL_CACHE_SIZE)
+                return log10_factorial[x];
 
-static CUDA_HOST_DEVICE void normalizeFromLog10(double *normalized, const double *array, int array_len)
-{
-    double maxValue = array[0];
-    for(int i = 1; i < array_len; i++)
+            return firepony::log10Factorial(x);
+        }
+    };
+
+    operator view()
     {
-        if (array[i] > maxValue)
-            maxValue = array[i];
+        struct view v = {
+            log10_prior,
+            log10_error_prob,
+            log10_one_minus_error_prob,
+            log10_factorial,
+        };
+        return v;
     }
+};
 
-    double sum = 0.0;
-    for(int i = 0; i < array_len; i++)
+template <target_system system>
+struct build_empirical_quality_tables
+{
+    typename empirical_quality_tables<system>::view tables;
+
+    build_empirical_quality_tables(typename empirical_quality_tables<system>::view tables)
+        : tables(tables)
+    { }
+
+    CUDA_HOST_DEVICE void operator() (const uint32 index)
     {
-        normalized[i] = pow(10.0, array[i] - maxValue);
-        sum += normalized[i];
+        if (index <= uint32(MAX_GATK_USABLE_Q_SCORE))
+        {
+            tables.log10_prior[index] = log10(gaussian(double(index)));
+        }
+
+        if (index < uint32(NUM_QEMP_BINS))
+        {
+            const double log10p = qualToErrorProbLog10(index / RESOLUTION_BINS_PER_QUAL);
+            tables.log10_error_prob[index] = log10p;
+            tables.log10_one_minus_error_prob[index] = log10(1 - pow(10.0, log10p));
+        }
+
+        tables.log10_factorial[index] = log10Factorial(uint64(index));
     }
+};
+
+template <target_system system>
+static void build_tables(empirical_quality_tables<system>& tables)
+{
+    tables.log10_prior.resize(MAX_GATK_USABLE_Q_SCORE + 1);
+    tables.log10_error_prob.resize(NUM_QEMP_BINS);
+    tables.log10_one_minus_error_prob.resize(NUM_QEMP_BINS);
+    tables.log10_factorial.resize(LOG10_FACTORIAL_CACHE_SIZE);
+
+    parallel<system>::for_each(thrust::make_counting_iterator(0u),
+                               thrust::make_counting_iterator(0u) + LOG10_FACTORIAL_CACHE_SIZE,
+                               build_empirical_quality_tables<system>(tables));
+}
 
-    for(int i = 0; i < array_len; i++)
+template <target_system system>
+static CUDA_HOST_DEVICE double log10QempPrior(const typename empirical_quality_tables<system>::view& tables,
+                                              const double Qempirical, const double Qreported, bool need_rounding)
+{
+    double delta = Qempirical - Qreported;
+    if (need_rounding)
     {
-        double x = normalized[i] / sum;
-        normalized[i] = x;
+        delta = round(delta);
     }
+
+    // clamp before converting to int, which is undefined for non-finite or out of range values
+    int difference = fabs(delta) < double(MAX_GATK_USABLE_Q_SCORE) ? abs(int(delta)) : MAX_GATK_USABLE_Q_SCORE;
+    return tables.log10_prior[difference];
 }
 
-static CUDA_HOST_DEVICE double bayesianEstimateOfEmpiricalQuality(const uint64 nObservations, const uint64 nErrors, const double QReported, bool need_rounding)
+template <target_system system>
+static CUDA_HOST_DEVICE double bayesianEstimateOfEmpiricalQuality(const typename empirical_quality_tables<system>::view& tables,
+                                                                  uint64 nObservations, uint64 nErrors, const double QReported, bool need_rounding)
 {
-    constexpr int numBins = (MAX_REASONABLE_Q_SCORE + 1) * int(RESOLUTION_BINS_PER_QUAL);
-    double log10Posteriors[numBins];
-
-    for(int bin = 0; bin < numBins; bin++)
+    // mimic GATK's strange behavior
+    if (nObservations > MAX_NUMBER_OF_OBSERVATIONS)
     {
-        const double QEmpOfBin = bin / RESOLUTION_BINS_PER_QUAL;
-        log10Posteriors[bin] = log10QempPrior(QEmpOfBin, QReported, need_rounding) + log10QempLikelihood(QEmpOfBin, nObservations, nErrors);
+        double fraction = double(MAX_NUMBER_OF_OBSERVATIONS) / double(nObservations);
+        nErrors = round(double(nErrors) * fraction);
+        nObservations = MAX_NUMBER_OF_OBSERVATIONS;
     }
 
-    double normalizedPosteriors[numBins];
-    normalizeFromLog10(normalizedPosteriors, log10Posteriors, numBins);
+    // the binomial coefficient does not depend on the bin
+    const double log10BinomialCoefficient = tables.log10Factorial(nObservations) -
+                                            tables.log10Factorial(nErrors) -
+                                            tables.log10Factorial(nObservations - nErrors);
 
+    // note: GATK normalizes the posteriors before picking the most likely bin, which doesn't change the result
     int MLEbin = 0;
-    for(int i = 1; i < numBins; i++)
+    double MLEposterior = 0.0;
+
+    for(int bin = 0; bin < NUM_QEMP_BINS; bin++)
     {
-        if (log10Posteriors[i] > log10Posteriors[MLEbin])
-            MLEbin = i;
+        const double QEmpOfBin = bin / RESOLUTION_BINS_PER_QUAL;
+
+        double log10Likelihood = 0.0;
+        if (nObservations != 0)
+        {
+            log10Likelihood = log10BinomialCoefficient +
+                              tables.log10_error_prob[bin] * nErrors +
+                              tables.log10_one_minus_error_prob[bin] * (nObservations - nErrors);
+        }
+
+        const double log10Posterior = log10QempPrior<system>(tables, QEmpOfBin, QReported, need_rounding) + log10Likelihood;
+        if (bin == 0 || log10Posterior > MLEposterior)
+        {
+            MLEbin = bin;
+            MLEposterior = log10Posterior;
+        }
     }
 
     double Qemp = MLEbin / RESOLUTION_BINS_PER_QUAL;
     return Qemp;
 }
 
-static CUDA_HOST_DEVICE double calcEmpiricalQuality(const covariate_empirical_value& val, bool need_rounding)
+// QReported is the prior the estimate is conditioned on
+template <target_system system>
+static CUDA_HOST_DEVICE double calcEmpiricalQuality(const typename empirical_quality_tables<system>::view& tables,
+                                                    const covariate_empirical_value& val, const double QReported, bool need_rounding)
 {
     // smoothing is one error and one non-error observation
     const uint64 mismatches = uint64(val.mismatches + 0.5) + SMOOTHING_CONSTANT;
     const uint64 observations = val.observations + SMOOTHING_CONSTANT + SMOOTHING_CONSTANT;
 
-    double empiricalQual = bayesianEstimateOfEmpiricalQuality(observations, mismatches, val.estimated_quality, need_rounding);
+    double empiricalQual = bayesianEstimateOfEmpiricalQuality<system>(tables, observations, mismatches, QReported, need_rounding);
     return min(empiricalQual, double(MAX_RECALIBRATED_Q_SCORE));
 }
 
@@ -173,10 +236,13 @@ template <target_system system>
 struct calc_empirical_quality
 {
     typename covariate_empirical_table<system>::view table;
+    typename empirical_quality_tables<system>::view tables;
     bool need_rounding;
 
-    calc_empirical_quality(typename covariate_empirical_table<system>::view table, bool need_rounding)
-        : table(table), need_rounding(need_rounding)
+    calc_empirical_quality(typename covariate_empirical_table<system>::view table,
+                           typename empirical_quality_tables<system>::view tables,
+                           bool need_rounding)
+        : table(table), tables(tables), need_rounding(need_rounding)
     { }
 
     CUDA_HOST_DEVICE void operator() (const uint32 index)
@@ -184,17 +250,58 @@ struct calc_empirical_quality
         covariate_empirical_value& val = table.values[index];
 
         val.estimated_quality = double(-10.0 * log10(val.expected_errors / double(val.observations)));
-        val.empirical_quality = calcEmpiricalQuality(val, need_rounding);
+        val.empirical_quality = calcEmpiricalQuality<system>(tables, val, val.estimated_quality, need_rounding);
+    }
+};
+
+template <target_system system>
+struct calc_conditional_empirical_quality
+{
+    typename covariate_empirical_table<system>::view table;
+    typename empirical_quality_tables<system>::view tables;
+    pointer<system, double> prior;
+    pointer<system, double> out;
+
+    calc_conditional_empirical_quality(typename covariate_empirical_table<system>::view table,
+                                       typename empirical_quality_tables<system>::view tables,
+                                       pointer<system, double> prior,
+                                       pointer<system, double> out)
+        : table(table), tables(tables), prior(prior), out(out)
+    { }
+
+    CUDA_HOST_DEVICE void operator() (const uint32 index)
+    {
+        // GATK truncates the quality difference in the prior when applying the tables, so no rounding here
+        out[index] = calcEmpiricalQuality<system>(tables, table.values[index], prior[index], false);
     }
 };
 
 template <target_system system>
 void compute_empirical_quality(firepony_context<system>& context, covariate_empirical_table<system>& table, bool need_rounding)
 {
+    empirical_quality_tables<system> tables;
+    build_tables(tables);
+
     parallel<system>::for_each(thrust::make_counting_iterator(0u),
                                thrust::make_counting_iterator(0u) + table.size(),
-                               calc_empirical_quality<system>(table, need_rounding));
+                               calc_empirical_quality<system>(table, tables, need_rounding));
 }
 INSTANTIATE(compute_empirical_quality)
 
+template <target_system system>
+void compute_conditional_empirical_quality(covariate_empirical_table<system>& table,
+                                           persistent_allocation<system, double>& prior,
+                                           persistent_allocation<system, double>& out)
+{
+    empirical_quality_tables<system> tables;
+    build_tables(tables);
+
+    out.resize(table.size());
+
+    parallel<system>::for_each(thrust::make_counting_iterator(0u),
+                               thrust::make_counting_iterator(0u) + table.size(),
+                               calc_conditional_empirical_quality<system>(table, tables, prior, out));
+}
+INSTANTIATE(compute_conditional_empirical_quality)
+
 } // namespace firepony
@@ -34,4 +34,10 @@ namespace firepony {
 
 template <target_system system> void compute_empirical_quality(firepony_context<system>& context, covariate_empirical_table<system>& table, bool need_rounding);
 
+// computes the empirical quality of each row of a table conditioned on a per-row prior instead of the row's own estimated quality
+// (this is how the tables are evaluated when recalibrating reads)
+template <target_system system> void compute_conditional_empirical_quality(covariate_empirical_table<system>& table,
+                                                                           persistent_allocation<system, double>& prior,
+                                                                           persistent_allocation<system, double>& out);
+
 } // namespace firepony
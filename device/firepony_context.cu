@@ -57,6 +57,8 @@ void firepony_context<system>::start_batch(const alignment_batch<system>& batch)
                  active_location_list.m_storage.begin(),
                  active_location_list.m_storage.end(),
                  0xffffffff);
+
+    batch_memory_peak = 0;
 }
 METHOD_INSTANTIATE(firepony_context, start_batch);
 
@@ -65,8 +67,59 @@ void firepony_context<system>::end_batch(const alignment_batch<system>& batch)
 {
     stats.total_reads += batch.host->num_reads;
     stats.num_batches++;
+
+    update_pool_statistics();
 }
 METHOD_INSTANTIATE(firepony_context, end_batch);
 
+template <target_system system>
+void firepony_context<system>::update_pool_statistics(void)
+{
+    stats.pool_requests = pool.num_requests;
+    stats.pool_allocations = pool.num_allocations;
+    stats.pool_high_water = pool.high_water_mark;
+}
+METHOD_INSTANTIATE(firepony_context, update_pool_statistics);
+
+template <target_system system>
+uint64 firepony_context<system>::update_memory_statistics(void)
+{
+    const uint64 cigar_bytes = cigar.footprint(footprints);
+    const uint64 baq_bytes = baq.footprint(footprints);
+    const uint64 fractional_error_bytes = fractional_error.footprint(footprints);
+    const uint64 covariates_bytes = covariates.footprint(footprints);
+    const uint64 scratch_bytes = footprint(footprints, active_read_list) +
+                                 footprint(footprints, alignment_windows) +
+                                 footprint(footprints, active_location_list) +
+                                 footprint(footprints, read_offset_list) +
+                                 footprint(footprints, temp_storage) +
+                                 footprint(footprints, temp_u32) +
+                                 footprint(footprints, temp_u32_2) +
+                                 footprint(footprints, temp_u32_3) +
+                                 footprint(footprints, temp_u32_4) +
+                                 footprint(footprints, temp_u8) +
+                                 read_filter.footprint(footprints) +
+                                 snp_filter.footprint(footprints) +
+                                 pool.footprint();
+
+    stats.memory_cigar.add(cigar_bytes);
+    stats.memory_baq.add(baq_bytes);
+    stats.memory_fractional_error.add(fractional_error_bytes);
+    stats.memory_covariates.add(covariates_bytes);
+    stats.memory_scratch.add(scratch_bytes);
+
+    const uint64 total = cigar_bytes + baq_bytes + fractional_error_bytes + covariates_bytes + scratch_bytes;
+
+    // the accumulators and the pool grow over the run; only the remainder scales with the batch
+    resident_memory = covariates.accumulator_footprint(footprints) + pool.footprint();
+
+    const uint64 batch_bytes = total - resident_memory;
+    if (batch_bytes > batch_memory_peak)
+        batch_memory_peak = batch_bytes;
+
+    return total;
+}
+METHOD_INSTANTIATE(firepony_context, update_memory_statistics);
+
 } // namespace firepony
 
@@ -36,11 +36,14 @@
 #include "alignment_data_device.h"
 #include "../sequence_database.h"
 #include "../variant_database.h"
+#include "read_filters.h"
 #include "snp_filter.h"
 #include "covariates.h"
 #include "cigar.h"
 #include "baq.h"
 #include "fractional_errors.h"
+#include "recalibrate.h"
+#include "allocation_pool.h"
 #include "util.h"
 
 #include <lift/timer.h>
@@ -50,13 +53,50 @@
 
 namespace firepony {
 
+// tracks the largest memory footprint seen, in bytes
+struct memory_high_water // host-only
+{
+    uint64 peak;
+
+    memory_high_water()
+        : peak(0)
+    { }
+
+    void add(uint64 bytes)
+    {
+        if (bytes > peak)
+            peak = bytes;
+    }
+
+    // each device has its own memory, so high-water marks from different devices add up
+    memory_high_water& operator+=(const memory_high_water& other)
+    {
+        peak += other.peak;
+        return *this;
+    }
+};
+
 struct pipeline_statistics // host-only
 {
     uint64 total_reads;        // total number of reads processed
     uint64 filtered_reads;     // number of reads filtered out in pre-processing
     uint64 baq_reads;          // number of reads for which BAQ was computed
+    uint64 baq_skipped_reads;  // number of reads that skipped BAQ for exceeding the maximum BAQ read length
+    uint64 cycle_limited_reads;  // number of reads with cycles too large for the cycle covariate
     uint64 num_batches;        // number of batches processed
 
+    // number of reads rejected by each read filter, indexed by read_filter_id
+    // (a read is only counted against the first filter that rejects it)
+    uint64 read_filter_rejections[NUM_READ_FILTERS];
+
+    uint64 baq_validated_bases;       // number of bases compared when validating single-precision BAQ
+    uint64 baq_validation_mismatches; // number of compared bases where single-precision BAQ differed
+    uint64 baq_lane_mismatches;       // number of compared bases where the host SIMD lane HMM differed from the per-read HMM
+
+    uint64 pool_requests;      // number of temporary buffers requested from the allocation pool
+    uint64 pool_allocations;   // number of pool requests that had to allocate or grow a buffer
+    uint64 pool_high_water;    // largest number of bytes checked out of the allocation pool at once
+
     time_series io;
     time_series read_filter;
     time_series snp_filter;
@@ -68,35 +108,86 @@ struct pipeline_statistics // host-only
 
     time_series baq_setup;
     time_series baq_hmm;
-#if BAQ_HMM_SPLIT_PHASE
+    // only collected when the HMM runs split-phase
     time_series baq_hmm_forward;
     time_series baq_hmm_backward;
     time_series baq_hmm_map;
-#endif
+    // HMM time of batches that ran all phases in a single pass, which has no per-phase breakdown
+    time_series baq_hmm_fused;
     time_series baq_postprocess;
 
     time_series covariates_gather;
     time_series covariates_filter;
     time_series covariates_sort;
     time_series covariates_pack;
+    time_series covariates_hash;
+    time_series covariates_merge;
 
     time_series postprocessing;
     time_series output;
 
+    // only collected when writing recalibrated alignments
+    time_series recalibration;
+
+    // peak memory footprint of each group of buffers in the context
+    memory_high_water memory_cigar;
+    memory_high_water memory_baq;
+    memory_high_water memory_fractional_error;
+    memory_high_water memory_covariates;
+    memory_high_water memory_scratch;
+
+    // peak total footprint at the end of each pipeline stage
+    memory_high_water memory_read_filter;
+    memory_high_water memory_cigar_expansion;
+    memory_high_water memory_bp_filter;
+    memory_high_water memory_snp_filter;
+    memory_high_water memory_baq_stage;
+    memory_high_water memory_fractional_error_stage;
+    memory_high_water memory_covariates_stage;
+
     pipeline_statistics()
         : total_reads(0),
           filtered_reads(0),
           baq_reads(0),
-          num_batches(0)
-    { }
+          baq_skipped_reads(0),
+          cycle_limited_reads(0),
+          num_batches(0),
+          baq_validated_bases(0),
+          baq_validation_mismatches(0),
+          baq_lane_mismatches(0),
+          pool_requests(0),
+          pool_allocations(0),
+          pool_high_water(0)
+    {
+        for(uint32 i = 0; i < NUM_READ_FILTERS; i++)
+        {
+            read_filter_rejections[i] = 0;
+        }
+    }
 
     pipeline_statistics& operator+=(const pipeline_statistics& other)
     {
         total_reads += other.total_reads;
         filtered_reads += other.filtered_reads;
         baq_reads += other.baq_reads;
+        baq_skipped_reads += other.baq_skipped_reads;
+        cycle_limited_reads += other.cycle_limited_reads;
         num_batches += other.num_batches;
 
+        for(uint32 i = 0; i < NUM_READ_FILTERS; i++)
+        {
+            read_filter_rejections[i] += other.read_filter_rejections[i];
+        }
+
+        baq_validated_bases += other.baq_validated_bases;
+        baq_validation_mismatches += other.baq_validation_mismatches;
+        baq_lane_mismatches += other.baq_lane_mismatches;
+
+        pool_requests += other.pool_requests;
+        pool_allocations += other.pool_allocations;
+        // pools are per-device, so the aggregate high-water mark is the sum across devices
+        pool_high_water += other.pool_high_water;
+
         io += other.io;
         read_filter += other.read_filter;
         snp_filter += other.snp_filter;
@@ -111,16 +202,35 @@ struct pipeline_statistics // host-only
         baq_hmm_forward += other.baq_hmm_forward;
         baq_hmm_backward += other.baq_hmm_backward;
         baq_hmm_map += other.baq_hmm_map;
+        baq_hmm_fused += other.baq_hmm_fused;
         baq_postprocess += other.baq_postprocess;
 
         covariates_gather += other.covariates_gather;
         covariates_filter += other.covariates_filter;
         covariates_sort += other.covariates_sort;
         covariates_pack += other.covariates_pack;
+        covariates_hash += other.covariates_hash;
+        covariates_merge += other.covariates_merge;
 
         postprocessing += other.postprocessing;
         output += other.output;
 
+        recalibration += other.recalibration;
+
+        memory_cigar += other.memory_cigar;
+        memory_baq += other.memory_baq;
+        memory_fractional_error += other.memory_fractional_error;
+        memory_covariates += other.memory_covariates;
+        memory_scratch += other.memory_scratch;
+
+        memory_read_filter += other.memory_read_filter;
+        memory_cigar_expansion += other.memory_cigar_expansion;
+        memory_bp_filter += other.memory_bp_filter;
+        memory_snp_filter += other.memory_snp_filter;
+        memory_baq_stage += other.memory_baq_stage;
+        memory_fractional_error_stage += other.memory_fractional_error_stage;
+        memory_covariates_stage += other.memory_covariates_stage;
+
         return *this;
     }
 };
@@ -148,7 +258,7 @@ struct firepony_context
     // we match the BP representation size to avoid RMW hazards at the edges of reads
     vector_dna16<system> active_location_list;
     // list of read offsets in the reference for each BP (relative to the alignment start position)
-    persistent_allocation<system, uint16> read_offset_list;
+    persistent_allocation<system, read_coord> read_offset_list;
 
     // temporary storage for CUB calls
     persistent_allocation<system, uint8> temp_storage;
@@ -161,23 +271,41 @@ struct firepony_context
     persistent_allocation<system, uint8>  temp_u8;
 
     // various pipeline states go here
+    read_filter_context<system> read_filter;
     snp_filter_context<system> snp_filter;
     cigar_context<system> cigar;
     baq_context<system> baq;
     covariates_context<system> covariates;
     fractional_error_context<system> fractional_error;
+    recalibration_context<system> recalibration;
 
     // --- everything below this line is host-only and not available on the device
     pipeline_statistics stats;
 
+    // pool for per-call temporary buffers
+    allocation_pool<system>& pool;
+    // largest size seen for each buffer in the context, for memory accounting
+    footprint_tracker& footprints;
+
+    // largest memory footprint seen during the current batch, not counting resident_memory
+    uint64 batch_memory_peak;
+    // memory held independently of the batch size (the run-long accumulators and the allocation pool)
+    uint64 resident_memory;
+
     firepony_context(const lift::compute_device& compute_device,
                      const runtime_options& options,
-                     const alignment_header<system> bam_header)
+                     const alignment_header<system> bam_header,
+                     allocation_pool<system>& pool,
+                     footprint_tracker& footprints)
         : compute_device(compute_device),
           options(options),
           bam_header(bam_header),
           reference_db(),
-          variant_db()
+          variant_db(),
+          pool(pool),
+          footprints(footprints),
+          batch_memory_peak(0),
+          resident_memory(0)
     { }
 
     void update_databases(const sequence_database_storage<system>& reference_db,
@@ -185,6 +313,12 @@ struct firepony_context
 
     void start_batch(const alignment_batch<system>& batch);
     void end_batch(const alignment_batch<system>& batch);
+
+    // copies the allocation pool counters into stats
+    void update_pool_statistics(void);
+
+    // records the current footprint of each buffer group in stats and returns the total in bytes
+    uint64 update_memory_statistics(void);
 };
 
 // encapsulates common state for our thrust functors to save a little typing
@@ -43,19 +43,19 @@ struct compute_fractional_errors : public lambda<system>
     LAMBDA_INHERIT_MEMBERS;
 
     const packed_vector<system, 1> error_vector;
-    pointer<system, double> output_vector;
+    pointer<system, base_mismatch> output_vector;
 
     compute_fractional_errors(firepony_context<system> ctx,
                               const alignment_batch_device<system> batch,
                               const packed_vector<system, 1> error_vector,
-                              pointer<system, double> output_vector)
+                              pointer<system, base_mismatch> output_vector)
         : lambda<system>(ctx, batch), error_vector(error_vector), output_vector(output_vector)
     { }
 
     CUDA_HOST_DEVICE void calculateAndStoreErrorsInBlock(const int iii,
                                                          const int blockStartIndex,
                                                          const typename packed_vector<system, 1>::const_stream_type errorArray,
-                                                         double *fractionalErrors)
+                                                         base_mismatch *fractionalErrors)
     {
         int totalErrors = 0;
         for(int jjj = max(0, blockStartIndex - 1); jjj <= iii; jjj++)
@@ -65,14 +65,14 @@ struct compute_fractional_errors : public lambda<system>
 
         for(int jjj = max(0, blockStartIndex - 1); jjj <= iii; jjj++)
         {
-            fractionalErrors[jjj] = ((double) totalErrors) / ((double)(iii - max(0, blockStartIndex - 1) + 1));
+            fractionalErrors[jjj] = base_mismatch(mismatch_from_error(((double) totalErrors) / ((double)(iii - max(0, blockStartIndex - 1) + 1))));
         }
     }
 
     CUDA_HOST_DEVICE void operator() (const uint32 read_index)
     {
         const CRQ_index idx = batch.crq_index(read_index);
-        const ushort2& read_window = ctx.cigar.read_window_clipped[read_index];
+        const read_coord2& read_window = ctx.cigar.read_window_clipped[read_index];
         const uint8 *baqArray = &ctx.baq.qualities[idx.qual_start] + read_window.x;
 
         // offset the error array by read_window.x to simulate hard clipping of soft clipped bases
@@ -81,7 +81,7 @@ struct compute_fractional_errors : public lambda<system>
         constexpr int BLOCK_START_UNSET = -1;
 
         // offset into output_vector to simulate hard clipping of soft clipped bases
-        double *fractionalErrors = &output_vector[idx.qual_start] + read_window.x;
+        base_mismatch *fractionalErrors = &output_vector[idx.qual_start] + read_window.x;
         const int fractionalErrors_length = read_window.y - read_window.x + 1;
 
         bool inBlock = false;
@@ -94,7 +94,7 @@ struct compute_fractional_errors : public lambda<system>
             {
                 if (!inBlock)
                 {
-                    fractionalErrors[iii] = (double) errorArray[iii];
+                    fractionalErrors[iii] = base_mismatch(mismatch_from_error(errorArray[iii]));
                 } else {
                     calculateAndStoreErrorsInBlock(iii, blockStartIndex, errorArray, fractionalErrors);
                     inBlock = false; // reset state variables
@@ -116,28 +116,70 @@ struct compute_fractional_errors : public lambda<system>
     }
 };
 
+// without BAQ every base has no BAQ uncertainty, so the fractional errors are the raw error indicators
+template <target_system system>
+struct copy_error_indicators : public lambda<system>
+{
+    LAMBDA_INHERIT_MEMBERS;
+
+    const packed_vector<system, 1> error_vector;
+    pointer<system, base_mismatch> output_vector;
+
+    copy_error_indicators(firepony_context<system> ctx,
+                          const alignment_batch_device<system> batch,
+                          const packed_vector<system, 1> error_vector,
+                          pointer<system, base_mismatch> output_vector)
+        : lambda<system>(ctx, batch), error_vector(error_vector), output_vector(output_vector)
+    { }
+
+    CUDA_HOST_DEVICE void operator() (const uint32 read_index)
+    {
+        const CRQ_index idx = batch.crq_index(read_index);
+        const read_coord2& read_window = ctx.cigar.read_window_clipped[read_index];
+
+        auto errorArray = error_vector.stream() + (idx.read_start + read_window.x);
+        base_mismatch *fractionalErrors = &output_vector[idx.qual_start] + read_window.x;
+        const int fractionalErrors_length = read_window.y - read_window.x + 1;
+
+        for(int iii = 0; iii < fractionalErrors_length; iii++)
+        {
+            fractionalErrors[iii] = base_mismatch(mismatch_from_error(errorArray[iii]));
+        }
+    }
+};
+
+template <target_system system>
+static void build_fractional_errors(firepony_context<system>& context,
+                                    const alignment_batch<system>& batch,
+                                    const packed_vector<system, 1>& error_vector,
+                                    persistent_allocation<system, base_mismatch>& output_vector)
+{
+    if (context.options.gatk4)
+    {
+        parallel<system>::for_each(context.active_read_list.begin(),
+                                   context.active_read_list.end(),
+                                   copy_error_indicators<system>(context, batch.device, error_vector, output_vector));
+    } else {
+        parallel<system>::for_each(context.active_read_list.begin(),
+                                   context.active_read_list.end(),
+                                   compute_fractional_errors<system>(context, batch.device, error_vector, output_vector));
+    }
+}
+
 template <target_system system>
 void build_fractional_error_arrays(firepony_context<system>& context, const alignment_batch<system>& batch)
 {
     auto& frac = context.fractional_error;
 
-    frac.snp_errors.resize(context.baq.qualities.size());
-    frac.insertion_errors.resize(context.baq.qualities.size());
-    frac.deletion_errors.resize(context.baq.qualities.size());
-
-    thrust::fill(lift::backend_policy<system>::execution_policy(), frac.snp_errors.begin(), frac.snp_errors.end(), 0.0);
-    thrust::fill(lift::backend_policy<system>::execution_policy(), frac.insertion_errors.begin(), frac.insertion_errors.end(), 0.0);
-    thrust::fill(lift::backend_policy<system>::execution_policy(), frac.deletion_errors.begin(), frac.deletion_errors.end(), 0.0);
-
-    parallel<system>::for_each(context.active_read_list.begin(),
-                               context.active_read_list.end(),
-                               compute_fractional_errors<system>(context, batch.device, context.cigar.is_snp, frac.snp_errors));
-    parallel<system>::for_each(context.active_read_list.begin(),
-                               context.active_read_list.end(),
-                               compute_fractional_errors<system>(context, batch.device, context.cigar.is_insertion, frac.insertion_errors));
-    parallel<system>::for_each(context.active_read_list.begin(),
-                               context.active_read_list.end(),
-                               compute_fractional_errors<system>(context, batch.device, context.cigar.is_deletion, frac.deletion_errors));
+    // note: these are not cleared; every base in the clipped read window of each active read is written below,
+    // and the covariate walker never reads errors outside that window
+    frac.snp_errors.resize(batch.device.qualities.size());
+    frac.insertion_errors.resize(batch.device.qualities.size());
+    frac.deletion_errors.resize(batch.device.qualities.size());
+
+    build_fractional_errors(context, batch, context.cigar.is_snp, frac.snp_errors);
+    build_fractional_errors(context, batch, context.cigar.is_insertion, frac.insertion_errors);
+    build_fractional_errors(context, batch, context.cigar.is_deletion, frac.deletion_errors);
 }
 INSTANTIATE(build_fractional_error_arrays);
 
@@ -31,15 +31,29 @@
 #pragma once
 
 #include "../types.h"
+#include "util.h"
+#include "covariate_table.h"
 
 namespace firepony {
 
 template <target_system system>
 struct fractional_error_context
 {
-    persistent_allocation<system, double> snp_errors;
-    persistent_allocation<system, double> insertion_errors;
-    persistent_allocation<system, double> deletion_errors;
+    // fractional errors for each base, indexed like the base qualities
+    // these are stored in the fixed point format of the mismatch counts they feed (see covariate_mismatch),
+    // so each value is computed in double precision and rounded exactly once
+    // only bases inside each active read's clipped read window are written
+    persistent_allocation<system, base_mismatch> snp_errors;
+    persistent_allocation<system, base_mismatch> insertion_errors;
+    persistent_allocation<system, base_mismatch> deletion_errors;
+
+    // number of bytes held by this context
+    size_t footprint(footprint_tracker& tracker) const
+    {
+        return firepony::footprint(tracker, snp_errors) +
+               firepony::footprint(tracker, insertion_errors) +
+               firepony::footprint(tracker, deletion_errors);
+    }
 };
 
 template <target_system system> void build_fractional_error_arrays(firepony_context<system>& context, const alignment_batch<system>& batch);
@@ -44,6 +44,9 @@
 #include "fractional_errors.h"
 #include "read_filters.h"
 #include "read_group_table.h"
+#include "recalibrate.h"
+#include "recalibration_report.h"
+#include "recalibration_table_file.h"
 #include "snp_filter.h"
 #include "util.h"
 #include "version.h"
@@ -82,38 +85,49 @@ void firepony_process_batch(firepony_context<system>& context, const alignment_b
     }
 
     read_filter.stop();
+    context.stats.memory_read_filter.add(context.update_memory_statistics());
 
     if (context.active_read_list.size() > 0)
     {
         // generate cigar events and coordinates
-        // this will generate -1 read indices for events belonging to inactive reads, so it must happen after read filtering
+        // cigar event ranges are only assigned to active reads, so this must happen after read filtering
         cigar_expansion.start();
         expand_cigars(context, batch);
         cigar_expansion.stop();
+        context.stats.memory_cigar_expansion.add(context.update_memory_statistics());
 
         // apply per-BP filters
         bp_filter.start();
         filter_bases(context, batch);
         bp_filter.stop();
+        context.stats.memory_bp_filter.add(context.update_memory_statistics());
 
         // filter known SNPs from active_loc_list
         snp_filter.start();
         filter_known_snps(context, batch);
         snp_filter.stop();
+        context.stats.memory_snp_filter.add(context.update_memory_statistics());
 
         // compute the base alignment quality for each read
-        baq.start();
-        baq_reads(context, batch);
-        baq.stop();
+        // (GATK4 doesn't apply BAQ by default, so we skip it entirely in GATK4 mode)
+        if (!context.options.gatk4)
+        {
+            baq.start();
+            baq_reads(context, batch);
+            baq.stop();
+            context.stats.memory_baq_stage.add(context.update_memory_statistics());
+        }
 
         fractional_error.start();
         build_fractional_error_arrays(context, batch);
         fractional_error.stop();
+        context.stats.memory_fractional_error_stage.add(context.update_memory_statistics());
 
         // build covariate tables
         covariates.start();
         gather_covariates(context, batch);
         covariates.stop();
+        context.stats.memory_covariates_stage.add(context.update_memory_statistics());
     }
 
     if (context.options.debug)
@@ -140,18 +154,39 @@ void firepony_process_batch(firepony_context<system>& context, const alignment_b
         context.stats.cigar_expansion.add(cigar_expansion);
         context.stats.bp_filter.add(bp_filter);
         context.stats.snp_filter.add(snp_filter);
-        context.stats.baq.add(baq);
+        if (!context.options.gatk4)
+        {
+            context.stats.baq.add(baq);
+        }
+
         context.stats.fractional_error.add(fractional_error);
         context.stats.covariates.add(covariates);
     }
 }
 INSTANTIATE(firepony_process_batch);
 
+// finalizes any per-device intermediate state once all batches have been processed
 template <target_system system>
-static void output_header(firepony_context<system>& context)
+void firepony_flush_intermediates(firepony_context<system>& context)
+{
+    timer<system> covariates;
+
+    covariates.start();
+    flush_covariates(context);
+    covariates.stop();
+
+    parallel<system>::synchronize();
+
+    context.stats.covariates.add(covariates);
+}
+INSTANTIATE(firepony_flush_intermediates);
+
+static void output_header(bool gatk4)
 {
     output_printf("%s", "#:GATKReport.v1.1:5\n");
     output_printf("%s", "#:GATKTable:2:18:%s:%s:;\n");
+    // note: this table always lists the GATK3 recalibration arguments, even in GATK4 mode
+    // only the recalibration tables follow GATK4; GATK4 runs are identified by the software field below
     output_printf("%s", "#:GATKTable:Arguments:Recalibration argument collection values used in this run\n");
     output_printf("%s", "Argument                    Value                                                                   \n");
     output_printf("%s", "binary_tag_name             null                                                                    \n");
@@ -172,8 +207,14 @@ static void output_header(firepony_context<system>& context)
     output_printf("%s", "solid_nocall_strategy       THROW_EXCEPTION                                                         \n");
     output_printf("%s", "solid_recal_mode            SET_Q_ZERO                                                              \n");
     // this field is a Firepony extension, tracks the software and version number that produced this file
-    output_printf(      "software                    Firepony_%d.%d.%d                                                       \n",
-                  FIREPONY_VERSION_MAJOR, FIREPONY_VERSION_MINOR, FIREPONY_VERSION_REV);
+    if (gatk4)
+    {
+        output_printf(  "software                    Firepony_%d.%d.%d_GATK4                                                 \n",
+                      FIREPONY_VERSION_MAJOR, FIREPONY_VERSION_MINOR, FIREPONY_VERSION_REV);
+    } else {
+        output_printf(  "software                    Firepony_%d.%d.%d                                                       \n",
+                      FIREPONY_VERSION_MAJOR, FIREPONY_VERSION_MINOR, FIREPONY_VERSION_REV);
+    }
     output_printf("\n");
 
     // output a dummy quantization table, as GATK checks whether it's present
@@ -182,29 +223,44 @@ static void output_header(firepony_context<system>& context)
     fmt.add_column("Count", table_formatter::FMT_STRING, table_formatter::ALIGNMENT_RIGHT);
     fmt.add_column("QuantizedScore", table_formatter::FMT_STRING, table_formatter::ALIGNMENT_RIGHT);
 
-    for(uint32 pass = 0; pass < 2; pass++)
+    for(uint32 i = 0; i < 94; i++)
     {
-        for(uint32 i = 0; i < 94; i++)
-        {
-            char buf[256];
+        fmt.start_row();
 
-            fmt.start_row();
+        fmt.data_int_as_string(i);
+        fmt.data("0");
+        fmt.data_int_as_string(i);
 
-            snprintf(buf, sizeof(buf), "%d", i);
+        fmt.end_row();
+    }
 
-            fmt.data(std::string(buf));
-            fmt.data(std::string("0"));
-            fmt.data(std::string(buf));
+    fmt.end_table();
+}
 
-            fmt.end_row();
-        }
+template <target_system system>
+void build_recalibration_report(firepony_context<system>& context, recalibration_report& report)
+{
+    auto& cv = context.covariates;
 
-        fmt.end_table();
-    }
+    report.gatk4 = context.options.gatk4;
+    report.read_groups = context.bam_header.host.read_groups_db;
+
+    report.read_group.copyfrom(cv.read_group);
+    report.quality.copyfrom(cv.empirical_quality);
+    report.context.copyfrom(cv.empirical_context);
+    report.cycle.copyfrom(cv.empirical_cycle);
+}
+INSTANTIATE(build_recalibration_report);
+
+void output_recalibration_report(recalibration_report& report)
+{
+    output_header(report.gatk4);
+    output_read_group_table(report);
+    output_covariates(report);
 }
 
 template <target_system system>
-void firepony_postprocess(firepony_context<system>& context)
+void firepony_postprocess(firepony_context<system>& context, recalibration_report& report)
 {
     timer<system> postprocessing;
     timer<host> output;
@@ -216,18 +272,45 @@ void firepony_postprocess(firepony_context<system>& context)
     postprocessing.stop();
 
     output.start();
-    output_header(context);
-    output_read_group_table(context);
-    output_covariates(context);
+    build_recalibration_report(context, report);
+    output_recalibration_report(report);
+
+    if (context.options.binary_output)
+    {
+        if (!write_recalibration_table_file(context.options.binary_output, report))
+        {
+            fprintf(stderr, "error writing binary recalibration tables to %s\n", context.options.binary_output);
+        }
+    }
     output.stop();
 
     parallel<system>::synchronize();
 
     context.stats.postprocessing.add(postprocessing);
     context.stats.output.add(output);
+    context.update_pool_statistics();
 }
 INSTANTIATE(firepony_postprocess);
 
+// rewrites the base qualities for a batch using the recalibration tables in the context
+template <target_system system>
+void firepony_recalibrate_batch(firepony_context<system>& context, const alignment_batch<system>& batch)
+{
+    timer<system> recalibration;
+
+    recalibration.start();
+    recalibrate_batch(context, batch);
+    recalibration.stop();
+
+    parallel<system>::synchronize();
+    parallel<system>::check_errors();
+
+    context.stats.total_reads += batch.host->num_reads;
+    context.stats.num_batches++;
+    context.stats.recalibration.add(recalibration);
+}
+INSTANTIATE(firepony_recalibrate_batch);
+
 template <target_system system>
 void debug_read(firepony_context<system>& context, const alignment_batch<system>& batch, uint32 read_id)
 {
@@ -244,8 +327,8 @@ void debug_read(firepony_context<system>& context, const alignment_batch<system>
     fprintf(stderr, "  offset list = [ ");
     for(uint32 i = idx.read_start; i < idx.read_start + idx.read_len; i++)
     {
-        uint16 off = context.read_offset_list[i];
-        if (off == uint16(-1))
+        read_coord off = context.read_offset_list[i];
+        if (off == read_coord(-1))
         {
             fprintf(stderr, "  - ");
         } else {
@@ -255,7 +338,11 @@ void debug_read(firepony_context<system>& context, const alignment_batch<system>
     fprintf(stderr, "]\n");
 
     debug_cigar(context, batch, read_index);
-    debug_baq(context, batch, read_index);
+
+    if (!context.options.gatk4)
+    {
+        debug_baq(context, batch, read_index);
+    }
 
 // xxxnsubtil: this needs the sequence name database which isn't available right now!
 //    const uint2 alignment_window = context.alignment_windows[read_index];
@@ -35,6 +35,7 @@
 #include "../sequence_database.h"
 #include "../variant_database.h"
 #include "../io_thread.h"
+#include "../alignment_writer.h"
 
 #include "firepony_context.h"
 
@@ -59,7 +60,14 @@ struct firepony_pipeline
     virtual void join(void) = 0;
 
     virtual void gather_intermediates(firepony_pipeline *other) = 0;
-    virtual void postprocess(void) = 0;
+    // computes the final tables and writes them out; a host copy is left in report
+    virtual void postprocess(recalibration_report& report) = 0;
+
+    // switches the pipeline to recalibrating the batches from reader with the given tables and handing them to writer
+    // must be called after setup(); start() and join() then run the recalibration pass
+    virtual void setup_recalibration(io_thread *reader,
+                                     alignment_writer *writer,
+                                     recalibration_tables<host> *tables) = 0;
 
     // create a firepony pipeline object on the given compute device
     static firepony_pipeline *create(lift::compute_device *device);
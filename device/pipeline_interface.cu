@@ -47,14 +47,23 @@
 namespace firepony {
 
 template <target_system system> void firepony_process_batch(firepony_context<system>& context, const alignment_batch<system>& batch);
-template <target_system system> void firepony_postprocess(firepony_context<system>& context);
+template <target_system system> void firepony_flush_intermediates(firepony_context<system>& context);
+template <target_system system> void firepony_postprocess(firepony_context<system>& context, recalibration_report& report);
+template <target_system system> void firepony_recalibrate_batch(firepony_context<system>& context, const alignment_batch<system>& batch);
 
 template <target_system system_dst, target_system system_src>
 void firepony_gather_intermediates(firepony_context<system_dst>& context, firepony_context<system_src>& other)
 {
-    context.covariates.quality.concat(context.compute_device, other.compute_device, other.covariates.quality);
-    context.covariates.cycle.concat(context.compute_device, other.compute_device, other.covariates.cycle);
-    context.covariates.context.concat(context.compute_device, other.compute_device, other.covariates.context);
+    pooled_allocation<system_dst, covariate_observation_value> temp_values(context.pool);
+    pooled_allocation<system_dst, covariate_key> temp_keys(context.pool);
+
+    // tables on both sides are sorted and packed, so we can merge them directly
+    context.covariates.quality.merge(context.compute_device, other.compute_device, other.covariates.quality,
+                                     temp_keys, temp_values, context.temp_storage);
+    context.covariates.cycle.merge(context.compute_device, other.compute_device, other.covariates.cycle,
+                                   temp_keys, temp_values, context.temp_storage);
+    context.covariates.context.merge(context.compute_device, other.compute_device, other.covariates.context,
+                                     temp_keys, temp_values, context.temp_storage);
 }
 
 template <target_system system>
@@ -74,12 +83,19 @@ struct firepony_device_pipeline : public firepony_pipeline
     firepony_context<system> *context;
     alignment_batch<system> *batch;
 
+    // temporary buffer pool for context
+    allocation_pool<system> pool;
+    // buffer sizes seen by the context's memory accounting
+    footprint_tracker footprints;
+
     io_thread *reader;
+    // set when recalibrating reads instead of computing the tables
+    alignment_writer *writer;
 
     std::thread thread;
 
     firepony_device_pipeline(uint32 consumer_id, lift::compute_device *device)
-        : consumer_id(consumer_id), device(device)
+        : consumer_id(consumer_id), device(device), writer(nullptr)
     { }
 
     virtual std::string get_name(void) override
@@ -120,7 +136,7 @@ struct firepony_device_pipeline : public firepony_pipeline
 
         header->download();
 
-        context = new firepony_context<system>(*device, *options, *header);
+        context = new firepony_context<system>(*device, *options, *header, pool, footprints);
         batch = new alignment_batch<system>();
     }
 
@@ -159,7 +175,19 @@ struct firepony_device_pipeline : public firepony_pipeline
         }
     }
 
-    virtual void postprocess(void) override
+    virtual void setup_recalibration(io_thread *reader,
+                                     alignment_writer *writer,
+                                     recalibration_tables<host> *tables) override
+    {
+        device->enable();
+
+        this->reader = reader;
+        this->writer = writer;
+
+        context->recalibration.tables.copyfrom(*tables);
+    }
+
+    virtual void postprocess(recalibration_report& report) override
     {
         device->enable();
 
@@ -172,7 +200,7 @@ struct firepony_device_pipeline : public firepony_pipeline
             init.initialize(d.num_threads);
         }
 
-        firepony_postprocess(*context);
+        firepony_postprocess(*context, report);
     }
 
 private:
@@ -216,12 +244,29 @@ private:
             // update context database pointers
             context->update_databases(*reference, *dbsnp);
 
-            // process the batch
-            firepony_process_batch(*context, *batch);
+            if (writer)
+            {
+                // recalibrate the batch, bring the new qualities back and write it out (in input order)
+                firepony_recalibrate_batch(*context, *batch);
+                h_batch->qualities.copy(context->recalibration.qualities);
+                writer->write_batch(h_batch);
+            } else {
+                // process the batch
+                firepony_process_batch(*context, *batch);
+
+                // let the reader correct its batch size estimate under a memory budget
+                reader->report_footprint(h_batch, context->batch_memory_peak, context->resident_memory);
+            }
 
             // return it to the reader for reuse
             reader->retire_batch(h_batch);
         }
+
+        if (!writer)
+        {
+            // move any device-local accumulated data into the intermediate tables
+            firepony_flush_intermediates(*context);
+        }
     }
 };
 
@@ -0,0 +1,76 @@
+/*
+ * Firepony
+ *
+ * Copyright (c) 2014-2015, NVIDIA CORPORATION
+ * Copyright (c) 2015, Nuno Subtil <subtil@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the copyright holders nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "../../types.h"
+
+namespace firepony {
+
+// atomic primitives usable from both host and device code
+// on the host side, these map to the gcc __sync builtins, since the TBB backend runs functors concurrently
+
+inline CUDA_HOST_DEVICE uint32 atomic_cas(uint32 *address, uint32 compare, uint32 val)
+{
+#if CUDA_DEVICE_COMPILATION
+    return atomicCAS(address, compare, val);
+#else
+    return __sync_val_compare_and_swap(address, compare, val);
+#endif
+}
+
+inline CUDA_HOST_DEVICE uint64 atomic_cas(uint64 *address, uint64 compare, uint64 val)
+{
+#if CUDA_DEVICE_COMPILATION
+    return atomicCAS((unsigned long long *) address, (unsigned long long) compare, (unsigned long long) val);
+#else
+    return __sync_val_compare_and_swap(address, compare, val);
+#endif
+}
+
+inline CUDA_HOST_DEVICE uint32 atomic_add(uint32 *address, uint32 val)
+{
+#if CUDA_DEVICE_COMPILATION
+    return atomicAdd(address, val);
+#else
+    return __sync_fetch_and_add(address, val);
+#endif
+}
+
+inline CUDA_HOST_DEVICE uint64 atomic_add(uint64 *address, uint64 val)
+{
+#if CUDA_DEVICE_COMPILATION
+    return atomicAdd((unsigned long long *) address, (unsigned long long) val);
+#else
+    return __sync_fetch_and_add(address, val);
+#endif
+}
+
+} // namespace firepony
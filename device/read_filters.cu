@@ -30,6 +30,9 @@
 
 #include <lift/parallel.h>
 
+#include <thrust/count.h>
+#include <thrust/iterator/permutation_iterator.h>
+
 #include "from_nvbio/alphabet.h"
 
 #include "firepony_context.h"
@@ -39,13 +42,17 @@
 
 namespace firepony {
 
+// read filters
+// each filter is a stateless predicate that returns true for reads that should be kept;
+// filters are composed at compile time into a read_filter_chain and evaluated together in a single compaction pass
+
 // filter if any of the flags are set
 template <target_system system, uint32 flags>
-struct filter_if_any_set : public lambda<system>
+struct filter_if_any_set
 {
-    LAMBDA_INHERIT;
+    static constexpr read_filter_id id = READ_FILTER_FLAGS;
 
-    CUDA_HOST_DEVICE bool operator() (const uint32 read_index)
+    static CUDA_HOST_DEVICE bool pass(firepony_context<system>& ctx, const alignment_batch_device<system>& batch, const uint32 read_index)
     {
         if ((batch.flags[read_index] & flags) != 0)
         {
@@ -58,11 +65,11 @@ struct filter_if_any_set : public lambda<system>
 
 // implements the GATK filters MappingQualityUnavailable and MappingQualityZero
 template <target_system system>
-struct filter_mapq : public lambda<system>
+struct filter_mapq
 {
-    LAMBDA_INHERIT;
+    static constexpr read_filter_id id = READ_FILTER_MAPQ;
 
-    CUDA_HOST_DEVICE bool operator() (const uint32 read_index)
+    static CUDA_HOST_DEVICE bool pass(firepony_context<system>& ctx, const alignment_batch_device<system>& batch, const uint32 read_index)
     {
         if (batch.mapq[read_index] == 0 ||
             batch.mapq[read_index] == 255)
@@ -74,13 +81,26 @@ struct filter_mapq : public lambda<system>
     }
 };
 
+// implements the minimum length part of the GATK ReadLengthFilter
+template <target_system system>
+struct filter_min_read_length
+{
+    static constexpr read_filter_id id = READ_FILTER_MIN_READ_LENGTH;
+
+    static CUDA_HOST_DEVICE bool pass(firepony_context<system>& ctx, const alignment_batch_device<system>& batch, const uint32 read_index)
+    {
+        const CRQ_index idx = batch.crq_index(read_index);
+        return idx.read_len >= ctx.read_filter.min_read_length;
+    }
+};
+
 // partially implements the GATK MalformedReadFilter
 template <target_system system>
-struct filter_if_read_malformed : public lambda<system>
+struct filter_if_read_malformed
 {
-    LAMBDA_INHERIT;
+    static constexpr read_filter_id id = READ_FILTER_MALFORMED_READ;
 
-    CUDA_HOST_DEVICE bool operator() (const uint32 read_index)
+    static CUDA_HOST_DEVICE bool pass(firepony_context<system>& ctx, const alignment_batch_device<system>& batch, const uint32 read_index)
     {
         const CRQ_index idx = batch.crq_index(read_index);
 
@@ -155,11 +175,11 @@ struct filter_if_read_malformed : public lambda<system>
 
 // implements another part of the GATK MalformedReadFilter
 template <target_system system>
-struct filter_if_cigar_malformed : public lambda<system>
+struct filter_if_cigar_malformed
 {
-    LAMBDA_INHERIT;
+    static constexpr read_filter_id id = READ_FILTER_MALFORMED_CIGAR;
 
-    CUDA_HOST_DEVICE bool operator() (const uint32 read_index)
+    static CUDA_HOST_DEVICE bool pass(firepony_context<system>& ctx, const alignment_batch_device<system>& batch, const uint32 read_index)
     {
         const CRQ_index idx = batch.crq_index(read_index);
 
@@ -257,112 +277,116 @@ struct filter_if_cigar_malformed : public lambda<system>
     }
 };
 
-// filter invalid reads
-// (this runs prior to any other pieces of the context being populated)
+// a list of read filters, applied in order
+// a read is kept if it passes all filters; otherwise, the rejection is counted against the first filter that failed
+template <target_system system, typename... filters>
+struct read_filter_chain;
+
 template <target_system system>
-void filter_invalid_reads(firepony_context<system>& context, const alignment_batch<system>& batch)
+struct read_filter_chain<system>
 {
-    auto& active_read_list = context.active_read_list;
-    auto& temp_u32 = context.temp_u32;
-    uint32 num_active;
-    uint32 start_count;
-
-    // corresponds to the GATK filters MappingQualityUnavailable and MappingQualityZero
-    filter_mapq<system> mapq_filter(context, batch.device);
-
-    // this filter corresponds to the following GATK filters:
-    // - DuplicateReadFilter
-    // - FailsVendorQualityCheckFilter
-    // - NotPrimaryAlignmentFilter
-    // - UnmappedReadFilter
-    filter_if_any_set<system,
-                      AlignmentFlags::DUPLICATE |
-                      AlignmentFlags::QC_FAIL |
-                      AlignmentFlags::UNMAP |
-                      AlignmentFlags::SECONDARY> flags_filter(context, batch.device);
-
-    // implements part of the GATK filter MalformedReadFilter
-    filter_if_cigar_malformed<system> malformed_cigar_filter(context, batch.device);
+    // bit i is set if the chain contains the filter with id i
+    static constexpr uint32 mask = 0;
 
-    start_count = active_read_list.size();
-    num_active = active_read_list.size();
-
-    // make sure the temp buffer is big enough
-    context.temp_u32.resize(active_read_list.size());
-
-    // set up a ping-pong queue between active_read_list and temp_u32
-    auto pingpong = make_pingpong_queue(active_read_list, temp_u32);
+    static CUDA_HOST_DEVICE uint8 first_failure(firepony_context<system>& ctx, const alignment_batch_device<system>& batch, const uint32 read_index)
+    {
+        return uint8(NUM_READ_FILTERS);
+    }
+};
 
-    // apply the mapq filter
-    num_active = parallel<system>::copy_if(pingpong.source().begin(),
-                                           num_active,
-                                           pingpong.dest().begin(),
-                                           mapq_filter,
-                                           context.temp_storage);
-    pingpong.swap();
+template <target_system system, typename filter, typename... next>
+struct read_filter_chain<system, filter, next...>
+{
+    static constexpr uint32 mask = (1u << filter::id) | read_filter_chain<system, next...>::mask;
 
-    if (num_active)
+    static CUDA_HOST_DEVICE uint8 first_failure(firepony_context<system>& ctx, const alignment_batch_device<system>& batch, const uint32 read_index)
     {
-        // apply the flags filters
-        num_active = parallel<system>::copy_if(pingpong.source().begin(),
-                                               num_active,
-                                               pingpong.dest().begin(),
-                                               flags_filter,
-                                               context.temp_storage);
-        pingpong.swap();
+        if (!filter::pass(ctx, batch, read_index))
+        {
+            return uint8(filter::id);
+        }
+
+        return read_filter_chain<system, next...>::first_failure(ctx, batch, read_index);
     }
+};
 
-    if (num_active)
+// evaluates a filter chain on a read and records the first filter that rejected it
+template <target_system system, typename chain>
+struct apply_read_filter_chain : public lambda<system>
+{
+    LAMBDA_INHERIT;
+
+    CUDA_HOST_DEVICE void operator() (const uint32 read_index)
     {
-        // apply the malformed cigar filters
-        num_active = parallel<system>::copy_if(pingpong.source().begin(),
-                                               num_active,
-                                               pingpong.dest().begin(),
-                                               malformed_cigar_filter,
-                                               context.temp_storage);
-        pingpong.swap();
+        ctx.read_filter.first_failure[read_index] = chain::first_failure(ctx, batch, read_index);
     }
+};
 
-    pingpong.source().resize(num_active);
+// copy_if predicate that keeps the reads that passed all filters
+template <target_system system>
+struct read_passed_filters : public lambda<system>
+{
+    LAMBDA_INHERIT;
 
-    // copy back into active_read_list if needed
-    if (pingpong.is_swapped())
+    CUDA_HOST_DEVICE bool operator() (const uint32 read_index)
     {
-        active_read_list.copy(pingpong.source());
+        return ctx.read_filter.first_failure[read_index] == uint8(NUM_READ_FILTERS);
     }
+};
 
-    // track how many reads we filtered
-    context.stats.filtered_reads += start_count - num_active;
-}
-INSTANTIATE(filter_invalid_reads);
-
-// filter invalid reads
-// (this runs prior to any other pieces of the context being populated)
-template <target_system system>
-void filter_malformed_reads(firepony_context<system>& context, const alignment_batch<system>& batch)
+// applies a filter chain to the active read list with a single compaction and accumulates the per-filter rejection counts
+// the filters are evaluated once per read up front, so the compaction and the counts both work off the same stored result
+template <target_system system, typename chain>
+static void run_read_filter_chain(firepony_context<system>& context, const alignment_batch<system>& batch)
 {
     auto& active_read_list = context.active_read_list;
     auto& temp_u32 = context.temp_u32;
+    auto& first_failure = context.read_filter.first_failure;
     uint32 num_active;
     uint32 start_count;
 
-    // implements part of the GATK filter MalformedReadFilter
-    filter_if_read_malformed<system> malformed_read_filter(context, batch.device);
-
     start_count = active_read_list.size();
-    num_active = active_read_list.size();
+
+    // evaluate all filters in one pass
+    first_failure.resize(batch.device.num_reads);
+    parallel<system>::for_each(active_read_list.begin(),
+                               active_read_list.end(),
+                               apply_read_filter_chain<system, chain>(context, batch.device));
 
     // make sure the temp buffer is big enough
-    context.temp_u32.resize(active_read_list.size());
+    temp_u32.resize(active_read_list.size());
 
-    // apply the malformed read filter
-    // this copies from active_read_list into temp_u32
+    // this copies the surviving reads from active_read_list into temp_u32
     num_active = parallel<system>::copy_if(active_read_list.begin(),
-                                           num_active,
+                                           start_count,
                                            temp_u32.begin(),
-                                           malformed_read_filter,
+                                           read_passed_filters<system>(context, batch.device),
                                            context.temp_storage);
 
+    // count the rejections for each filter in the chain
+    // the compaction already gives the total, so the filter with the highest id gets whatever the others didn't reject,
+    // and nothing needs counting for a single-filter chain or once every rejection is accounted for
+    uint32 remaining = start_count - num_active;
+    for(uint32 i = 0; i < NUM_READ_FILTERS && remaining; i++)
+    {
+        if (!(chain::mask & (1u << i)))
+            continue;
+
+        uint32 count;
+        if (chain::mask >> (i + 1))
+        {
+            count = thrust::count(lift::backend_policy<system>::execution_policy(),
+                                  thrust::make_permutation_iterator(first_failure.begin(), active_read_list.begin()),
+                                  thrust::make_permutation_iterator(first_failure.begin(), active_read_list.begin() + start_count),
+                                  uint8(i));
+        } else {
+            count = remaining;
+        }
+
+        context.stats.read_filter_rejections[i] += count;
+        remaining -= count;
+    }
+
     // resize and copy back to active_read_list
     temp_u32.resize(num_active);
     active_read_list.copy(temp_u32);
@@ -370,6 +394,42 @@ void filter_malformed_reads(firepony_context<system>& context, const alignment_b
     // track how many reads we filtered
     context.stats.filtered_reads += start_count - num_active;
 }
+
+// filter invalid reads
+// (this runs prior to any other pieces of the context being populated)
+template <target_system system>
+void filter_invalid_reads(firepony_context<system>& context, const alignment_batch<system>& batch)
+{
+    // the flags filter corresponds to the following GATK filters:
+    // - DuplicateReadFilter
+    // - FailsVendorQualityCheckFilter
+    // - NotPrimaryAlignmentFilter
+    // - UnmappedReadFilter
+    typedef read_filter_chain<system,
+                              filter_mapq<system>,
+                              filter_if_any_set<system,
+                                                AlignmentFlags::DUPLICATE |
+                                                AlignmentFlags::QC_FAIL |
+                                                AlignmentFlags::UNMAP |
+                                                AlignmentFlags::SECONDARY>,
+                              filter_if_cigar_malformed<system>,
+                              filter_min_read_length<system> > chain;
+
+    context.read_filter.min_read_length = context.options.min_read_length;
+    run_read_filter_chain<system, chain>(context, batch);
+}
+INSTANTIATE(filter_invalid_reads);
+
+// filter malformed reads
+// (this requires the alignment windows and runs separately, since computing them relies on the cigar checks above)
+template <target_system system>
+void filter_malformed_reads(firepony_context<system>& context, const alignment_batch<system>& batch)
+{
+    typedef read_filter_chain<system,
+                              filter_if_read_malformed<system> > chain;
+
+    run_read_filter_chain<system, chain>(context, batch);
+}
 INSTANTIATE(filter_malformed_reads);
 
 // filter non-regular bases (anything other than A, C, G, T)
@@ -27,13 +27,66 @@
 
 #pragma once
 
-#include "firepony_context.h"
+#include "../types.h"
+#include "alignment_data_device.h"
+#include "util.h"
 
 namespace firepony {
 
+// identifies each read filter, in the order in which they are applied
+// each filter has its own rejection counter in pipeline_statistics
+typedef enum {
+    READ_FILTER_MAPQ,               // GATK: MappingQualityUnavailable, MappingQualityZero
+    READ_FILTER_FLAGS,              // GATK: DuplicateRead, FailsVendorQualityCheck, NotPrimaryAlignment, UnmappedRead
+    READ_FILTER_MALFORMED_CIGAR,    // GATK: MalformedRead (cigar checks)
+    READ_FILTER_MIN_READ_LENGTH,    // GATK: ReadLength
+    READ_FILTER_MALFORMED_READ,     // GATK: MalformedRead (alignment and header checks)
+
+    NUM_READ_FILTERS
+} read_filter_id;
+
+inline const char *read_filter_name(const uint32 id)
+{
+    switch(id)
+    {
+    case READ_FILTER_MAPQ:
+        return "MappingQualityFilter";
+    case READ_FILTER_FLAGS:
+        return "FlagFilter";
+    case READ_FILTER_MALFORMED_CIGAR:
+        return "MalformedCigarFilter";
+    case READ_FILTER_MIN_READ_LENGTH:
+        return "ReadLengthFilter";
+    case READ_FILTER_MALFORMED_READ:
+        return "MalformedReadFilter";
+    default:
+        return "?";
+    }
+}
+
+template <target_system system>
+struct read_filter_context
+{
+    // reads shorter than this are filtered out (0 disables the filter)
+    uint32 min_read_length;
+
+    // the first filter that rejected each read in the current filter pass, indexed by read index
+    // (NUM_READ_FILTERS if the read passed all filters)
+    persistent_allocation<system, uint8> first_failure;
+
+    read_filter_context()
+        : min_read_length(0)
+    { }
+
+    // number of bytes held by this context
+    size_t footprint(footprint_tracker& tracker) const
+    {
+        return firepony::footprint(tracker, first_failure);
+    }
+};
+
 template <target_system system> void filter_invalid_reads(firepony_context<system>& context, const alignment_batch<system>& batch);
 template <target_system system> void filter_malformed_reads(firepony_context<system>& context, const alignment_batch<system>& batch);
 template <target_system system> void filter_bases(firepony_context<system>& context, const alignment_batch<system>& batch);
 
 } // namespace firepony
-
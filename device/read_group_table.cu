@@ -81,8 +81,8 @@ void build_read_group_table(firepony_context<system>& context)
                                remove_quality_from_key<system>(context));
 
     // sort and pack the read group table
-    auto& temp_keys = context.temp_u32;
-    scoped_allocation<system, covariate_empirical_value> temp_values;
+    pooled_allocation<system, covariate_key> temp_keys(context.pool);
+    pooled_allocation<system, covariate_empirical_value> temp_values(context.pool);
     auto& temp_storage = context.temp_storage;
 
     cv.read_group.sort(temp_keys, temp_values, temp_storage, covariate_packer_quality_score<system>::chain::bits_used);
@@ -93,15 +93,14 @@ void build_read_group_table(firepony_context<system>& context)
 }
 INSTANTIATE(build_read_group_table);
 
-template <target_system system>
-static void output_read_group_table_loop(firepony_context<system>& context, covariate_empirical_table<host>& table, table_formatter& fmt)
+static void output_read_group_table_loop(const string_database& read_groups, covariate_empirical_table<host>& table, table_formatter& fmt)
 {
-    typedef covariate_packer_quality_score<system> packer;
+    typedef covariate_packer_quality_score<host> packer;
 
     for(uint32 i = 0; i < table.size(); i++)
     {
         uint32 rg_id = packer::decode(table.keys[i], packer::ReadGroup);
-        const std::string& rg_name = context.bam_header.host.read_groups_db.lookup(rg_id);
+        const std::string& rg_name = read_groups.lookup(rg_id);
 
         const char ev = cigar_event::ascii(packer::decode(table.keys[i], packer::EventTracker));
         const covariate_empirical_value& val = table.values[i];
@@ -119,12 +118,8 @@ static void output_read_group_table_loop(firepony_context<system>& context, cova
     }
 }
 
-template <target_system system>
-void output_read_group_table(firepony_context<system>& context)
+void output_read_group_table(recalibration_report& report)
 {
-    covariate_empirical_table<host> table;
-    table.copyfrom(context.covariates.read_group);
-
     table_formatter fmt("RecalTable0");
     fmt.add_column("ReadGroup", table_formatter::FMT_STRING);
     fmt.add_column("EventType", table_formatter::FMT_CHAR);
@@ -133,15 +128,9 @@ void output_read_group_table(firepony_context<system>& context)
     fmt.add_column("Observations", table_formatter::FMT_UINT64);
     fmt.add_column("Errors", table_formatter::FMT_FLOAT_2, table_formatter::ALIGNMENT_RIGHT, table_formatter::ALIGNMENT_LEFT);
 
-    // preprocess table data to compute column widths
-    output_read_group_table_loop(context, table, fmt);
-    fmt.end_table();
-
-    // output table
-    output_read_group_table_loop(context, table, fmt);
+    output_read_group_table_loop(report.read_groups, report.read_group, fmt);
     fmt.end_table();
 }
-INSTANTIATE(output_read_group_table);
 
 } // namespace firepony
 
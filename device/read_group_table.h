@@ -29,11 +29,12 @@
 
 #include "device_types.h"
 #include "covariate_table.h"
+#include "recalibration_report.h"
 
 namespace firepony {
 
 template <target_system system> void build_read_group_table(firepony_context<system>& context);
-template <target_system system> void output_read_group_table(firepony_context<system>& context);
+void output_read_group_table(recalibration_report& report);
 
 } // namespace firepony
 
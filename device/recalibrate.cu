@@ -0,0 +1,291 @@
+/*
+ * Firepony
+ * Copyright (c) 2014-2015, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the NVIDIA CORPORATION nor the
+ *      names of its contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NVIDIA CORPORATION BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <lift/parallel.h>
+
+#include <thrust/fill.h>
+
+#include "firepony_context.h"
+#include "covariates.h"
+#include "empirical_quality.h"
+#include "recalibrate.h"
+
+#include "covariates/packer_context.h"
+#include "covariates/packer_cycle_illumina.h"
+#include "covariates/packer_quality_score.h"
+
+namespace firepony {
+
+// bases with reported quality below this are left untouched (GATK's preserve_qscores_less_than)
+static constexpr int PRESERVE_QSCORES_LESS_THAN = 6;
+static constexpr int MIN_RECALIBRATED_Q_SCORE = 1;
+static constexpr int MAX_RECALIBRATED_Q_SCORE = 93;
+
+// fills in the covariate deltas for the mismatch rows of a table, given the prior for each (read group, quality) pair
+template <typename covariate_packer>
+static void build_covariate_deltas(persistent_allocation<host, double>& out, uint32& span,
+                                   covariate_empirical_table<host>& table,
+                                   const std::vector<double>& covariate_prior,
+                                   const uint32 num_read_groups)
+{
+    persistent_allocation<host, double> prior;
+    persistent_allocation<host, double> qemp;
+
+    span = 0;
+    prior.resize(table.size());
+
+    for(uint32 i = 0; i < table.size(); i++)
+    {
+        const uint32 rg = covariate_packer::decode(table.keys[i], covariate_packer::ReadGroup);
+        const uint32 qual = covariate_packer::decode(table.keys[i], covariate_packer::QualityScore);
+
+        if (rg < num_read_groups &&
+            covariate_packer::decode(table.keys[i], covariate_packer::EventTracker) == cigar_event::M)
+        {
+            prior[i] = covariate_prior[recalibration_tables<host>::prior_index(rg, qual)];
+            span = std::max(span, covariate_packer::decode(table.keys[i], covariate_packer::TargetCovariate) + 1);
+        } else {
+            prior[i] = 0.0;
+        }
+    }
+
+    compute_conditional_empirical_quality(table, prior, qemp);
+
+    out.resize(num_read_groups * 256 * span);
+    thrust::fill(out.t_begin(), out.t_end(), 0.0);
+
+    for(uint32 i = 0; i < table.size(); i++)
+    {
+        const uint32 rg = covariate_packer::decode(table.keys[i], covariate_packer::ReadGroup);
+        const uint32 qual = covariate_packer::decode(table.keys[i], covariate_packer::QualityScore);
+        const uint32 value = covariate_packer::decode(table.keys[i], covariate_packer::TargetCovariate);
+
+        if (rg < num_read_groups &&
+            covariate_packer::decode(table.keys[i], covariate_packer::EventTracker) == cigar_event::M &&
+            prior[i] >= 0.0)
+        {
+            out[recalibration_tables<host>::prior_index(rg, qual) * span + value] = qemp[i] - prior[i];
+        }
+    }
+}
+
+void build_recalibration_tables(recalibration_tables<host>& out, recalibration_report& report)
+{
+    typedef covariate_packer_quality_score<host> packer;
+
+    const uint32 num_read_groups = std::min<uint32>(report.read_groups.size(), 1 << 8);
+    const uint32 num_slots = num_read_groups * 256;
+
+    out.num_read_groups = num_read_groups;
+
+    // epsilon and globalDeltaQ for each read group
+    std::vector<double> epsilon(num_read_groups, -1.0);
+    std::vector<double> global_delta(num_read_groups, 0.0);
+
+    persistent_allocation<host, double> prior;
+    persistent_allocation<host, double> qemp;
+
+    prior.resize(report.read_group.size());
+    for(uint32 i = 0; i < report.read_group.size(); i++)
+    {
+        prior[i] = report.read_group.values[i].estimated_quality;
+    }
+
+    compute_conditional_empirical_quality(report.read_group, prior, qemp);
+
+    for(uint32 i = 0; i < report.read_group.size(); i++)
+    {
+        const uint32 rg = packer::decode(report.read_group.keys[i], packer::ReadGroup);
+
+        if (rg < num_read_groups &&
+            packer::decode(report.read_group.keys[i], packer::EventTracker) == cigar_event::M)
+        {
+            epsilon[rg] = prior[i];
+            global_delta[rg] = qemp[i] - prior[i];
+        }
+    }
+
+    // deltaQReported for each (read group, quality) pair
+    std::vector<double> reported_delta(num_slots, 0.0);
+
+    prior.resize(report.quality.size());
+    for(uint32 i = 0; i < report.quality.size(); i++)
+    {
+        const uint32 rg = packer::decode(report.quality.keys[i], packer::ReadGroup);
+        prior[i] = (rg < num_read_groups ? global_delta[rg] + epsilon[rg] : 0.0);
+    }
+
+    compute_conditional_empirical_quality(report.quality, prior, qemp);
+
+    for(uint32 i = 0; i < report.quality.size(); i++)
+    {
+        const uint32 rg = packer::decode(report.quality.keys[i], packer::ReadGroup);
+        const uint32 qual = packer::decode(report.quality.keys[i], packer::QualityScore);
+
+        if (rg < num_read_groups && epsilon[rg] >= 0.0 &&
+            packer::decode(report.quality.keys[i], packer::EventTracker) == cigar_event::M)
+        {
+            reported_delta[recalibration_tables<host>::prior_index(rg, qual)] = qemp[i] - prior[i];
+        }
+    }
+
+    // the prior for each base, plus the prior the covariate tables are conditioned on
+    // these are the same sum, but GATK adds the terms up in a different order for each, so we do the same
+    std::vector<double> covariate_prior(num_slots, -1.0);
+    out.prior.resize(num_slots);
+
+    for(uint32 rg = 0; rg < num_read_groups; rg++)
+    {
+        for(uint32 qual = 0; qual < 256; qual++)
+        {
+            const uint32 slot = recalibration_tables<host>::prior_index(rg, qual);
+
+            if (epsilon[rg] >= 0.0)
+            {
+                out.prior[slot] = epsilon[rg] + global_delta[rg] + reported_delta[slot];
+                covariate_prior[slot] = reported_delta[slot] + global_delta[rg] + epsilon[rg];
+            } else {
+                out.prior[slot] = -1.0;
+            }
+        }
+    }
+
+    build_covariate_deltas<covariate_packer_context<host> >(out.context_delta, out.context_span, report.context, covariate_prior, num_read_groups);
+    build_covariate_deltas<covariate_packer_cycle_illumina<host> >(out.cycle_delta, out.cycle_span, report.cycle, covariate_prior, num_read_groups);
+}
+
+template <target_system system>
+struct recalibrate_read : public lambda<system>
+{
+    LAMBDA_INHERIT;
+
+    typedef covariate_packer_context<system> context_packer;
+    typedef covariate_packer_cycle_illumina<system> cycle_packer;
+    typedef covariate_Context<system, context_packer::num_bases_mismatch, context_packer::num_bases_indel> context_covariate;
+
+    // looks up the delta for the mismatch key generated by a covariate chain
+    template <typename covariate_packer>
+    CUDA_HOST_DEVICE double covariate_delta(persistent_allocation<system, double>& deltas, const uint32 span, const covariate_key key)
+    {
+        const uint32 value = covariate_packer::decode(key, covariate_packer::TargetCovariate);
+        if (value >= span)
+        {
+            return 0.0;
+        }
+
+        const uint32 slot = recalibration_tables<system>::prior_index(covariate_packer::decode(key, covariate_packer::ReadGroup),
+                                                                      covariate_packer::decode(key, covariate_packer::QualityScore));
+        return deltas[slot * span + value];
+    }
+
+    CUDA_HOST_DEVICE void operator() (const uint32 read_index)
+    {
+        const CRQ_index idx = batch.crq_index(read_index);
+        auto& tables = ctx.recalibration.tables;
+        auto& out = ctx.recalibration.qualities;
+
+        for(uint32 i = 0; i < idx.qual_len; i++)
+        {
+            out[idx.qual_start + i] = batch.qualities[idx.qual_start + i];
+        }
+
+        const uint32 read_group = covariate_ReadGroup<system>::value(batch, read_index);
+
+        // reads without qualities or from read groups missing in the tables are left alone
+        if (idx.qual_len == 0 || idx.qual_len != idx.read_len ||
+            batch.qualities[idx.qual_start] == 0xff ||
+            read_group >= tables.num_read_groups)
+        {
+            return;
+        }
+
+        // the tables are built from the aligned part of each read, but recalibration covers the whole read
+        // (GATK computes covariates over soft clipped bases as well at this stage)
+        const read_coord2 window = make_read_coord2(0, idx.read_len - 1);
+        const read_coord2 high_quality_window = clip_low_quality_tails(batch, read_index, window);
+
+        typename covariate_Cycle_Illumina<system>::read_state cycle_state(batch, read_index, window);
+        typename context_covariate::read_state context_state(batch, read_index, high_quality_window);
+
+        covariate_event_values values;
+        values.read_group = read_group;
+
+        for(read_coord bp_offset = 0; bp_offset < idx.read_len; bp_offset++)
+        {
+            const uint8 qual = batch.qualities[idx.qual_start + bp_offset];
+            if (qual < PRESERVE_QSCORES_LESS_THAN)
+            {
+                continue;
+            }
+
+            const double prior = tables.prior[recalibration_tables<system>::prior_index(read_group, qual)];
+            if (prior < 0.0)
+            {
+                continue;
+            }
+
+            values.quality = covariate_QualityScore<system>::value(batch, read_index, bp_offset);
+            values.cycle = cycle_state.value(bp_offset);
+
+            if (bp_offset >= high_quality_window.x && bp_offset <= high_quality_window.y)
+            {
+                values.context = context_state.value(bp_offset);
+            } else {
+                // bases in the low quality tails have no context
+                values.context = { context_covariate::invalid_key_pattern,
+                                   context_covariate::invalid_key_pattern,
+                                   context_covariate::invalid_key_pattern };
+            }
+
+            const covariate_key context_key = context_packer::chain::encode(ctx, batch, read_index, bp_offset, 0, values, covariate_key_set{0, 0, 0}).M;
+            const covariate_key cycle_key = cycle_packer::chain::encode(ctx, batch, read_index, bp_offset, 0, values, covariate_key_set{0, 0, 0}).M;
+
+            const double delta = covariate_delta<context_packer>(tables.context_delta, tables.context_span, context_key) +
+                                 covariate_delta<cycle_packer>(tables.cycle_delta, tables.cycle_span, cycle_key);
+            const double recalibrated = prior + delta;
+
+            // round half away from zero and clamp, as GATK does
+            int q = (recalibrated > 0.0 ? int(recalibrated + 0.5) : int(recalibrated - 0.5));
+            q = min(max(q, MIN_RECALIBRATED_Q_SCORE), MAX_RECALIBRATED_Q_SCORE);
+
+            out[idx.qual_start + bp_offset] = uint8(q);
+        }
+    }
+};
+
+template <target_system system>
+void recalibrate_batch(firepony_context<system>& context, const alignment_batch<system>& batch)
+{
+    context.recalibration.qualities.resize(batch.device.qualities.size());
+
+    parallel<system>::for_each(thrust::make_counting_iterator(0u),
+                               thrust::make_counting_iterator(0u) + batch.device.num_reads,
+                               recalibrate_read<system>(context, batch.device));
+}
+INSTANTIATE(recalibrate_batch);
+
+} // namespace firepony
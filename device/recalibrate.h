@@ -0,0 +1,96 @@
+/*
+ * Firepony
+ * Copyright (c) 2014-2015, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the NVIDIA CORPORATION nor the
+ *      names of its contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NVIDIA CORPORATION BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "../types.h"
+#include "alignment_data_device.h"
+#include "recalibration_report.h"
+
+namespace firepony {
+
+// dense lookup tables used to recalibrate base qualities with a recalibration report
+//
+// for each base, GATK's sequential estimate is
+//   epsilon + globalDeltaQ + deltaQReported + (deltaQContext + deltaQCycle)
+// the first three terms only depend on the read group and reported quality, so they're folded into a single prior;
+// the covariate terms also only depend on the table row (their prior is part of the key), so they're precomputed per row
+// and laid out densely: slot ((read_group << 8) | quality) * span + covariate value, with span one past the largest
+// covariate value in the table
+// only mismatch (M) rows are used, as indel qualities are not written out
+template <target_system system>
+struct recalibration_tables
+{
+    // reads from read groups at or above this are not recalibrated
+    uint32 num_read_groups;
+    // epsilon + globalDeltaQ + deltaQReported for each (read group, quality) pair, or -1 for read groups without data
+    persistent_allocation<system, double> prior;
+
+    uint32 context_span;
+    uint32 cycle_span;
+    // covariate deltas; zero where the report has no row
+    persistent_allocation<system, double> context_delta;
+    persistent_allocation<system, double> cycle_delta;
+
+    recalibration_tables()
+        : num_read_groups(0),
+          context_span(0),
+          cycle_span(0)
+    { }
+
+    static CUDA_HOST_DEVICE uint32 prior_index(const uint32 read_group, const uint32 quality)
+    {
+        return (read_group << 8) | quality;
+    }
+
+    template <target_system other_system>
+    void copyfrom(recalibration_tables<other_system>& other)
+    {
+        num_read_groups = other.num_read_groups;
+        context_span = other.context_span;
+        cycle_span = other.cycle_span;
+
+        prior.copy(other.prior);
+        context_delta.copy(other.context_delta);
+        cycle_delta.copy(other.cycle_delta);
+    }
+};
+
+template <target_system system>
+struct recalibration_context
+{
+    recalibration_tables<system> tables;
+    // recalibrated qualities for the current batch, laid out like the batch quality data
+    persistent_allocation<system, uint8> qualities;
+};
+
+// builds the dense tables for a report
+void build_recalibration_tables(recalibration_tables<host>& out, recalibration_report& report);
+// recalibrates the base qualities of all reads in a batch into context.recalibration.qualities
+template <target_system system> void recalibrate_batch(firepony_context<system>& context, const alignment_batch<system>& batch);
+
+} // namespace firepony
@@ -0,0 +1,64 @@
+/*
+ * Firepony
+ * Copyright (c) 2014-2015, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the NVIDIA CORPORATION nor the
+ *      names of its contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NVIDIA CORPORATION BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "../types.h"
+#include "../string_database.h"
+#include "covariate_table.h"
+
+namespace firepony {
+
+// host copy of the empirical tables that make up a recalibration report
+// both the GATKReport text writer and the binary table file (see recalibration_table_file.h) work from this
+struct recalibration_report
+{
+    // tables were generated with GATK4 BaseRecalibrator defaults
+    bool gatk4;
+
+    // read group names, indexed by the value of the read group covariate
+    string_database read_groups;
+
+    // RecalTable0
+    covariate_empirical_table<host> read_group;
+    // RecalTable1
+    covariate_empirical_table<host> quality;
+    // RecalTable2, split by covariate
+    covariate_empirical_table<host> context;
+    covariate_empirical_table<host> cycle;
+
+    recalibration_report()
+        : gatk4(false)
+    { }
+};
+
+// copies the empirical tables out of a pipeline context
+template <target_system system> void build_recalibration_report(firepony_context<system>& context, recalibration_report& report);
+// writes out a report in GATKReport text format
+void output_recalibration_report(recalibration_report& report);
+
+} // namespace firepony
@@ -0,0 +1,444 @@
+/*
+ * Firepony
+ * Copyright (c) 2014-2015, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the NVIDIA CORPORATION nor the
+ *      names of its contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NVIDIA CORPORATION BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <set>
+#include <string>
+
+#include "recalibration_table_file.h"
+#include "../command_line.h"
+
+#include "covariates/packer_context.h"
+#include "covariates/packer_cycle_illumina.h"
+#include "covariates/packer_quality_score.h"
+
+namespace firepony {
+
+static uint64 align_offset(uint64 offset)
+{
+    return (offset + 7) & ~uint64(7);
+}
+
+// records the key layout of a packer chain
+// names lists the covariates in chain index order, starting at index 1 (the least significant bits)
+template <typename chain>
+static void describe_chain(recalibration_table_file_table& out, const char * const names[])
+{
+    static_assert(chain::index <= RECAL_TABLE_MAX_COVARIATES, "covariate chain too long");
+
+    out.num_covariates = chain::index;
+
+    for(uint32 i = 0; i < chain::index; i++)
+    {
+        const uint64 mask = chain::key_mask(i + 1);
+
+        strncpy(out.covariates[i].name, names[i], sizeof(out.covariates[i].name) - 1);
+        out.covariates[i].offset = __builtin_ctzll(mask);
+        out.covariates[i].bits = __builtin_popcountll(mask);
+    }
+}
+
+static bool write_padding(FILE *fp, uint64& offset)
+{
+    static const char zero[8] = { 0 };
+    const uint64 aligned = align_offset(offset);
+
+    if (fwrite(zero, 1, aligned - offset, fp) != aligned - offset)
+        return false;
+
+    offset = aligned;
+    return true;
+}
+
+// records the key layout of every table for this build
+static void describe_table_layouts(recalibration_table_file_header& header)
+{
+    static const char * const quality_score_names[] = { "EventTracker", "QualityScore", "ReadGroup" };
+    static const char * const context_names[] = { "EventTracker", "Context", "QualityScore", "ReadGroup" };
+    static const char * const cycle_names[] = { "EventTracker", "Cycle", "QualityScore", "ReadGroup" };
+
+    describe_chain<covariate_packer_quality_score<host>::chain>(header.tables[RECAL_TABLE_READ_GROUP], quality_score_names);
+    describe_chain<covariate_packer_quality_score<host>::chain>(header.tables[RECAL_TABLE_QUALITY], quality_score_names);
+    describe_chain<covariate_packer_context<host>::chain>(header.tables[RECAL_TABLE_CONTEXT], context_names);
+    describe_chain<covariate_packer_cycle_illumina<host>::chain>(header.tables[RECAL_TABLE_CYCLE], cycle_names);
+}
+
+bool write_recalibration_table_file(const char *fname, recalibration_report& report)
+{
+
+    covariate_empirical_table<host> *tables[NUM_RECAL_TABLES] = {
+        &report.read_group,
+        &report.quality,
+        &report.context,
+        &report.cycle,
+    };
+
+    recalibration_table_file_header header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, RECAL_TABLE_FILE_MAGIC, sizeof(RECAL_TABLE_FILE_MAGIC));
+    header.version = RECAL_TABLE_FILE_VERSION;
+    header.flags = (report.gatk4 ? RECAL_TABLE_FILE_GATK4 : 0) |
+                   (command_line_options.disable_output_rounding ? RECAL_TABLE_FILE_NO_ROUNDING : 0);
+    header.key_size = sizeof(covariate_key);
+    header.value_size = sizeof(covariate_empirical_value);
+
+    describe_table_layouts(header);
+
+    // lay out the read group dictionary
+    std::vector<uint64> name_offsets;
+    uint64 name_data_size = 0;
+
+    header.num_read_groups = report.read_groups.size();
+    for(uint32 i = 0; i < header.num_read_groups; i++)
+    {
+        name_offsets.push_back(name_data_size);
+        name_data_size += report.read_groups.lookup(i).size() + 1;
+    }
+    name_offsets.push_back(name_data_size);
+
+    uint64 offset = align_offset(sizeof(header));
+    header.read_groups_offset = offset;
+
+    // name offsets are relative to the start of the name data
+    offset += name_offsets.size() * sizeof(uint64) + name_data_size;
+
+    // lay out the tables
+    for(uint32 t = 0; t < NUM_RECAL_TABLES; t++)
+    {
+        auto& table = *tables[t];
+        assert(std::is_sorted(table.keys.begin(), table.keys.end()));
+
+        header.tables[t].num_rows = table.size();
+
+        offset = align_offset(offset);
+        header.tables[t].keys_offset = offset;
+        offset += table.size() * sizeof(covariate_key);
+
+        offset = align_offset(offset);
+        header.tables[t].values_offset = offset;
+        offset += table.size() * sizeof(covariate_empirical_value);
+    }
+
+    // write everything out
+    FILE *fp = fopen(fname, "wb");
+    if (fp == NULL)
+    {
+        return false;
+    }
+
+    bool ok = true;
+    offset = 0;
+
+    ok = ok && fwrite(&header, sizeof(header), 1, fp) == 1;
+    offset += sizeof(header);
+    ok = ok && write_padding(fp, offset);
+
+    ok = ok && fwrite(name_offsets.data(), sizeof(uint64), name_offsets.size(), fp) == name_offsets.size();
+    offset += name_offsets.size() * sizeof(uint64);
+
+    for(uint32 i = 0; i < header.num_read_groups; i++)
+    {
+        const std::string& name = report.read_groups.lookup(i);
+        ok = ok && fwrite(name.c_str(), 1, name.size() + 1, fp) == name.size() + 1;
+        offset += name.size() + 1;
+    }
+
+    for(uint32 t = 0; t < NUM_RECAL_TABLES; t++)
+    {
+        auto& table = *tables[t];
+
+        ok = ok && write_padding(fp, offset);
+        if (table.size())
+        {
+            ok = ok && fwrite(&table.keys[0], sizeof(covariate_key), table.size(), fp) == table.size();
+        }
+        offset += table.size() * sizeof(covariate_key);
+
+        ok = ok && write_padding(fp, offset);
+        if (table.size())
+        {
+            ok = ok && fwrite(&table.values[0], sizeof(covariate_empirical_value), table.size(), fp) == table.size();
+        }
+        offset += table.size() * sizeof(covariate_empirical_value);
+    }
+
+    if (fclose(fp) != 0)
+    {
+        ok = false;
+    }
+
+    return ok;
+}
+
+// checks that count elements of elem_size bytes starting at offset lie within a file of file_size bytes
+// sections are also required to be 8-byte aligned, as written by write_recalibration_table_file
+static bool section_fits(uint64 offset, uint64 count, uint64 elem_size, uint64 file_size)
+{
+    if (offset % 8 || offset > file_size)
+        return false;
+
+    // written as a division so that corrupt counts can't overflow
+    return count <= (file_size - offset) / elem_size;
+}
+
+// checks that the read group name offsets and data lie within the file and that each name is NUL-terminated and unique
+static bool validate_read_groups(const recalibration_table_file& file)
+{
+    const recalibration_table_file_header& header = file.header();
+
+    // there is one more offset than there are read groups
+    if (!section_fits(header.read_groups_offset, header.num_read_groups, sizeof(uint64), file.size) ||
+        (file.size - header.read_groups_offset) / sizeof(uint64) == header.num_read_groups)
+    {
+        return false;
+    }
+
+    const uint64 *name_offsets = reinterpret_cast<const uint64 *>(file.data + header.read_groups_offset);
+    const uint64 name_data_offset = header.read_groups_offset + (header.num_read_groups + 1) * sizeof(uint64);
+    const char *name_data = file.data + name_data_offset;
+    const uint64 name_data_size = file.size - name_data_offset;
+
+    std::set<std::string> names;
+
+    for(uint64 i = 0; i < header.num_read_groups; i++)
+    {
+        // names are stored back to back, each one followed by a NUL
+        if (name_offsets[i] >= name_offsets[i + 1] ||
+            name_offsets[i + 1] > name_data_size ||
+            name_data[name_offsets[i + 1] - 1] != '\0' ||
+            memchr(name_data + name_offsets[i], '\0', name_offsets[i + 1] - name_offsets[i]) != name_data + name_offsets[i + 1] - 1)
+        {
+            return false;
+        }
+
+        // read group IDs are positions in the dictionary, so a duplicate name would shift them when loaded
+        if (!names.insert(std::string(name_data + name_offsets[i])).second)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// checks that a table's keys are sorted (lookups rely on it) and refer to read groups in the dictionary
+static bool validate_keys(const recalibration_table_file& file, recalibration_table_id id)
+{
+    const recalibration_table_file_table& table = file.header().tables[id];
+    // the read group is always the last covariate in the chain
+    const recalibration_table_file_covariate& rg = table.covariates[table.num_covariates - 1];
+    const covariate_key *keys = file.keys(id);
+
+    for(uint64 i = 0; i < table.num_rows; i++)
+    {
+        if (i > 0 && keys[i] < keys[i - 1])
+            return false;
+
+        if (((uint64(keys[i]) >> rg.offset) & ((uint64(1) << rg.bits) - 1)) >= file.num_read_groups())
+            return false;
+    }
+
+    return true;
+}
+
+recalibration_table_file::recalibration_table_file()
+    : fd(-1),
+      size(0),
+      data(nullptr)
+{
+}
+
+void recalibration_table_file::close(void)
+{
+    if (data)
+    {
+        munmap((void *) data, size);
+        data = nullptr;
+    }
+
+    size = 0;
+
+    if (fd != -1)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool recalibration_table_file::open(recalibration_table_file *out, const char *fname)
+{
+    struct stat st;
+
+    out->fd = ::open(fname, O_RDONLY);
+    if (out->fd == -1)
+    {
+        fprintf(stderr, "error opening %s\n", fname);
+        return false;
+    }
+
+    if (fstat(out->fd, &st) == -1 || size_t(st.st_size) < sizeof(recalibration_table_file_header))
+    {
+        fprintf(stderr, "%s: not a recalibration table file\n", fname);
+        out->close();
+        return false;
+    }
+
+    out->size = st.st_size;
+
+    void *data = mmap(NULL, out->size, PROT_READ, MAP_SHARED, out->fd, 0);
+    if (data == MAP_FAILED)
+    {
+        perror("mmap");
+        out->close();
+        return false;
+    }
+
+    out->data = static_cast<const char *>(data);
+
+    const recalibration_table_file_header& header = out->header();
+    if (memcmp(header.magic, RECAL_TABLE_FILE_MAGIC, sizeof(RECAL_TABLE_FILE_MAGIC)) ||
+        header.version != RECAL_TABLE_FILE_VERSION)
+    {
+        fprintf(stderr, "%s: not a recalibration table file\n", fname);
+        out->close();
+        return false;
+    }
+
+    if (header.key_size != sizeof(covariate_key) ||
+        header.value_size != sizeof(covariate_empirical_value))
+    {
+        fprintf(stderr, "%s: table was written by an incompatible build (key size %u, value size %u)\n",
+                fname, header.key_size, header.value_size);
+        out->close();
+        return false;
+    }
+
+    if (!validate_read_groups(*out))
+    {
+        fprintf(stderr, "%s: corrupt read group dictionary in recalibration table file\n", fname);
+        out->close();
+        return false;
+    }
+
+    // the key layout must match this build, since keys are decoded with our own packers
+    recalibration_table_file_header expected;
+    memset(&expected, 0, sizeof(expected));
+    describe_table_layouts(expected);
+
+    for(uint32 t = 0; t < NUM_RECAL_TABLES; t++)
+    {
+        const recalibration_table_file_table& table = header.tables[t];
+
+        if (table.num_covariates != expected.tables[t].num_covariates ||
+            memcmp(table.covariates, expected.tables[t].covariates, sizeof(table.covariates)))
+        {
+            fprintf(stderr, "%s: table was written by an incompatible build (key layout mismatch)\n", fname);
+            out->close();
+            return false;
+        }
+
+        if (!section_fits(table.keys_offset, table.num_rows, sizeof(covariate_key), out->size) ||
+            !section_fits(table.values_offset, table.num_rows, sizeof(covariate_empirical_value), out->size))
+        {
+            fprintf(stderr, "%s: truncated recalibration table file\n", fname);
+            out->close();
+            return false;
+        }
+
+        if (!validate_keys(*out, recalibration_table_id(t)))
+        {
+            fprintf(stderr, "%s: corrupt keys in recalibration table file\n", fname);
+            out->close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const char *recalibration_table_file::read_group_name(uint32 id) const
+{
+    const uint64 *name_offsets = reinterpret_cast<const uint64 *>(data + header().read_groups_offset);
+    const char *name_data = reinterpret_cast<const char *>(name_offsets + num_read_groups() + 1);
+
+    return name_data + name_offsets[id];
+}
+
+const covariate_empirical_value *recalibration_table_file::lookup(recalibration_table_id table, covariate_key key) const
+{
+    const covariate_key *start = keys(table);
+    const covariate_key *end = start + num_rows(table);
+    const covariate_key *it = std::lower_bound(start, end, key);
+
+    if (it == end || *it != key)
+    {
+        return nullptr;
+    }
+
+    return values(table) + (it - start);
+}
+
+void recalibration_table_file::load(recalibration_report *out) const
+{
+    covariate_empirical_table<host> *tables[NUM_RECAL_TABLES] = {
+        &out->read_group,
+        &out->quality,
+        &out->context,
+        &out->cycle,
+    };
+
+    out->gatk4 = (header().flags & RECAL_TABLE_FILE_GATK4) != 0;
+
+    for(uint32 i = 0; i < num_read_groups(); i++)
+    {
+        out->read_groups.insert(std::string(read_group_name(i)));
+    }
+
+    for(uint32 t = 0; t < NUM_RECAL_TABLES; t++)
+    {
+        const recalibration_table_id id = recalibration_table_id(t);
+        auto& table = *tables[t];
+
+        table.resize(num_rows(id));
+        if (num_rows(id))
+        {
+            memcpy(&table.keys[0], keys(id), num_rows(id) * sizeof(covariate_key));
+            memcpy(&table.values[0], values(id), num_rows(id) * sizeof(covariate_empirical_value));
+        }
+    }
+}
+
+} // namespace firepony
@@ -0,0 +1,146 @@
+/*
+ * Firepony
+ * Copyright (c) 2014-2015, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the NVIDIA CORPORATION nor the
+ *      names of its contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NVIDIA CORPORATION BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "../types.h"
+#include "covariate_table.h"
+#include "recalibration_report.h"
+
+namespace firepony {
+
+// compact binary format for the empirical recalibration tables
+//
+// the file is meant to be mapped and queried in place:
+//   recalibration_table_file_header
+//   read group dictionary: (num_read_groups + 1) uint64 offsets into the name data, followed by the NUL-terminated names
+//   for each table: the covariate_key column, sorted in ascending order, followed by the covariate_empirical_value column
+// every section starts at an 8-byte aligned offset from the start of the file; data is stored in host byte order
+
+typedef enum {
+    RECAL_TABLE_READ_GROUP,     // RecalTable0
+    RECAL_TABLE_QUALITY,        // RecalTable1
+    RECAL_TABLE_CONTEXT,        // RecalTable2, context covariate
+    RECAL_TABLE_CYCLE,          // RecalTable2, cycle covariate
+
+    NUM_RECAL_TABLES
+} recalibration_table_id;
+
+#define RECAL_TABLE_FILE_MAGIC "FPRECAL"
+#define RECAL_TABLE_FILE_VERSION 1
+#define RECAL_TABLE_MAX_COVARIATES 8
+
+// header flags
+#define RECAL_TABLE_FILE_GATK4          1   // tables were generated with GATK4 defaults
+#define RECAL_TABLE_FILE_NO_ROUNDING    2   // text output was written without rounding
+
+// the position of one covariate in a table key
+struct recalibration_table_file_covariate
+{
+    char name[16];
+    uint32 offset;  // bit offset of the covariate value in the key
+    uint32 bits;    // number of bits in the covariate value
+};
+
+struct recalibration_table_file_table
+{
+    // the chain layout for this table, from the least significant bits up
+    // (the layout of the packer chain used to build the table; RecalTable0 keys have their quality score bits cleared)
+    uint32 num_covariates;
+    uint32 reserved;
+    recalibration_table_file_covariate covariates[RECAL_TABLE_MAX_COVARIATES];
+
+    uint64 num_rows;
+    uint64 keys_offset;
+    uint64 values_offset;
+};
+
+struct recalibration_table_file_header
+{
+    char magic[8];
+    uint32 version;
+    uint32 flags;
+    // sizes of covariate_key and covariate_empirical_value, which depend on build options
+    uint32 key_size;
+    uint32 value_size;
+
+    uint64 num_read_groups;
+    uint64 read_groups_offset;
+
+    recalibration_table_file_table tables[NUM_RECAL_TABLES];
+};
+
+// a read-only mapping of a binary recalibration table file
+struct recalibration_table_file
+{
+    int fd;
+    size_t size;
+    const char *data;
+
+    recalibration_table_file();
+    void close(void);
+
+    // map a binary table file, validating its header
+    static bool open(recalibration_table_file *out, const char *fname);
+
+    const recalibration_table_file_header& header(void) const
+    {
+        return *reinterpret_cast<const recalibration_table_file_header *>(data);
+    }
+
+    uint64 num_read_groups(void) const
+    {
+        return header().num_read_groups;
+    }
+
+    const char *read_group_name(uint32 id) const;
+
+    uint64 num_rows(recalibration_table_id table) const
+    {
+        return header().tables[table].num_rows;
+    }
+
+    const covariate_key *keys(recalibration_table_id table) const
+    {
+        return reinterpret_cast<const covariate_key *>(data + header().tables[table].keys_offset);
+    }
+
+    const covariate_empirical_value *values(recalibration_table_id table) const
+    {
+        return reinterpret_cast<const covariate_empirical_value *>(data + header().tables[table].values_offset);
+    }
+
+    // binary search for a key in a table, returns nullptr if not present
+    const covariate_empirical_value *lookup(recalibration_table_id table, covariate_key key) const;
+
+    // copies the contents of the file into a report
+    void load(recalibration_report *out) const;
+};
+
+bool write_recalibration_table_file(const char *fname, recalibration_report& report);
+
+} // namespace firepony
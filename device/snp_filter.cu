@@ -40,7 +40,7 @@
 namespace firepony {
 
 // functor used to compute the read offset list
-// for each read, fills in a list of uint16 values with the offset of each BP in the reference relative to the start of the alignment
+// for each read, fills in a list of read_coord values with the offset of each BP in the reference relative to the start of the alignment
 template <target_system system>
 struct compute_read_offset_list : public lambda<system>
 {
@@ -51,10 +51,10 @@ struct compute_read_offset_list : public lambda<system>
         const CRQ_index idx = batch.crq_index(read_index);
 
         const cigar_op *cigar = &batch.cigars[idx.cigar_start];
-        uint16 *offset_list = &ctx.read_offset_list[idx.read_start];
+        read_coord *offset_list = &ctx.read_offset_list[idx.read_start];
 
         // create a list of offsets from the base alignment position for each BP in the read
-        uint16 offset = 0;
+        read_coord offset = 0;
         for(uint32 c = 0; c < idx.cigar_len; c++)
         {
             switch(cigar[c].op)
@@ -90,7 +90,7 @@ struct compute_read_offset_list : public lambda<system>
             case cigar_op::OP_S:
                 for(uint32 i = 0; i < cigar[c].len; i++)
                 {
-                    *offset_list = uint16(-1);
+                    *offset_list = read_coord(-1);
                     offset_list++;
                 }
 
@@ -114,7 +114,6 @@ INSTANTIATE(build_read_offset_list);
 
 // functor used to compute the alignment window list
 // for each read, compute the end of the alignment window in the reference and the sequence
-// xxxnsubtil: this is very similar to cigar_coordinates_expand, should merge
 template <target_system system>
 struct compute_alignment_window : public lambda<system>
 {
@@ -123,14 +122,14 @@ struct compute_alignment_window : public lambda<system>
     CUDA_HOST_DEVICE void operator() (const uint32 read_index)
     {
         const CRQ_index idx = batch.crq_index(read_index);
-        const uint16 *offset_list = &ctx.read_offset_list[idx.read_start];
+        const read_coord *offset_list = &ctx.read_offset_list[idx.read_start];
         uint2& output = ctx.alignment_windows[read_index];
 
         // scan the offset list looking for the largest offset
         int c;
         for(c = (int) idx.read_len - 1; c >= 0; c--)
         {
-            if (offset_list[c] != uint16(-1))
+            if (offset_list[c] != read_coord(-1))
                     break;
         }
 
@@ -179,7 +178,7 @@ struct compute_vcf_ranges : public lambda<system>
         const auto& db = ctx.variant_db.get_sequence(ch);
 
         // figure out the genome alignment window for this read
-        const ushort2& reference_window_clipped = ctx.cigar.reference_window_clipped[read_index];
+        const read_coord2& reference_window_clipped = ctx.cigar.reference_window_clipped[read_index];
 
         const uint32 ref_sequence_offset = batch.alignment_start[read_index];
         const uint2 alignment_window = make_uint2(ref_sequence_offset + uint32(reference_window_clipped.x),
@@ -247,15 +246,16 @@ public:
         const auto& db = ctx.variant_db.get_sequence(batch.chromosome[read_index]);
 
         const CRQ_index& idx = batch.crq_index(read_index);
-        const ushort2& read_window_clipped = ctx.cigar.read_window_clipped[read_index];
-        const ushort2& reference_window_clipped = ctx.cigar.reference_window_clipped[read_index];
+        const read_coord2& read_window_clipped = ctx.cigar.read_window_clipped[read_index];
+        const read_coord2& reference_window_clipped = ctx.cigar.reference_window_clipped[read_index];
 
         const auto alignment_start = batch.alignment_start[read_index];
 
         uint2 vcf_db_range = ctx.snp_filter.active_vcf_ranges[read_index];
 
-        const uint32 cigar_start = ctx.cigar.cigar_offsets[idx.cigar_start];
-        const uint32 cigar_end = ctx.cigar.cigar_offsets[idx.cigar_start + idx.cigar_len];
+        const uint32 cigar_start = ctx.cigar.cigar_event_range[read_index].x;
+        const uint32 cigar_end = ctx.cigar.cigar_event_range[read_index].y;
+        auto events = ctx.cigar.events(batch, read_index);
 
         // traverse the VCF range and mark corresponding read BPs as inactive
         for(uint32 feature = vcf_db_range.x; feature <= vcf_db_range.y; feature++)
@@ -266,13 +266,13 @@ public:
 
             // locate a starting point for matching the feature along the read: search for the first read bp with a known reference coordinate inside our feature
             uint32 ev;
-            uint16 ref_coord = uint16(-1);
+            read_coord ref_coord = read_coord(-1);
 
             for(ev = cigar_start; ev < cigar_end; ev++)
             {
-                ref_coord = ctx.cigar.cigar_event_reference_coordinates[ev];
+                ref_coord = events.reference_coordinate(ev);
 
-                if (ref_coord != uint16(-1) && ref_coord >= feature_start)
+                if (ref_coord != read_coord(-1) && ref_coord >= feature_start)
                 {
                     break;
                 }
@@ -296,7 +296,7 @@ public:
                 // move backwards in the indel region to compensate
                 while(feature_bp_left && ev_feature_start > cigar_start)
                 {
-                    auto event = ctx.cigar.cigar_events[ev_feature_start];
+                    auto event = events.event(ev_feature_start);
 
                     if (event == cigar_event::S)
                     {
@@ -315,21 +315,21 @@ public:
                 }
 
                 // if we landed in an insertion region, move backwards to the beginning of the insertion region
-                while (ev_feature_start > cigar_start && ctx.cigar.cigar_events[ev_feature_start - 1] == cigar_event::I)
+                while (ev_feature_start > cigar_start && events.event(ev_feature_start - 1) == cigar_event::I)
                 {
                     ev_feature_start--;
                 }
 
                 // if the matching event has no read coordinate, move forward again until we find the first read coordinate inside the feature range
-                while (ev_feature_start < cigar_end && ctx.cigar.cigar_event_read_coordinates[ev_feature_start] == uint16(-1))
+                while (ev_feature_start < cigar_end && events.read_coordinate(ev_feature_start) == read_coord(-1))
                 {
                     ev_feature_start++;
                 }
             } else {
                 // if we didn't move backwards at all and we're in a deletion, then move backwards if the (reference) starting point for the feature is inside our clipping window
-                if (ctx.cigar.cigar_event_reference_coordinates[ev_feature_start] <= reference_window_clipped.y)
+                if (events.reference_coordinate(ev_feature_start) <= reference_window_clipped.y)
                 {
-                    while (ev_feature_start > cigar_start && ctx.cigar.cigar_events[ev_feature_start] == cigar_event::D)
+                    while (ev_feature_start > cigar_start && events.event(ev_feature_start) == cigar_event::D)
                     {
                         ev_feature_start--;
                     }
@@ -345,7 +345,7 @@ public:
             {
                 ev++;
 
-                auto event = ctx.cigar.cigar_events[ev];
+                auto event = events.event(ev);
 
                 if (event == cigar_event::S)
                 {
@@ -361,7 +361,7 @@ public:
             }
 
             // if there's no read coordinate for the matching event, move backward again until we find the last read coordinate inside the feature range
-            while(ev > cigar_start && ctx.cigar.cigar_event_read_coordinates[ev] == uint16(-1))
+            while(ev > cigar_start && events.read_coordinate(ev) == read_coord(-1))
             {
                 ev--;
             }
@@ -373,8 +373,8 @@ public:
                 continue;
             }
 
-            uint32 read_start = ctx.cigar.cigar_event_read_coordinates[ev_feature_start];
-            uint32 read_end   = ctx.cigar.cigar_event_read_coordinates[ev];
+            uint32 read_start = events.read_coordinate(ev_feature_start);
+            uint32 read_end   = events.read_coordinate(ev);
 
             if ((read_start < read_window_clipped.x && read_end < read_window_clipped.x) ||
                 (read_start > read_window_clipped.y && read_end > read_window_clipped.y))
@@ -45,6 +45,13 @@ struct snp_filter_context
     persistent_allocation<system, uint32> active_read_ids;
     // active VCF range for each read
     persistent_allocation<system, uint2> active_vcf_ranges;
+
+    // number of bytes held by this context
+    size_t footprint(footprint_tracker& tracker) const
+    {
+        return firepony::footprint(tracker, active_read_ids) +
+               firepony::footprint(tracker, active_vcf_ranges);
+    }
 };
 
 template <target_system system> void build_read_offset_list(firepony_context<system>& context, const alignment_batch<system>& batch);
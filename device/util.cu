@@ -104,6 +104,16 @@ void pack_to_1bit(packed_vector<system, 1>& dest, allocation<system, uint8>& src
 }
 INSTANTIATE(pack_to_1bit);
 
+// allocations are identified by address; the accounted buffers are members of the long-lived context
+size_t footprint_tracker::record(const void *allocation, size_t bytes)
+{
+    size_t& peak = high_water[allocation];
+    if (bytes > peak)
+        peak = bytes;
+
+    return peak;
+}
+
 // round a double to the Nth decimal place
 // this is meant to workaround broken printf() rounding in glibc
 double round_n(double val, int n)
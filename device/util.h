@@ -32,6 +32,8 @@
 
 #include "../types.h"
 
+#include <unordered_map>
+
 namespace firepony {
 
 // implements a pingpong queue between two objects
@@ -84,4 +86,28 @@ template <target_system system> void pack_to_1bit(packed_vector<system, 1>& dest
 // round a double to the Nth decimal place
 double round_n(double val, int n);
 
+// lift does not expose the capacity of an allocation, so we keep the largest size seen for each one
+// persistent allocations keep their storage when shrunk, so this is what they actually hold
+// each pipeline owns one tracker for the buffers of its context and only touches it from its own thread, so no locking is needed
+struct footprint_tracker
+{
+    std::unordered_map<const void *, size_t> high_water;
+
+    // records the current size in bytes of an allocation and returns the largest size seen for it so far
+    size_t record(const void *allocation, size_t bytes);
+};
+
+// number of bytes held by an allocation, for memory accounting
+template <target_system system, typename T>
+inline size_t footprint(footprint_tracker& tracker, const persistent_allocation<system, T>& storage)
+{
+    return tracker.record(&storage, storage.size() * sizeof(T));
+}
+
+template <target_system system, uint32 SYMBOL_SIZE_T, bool BIG_ENDIAN_T, typename IndexType>
+inline size_t footprint(footprint_tracker& tracker, const packed_vector<system, SYMBOL_SIZE_T, BIG_ENDIAN_T, IndexType>& vector)
+{
+    return tracker.record(&vector, size_t(vector.capacity()) * sizeof(uint32));
+}
+
 } // namespace firepony
@@ -0,0 +1,73 @@
+/*
+ * Firepony
+ * Copyright (c) 2014-2015, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the NVIDIA CORPORATION nor the
+ *      names of its contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NVIDIA CORPORATION BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "command_line.h"
+#include "output.h"
+
+#include "device/recalibration_report.h"
+#include "device/recalibration_table_file.h"
+
+using namespace firepony;
+
+// converts a binary recalibration table file (see firepony --binary-output) into GATKReport text
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 3)
+    {
+        fprintf(stderr, "usage: %s <binary-table-file> [<output-file-name>]\n", argv[0]);
+        exit(1);
+    }
+
+    recalibration_table_file file;
+    if (!recalibration_table_file::open(&file, argv[1]))
+    {
+        fprintf(stderr, "could not load %s\n", argv[1]);
+        exit(1);
+    }
+
+    if (argc == 3)
+    {
+        if (!output_open_file(argv[2]))
+        {
+            exit(1);
+        }
+    }
+
+    recalibration_report report;
+    file.load(&report);
+
+    // reproduce the rounding setting of the run that wrote the tables
+    command_line_options.disable_output_rounding = (file.header().flags & RECAL_TABLE_FILE_NO_ROUNDING) != 0;
+
+    output_recalibration_report(report);
+
+    file.close();
+    return 0;
+}
@@ -40,12 +40,16 @@
 #include "io_thread.h"
 #include "string_database.h"
 #include "output.h"
+#include "alignment_writer.h"
 
 #include "loader/alignments.h"
 #include "loader/reference.h"
 #include "loader/variants.h"
 
 #include "device/pipeline.h"
+#include "device/recalibrate.h"
+#include "device/recalibration_report.h"
+#include "device/recalibration_table_file.h"
 #include "variant_database.h"
 
 #include "version.h"
@@ -199,122 +203,78 @@ static void print_statistics(timer<host>& wall_clock, const pipeline_statistics&
     fprintf(stderr, "   cigar expansion: %.4f (%.2f%%)\n", stats.cigar_expansion.elapsed_time, stats.cigar_expansion.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
     fprintf(stderr, "   bp filtering: %.4f (%.2f%%)\n", stats.bp_filter.elapsed_time, stats.bp_filter.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
     fprintf(stderr, "   snp filtering: %.4f (%.2f%%)\n", stats.snp_filter.elapsed_time, stats.snp_filter.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
-    fprintf(stderr, "   baq: %.4f (%.2f%%)\n", stats.baq.elapsed_time, stats.baq.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
-    fprintf(stderr, "     setup: %.4f (%.2f%%)\n", stats.baq_setup.elapsed_time, stats.baq_setup.elapsed_time / stats.baq.elapsed_time * 100.0 / num_devices);
-    fprintf(stderr, "     hmm: %.4f (%.2f%%)\n", stats.baq_hmm.elapsed_time, stats.baq_hmm.elapsed_time / stats.baq.elapsed_time * 100.0 / num_devices);
 
-#if BAQ_HMM_SPLIT_PHASE
-    fprintf(stderr, "       forward: %.4f (%.2f%%)\n", stats.baq_hmm_forward.elapsed_time, stats.baq_hmm_forward.elapsed_time / stats.baq.elapsed_time * 100.0 / num_devices);
-    fprintf(stderr, "       backward: %.4f (%.2f%%)\n", stats.baq_hmm_backward.elapsed_time, stats.baq_hmm_backward.elapsed_time / stats.baq.elapsed_time * 100.0 / num_devices);
-    fprintf(stderr, "       map: %.4f (%.2f%%)\n", stats.baq_hmm_map.elapsed_time, stats.baq_hmm_map.elapsed_time / stats.baq.elapsed_time * 100.0 / num_devices);
-#endif
-
-    fprintf(stderr, "     post: %.4f (%.2f%%)\n", stats.baq_postprocess.elapsed_time, stats.baq_postprocess.elapsed_time / stats.baq.elapsed_time * 100.0 / num_devices);
-    fprintf(stderr, "   fractional error: %.4f (%.2f%%)\n", stats.fractional_error.elapsed_time, stats.fractional_error.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
-    fprintf(stderr, "   covariates: %.4f (%.2f%%)\n", stats.covariates.elapsed_time, stats.covariates.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
-    fprintf(stderr, "     gather: %.4f (%.2f%%)\n", stats.covariates_gather.elapsed_time, stats.covariates_gather.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
-    fprintf(stderr, "     filter: %.4f (%.2f%%)\n", stats.covariates_filter.elapsed_time, stats.covariates_filter.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
-    fprintf(stderr, "     sort: %.4f (%.2f%%)\n", stats.covariates_sort.elapsed_time, stats.covariates_sort.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
-    fprintf(stderr, "     pack: %.4f (%.2f%%)\n", stats.covariates_pack.elapsed_time, stats.covariates_pack.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
-    fprintf(stderr, "   post-processing: %.4f (%.2f%%)\n", stats.postprocessing.elapsed_time, stats.postprocessing.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
-    fprintf(stderr, "   output: %.4f (%.2f%%)\n", stats.output.elapsed_time, stats.output.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
-    fprintf(stderr, "   batches: %lu (%.2f batches/sec)\n", stats.num_batches, stats.num_batches / wall_clock.elapsed_time());
-    fprintf(stderr, "   reads: %lu (%.2fK reads/sec)\n", stats.total_reads, stats.total_reads / 1000.0 / wall_clock.elapsed_time());
-}
-
-int main(int argc, char **argv)
-{
-    std::vector<firepony_pipeline *> compute_devices;
-
-    reference_file_handle *ref_h;
-    variant_database_host h_dbsnp;
-    bool ret;
-
-    fprintf(stderr, "Firepony v%d.%d.%d\n", FIREPONY_VERSION_MAJOR, FIREPONY_VERSION_MINOR, FIREPONY_VERSION_REV);
-    parse_command_line(argc, argv);
-
-    if (command_line_options.verbose)
+    if (!command_line_options.gatk4)
     {
-        output_build_info();
-    }
+        fprintf(stderr, "   baq: %.4f (%.2f%%)\n", stats.baq.elapsed_time, stats.baq.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
+        fprintf(stderr, "     setup: %.4f (%.2f%%)\n", stats.baq_setup.elapsed_time, stats.baq_setup.elapsed_time / stats.baq.elapsed_time * 100.0 / num_devices);
+        fprintf(stderr, "     hmm: %.4f (%.2f%%)\n", stats.baq_hmm.elapsed_time, stats.baq_hmm.elapsed_time / stats.baq.elapsed_time * 100.0 / num_devices);
 
-    if (command_line_options.enable_cuda)
-    {
-        std::string runtime_version;
-        if (cuda_runtime_init(runtime_version) == true)
+        if (stats.baq_hmm_forward.elapsed_time > 0.0)
         {
-            fprintf(stderr, "CUDA runtime version %s\n", runtime_version.c_str());
+            fprintf(stderr, "       forward: %.4f (%.2f%%)\n", stats.baq_hmm_forward.elapsed_time, stats.baq_hmm_forward.elapsed_time / stats.baq.elapsed_time * 100.0 / num_devices);
+            fprintf(stderr, "       backward: %.4f (%.2f%%)\n", stats.baq_hmm_backward.elapsed_time, stats.baq_hmm_backward.elapsed_time / stats.baq.elapsed_time * 100.0 / num_devices);
+            fprintf(stderr, "       map: %.4f (%.2f%%)\n", stats.baq_hmm_map.elapsed_time, stats.baq_hmm_map.elapsed_time / stats.baq.elapsed_time * 100.0 / num_devices);
         }
-    }
-
-    compute_devices = enumerate_compute_devices();
 
-    if (compute_devices.size() == 0)
-    {
-        fprintf(stderr, "failed to initialize compute backend\n");
-        exit(1);
-    }
-
-    fprintf(stderr, "enabled compute devices:\n");
-    for(auto d : compute_devices)
-    {
-        fprintf(stderr, "  %s\n", d->get_name().c_str());
-    }
-    fprintf(stderr, "\n");
-
-    if (command_line_options.batch_size == uint32(-1))
-    {
-        command_line_options.batch_size = choose_batch_size(compute_devices);
-    }
-
-    if (command_line_options.output)
-    {
-        bool ret;
-        ret = output_open_file(command_line_options.output);
-        if (ret == false)
+        if (stats.baq_hmm_fused.elapsed_time > 0.0)
         {
-            exit(1);
+            // the fused HMM runs every phase of a read before moving on, so its phases can't be timed separately
+            fprintf(stderr, "       fused, not split by phase: %.4f (%.2f%%)\n", stats.baq_hmm_fused.elapsed_time, stats.baq_hmm_fused.elapsed_time / stats.baq.elapsed_time * 100.0 / num_devices);
         }
-    }
 
-    if (command_line_options.verbose)
-    {
-        fprintf(stderr, "original command line: ");
-        for(int i = 1; i < argc; i++)
+        if (command_line_options.baq_validate_precision)
         {
-            fprintf(stderr, "%s ", argv[i]);
+            fprintf(stderr, "       precision validation: %lu bases, %lu differing qualities\n", stats.baq_validated_bases, stats.baq_validation_mismatches);
+            fprintf(stderr, "       host SIMD lane validation: %lu differing qualities\n", stats.baq_lane_mismatches);
         }
-        fprintf(stderr, "\n");
-
-        fprintf(stderr, "computed command line: %s\n", canonical_command_line().c_str());
-        fprintf(stderr, "\n");
-    }
 
-    timer<host> data_io;
-    data_io.start();
-
-    // load the reference genome
-    ref_h = reference_file_handle::open(command_line_options.reference, compute_devices.size(), command_line_options.try_mmap);
-
-    if (ref_h == nullptr)
-    {
-        fprintf(stderr, "failed to load reference %s\n", command_line_options.reference);
-        exit(1);
+        fprintf(stderr, "     post: %.4f (%.2f%%)\n", stats.baq_postprocess.elapsed_time, stats.baq_postprocess.elapsed_time / stats.baq.elapsed_time * 100.0 / num_devices);
     }
 
-    fprintf(stderr, "loading variant database %s...", command_line_options.snp_database);
-    fflush(stderr);
-    ret = load_vcf(&h_dbsnp, ref_h, command_line_options.snp_database, command_line_options.try_mmap);
-    fprintf(stderr, "\n");
-
-    if (ret == false)
+    fprintf(stderr, "   fractional error: %.4f (%.2f%%)\n", stats.fractional_error.elapsed_time, stats.fractional_error.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
+    fprintf(stderr, "   covariates: %.4f (%.2f%%)\n", stats.covariates.elapsed_time, stats.covariates.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
+    fprintf(stderr, "     gather: %.4f (%.2f%%)\n", stats.covariates_gather.elapsed_time, stats.covariates_gather.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
+    fprintf(stderr, "     filter: %.4f (%.2f%%)\n", stats.covariates_filter.elapsed_time, stats.covariates_filter.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
+    fprintf(stderr, "     sort: %.4f (%.2f%%)\n", stats.covariates_sort.elapsed_time, stats.covariates_sort.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
+    fprintf(stderr, "     pack: %.4f (%.2f%%)\n", stats.covariates_pack.elapsed_time, stats.covariates_pack.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
+    fprintf(stderr, "     hash: %.4f (%.2f%%)\n", stats.covariates_hash.elapsed_time, stats.covariates_hash.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
+    fprintf(stderr, "     merge: %.4f (%.2f%%)\n", stats.covariates_merge.elapsed_time, stats.covariates_merge.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
+    fprintf(stderr, "   post-processing: %.4f (%.2f%%)\n", stats.postprocessing.elapsed_time, stats.postprocessing.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
+    fprintf(stderr, "   output: %.4f (%.2f%%)\n", stats.output.elapsed_time, stats.output.elapsed_time / wall_clock.elapsed_time() * 100.0 / num_devices);
+    fprintf(stderr, "   batches: %lu (%.2f batches/sec)\n", stats.num_batches, stats.num_batches / wall_clock.elapsed_time());
+    fprintf(stderr, "   reads: %lu (%.2fK reads/sec)\n", stats.total_reads, stats.total_reads / 1000.0 / wall_clock.elapsed_time());
+    fprintf(stderr, "   temporary buffers: %lu requests, %lu allocations, %.2f MB high-water\n", stats.pool_requests, stats.pool_allocations, stats.pool_high_water / (1024.0 * 1024.0));
+
+    const double MB = 1024.0 * 1024.0;
+    fprintf(stderr, "   peak memory by stage (MB):\n");
+    fprintf(stderr, "     read filtering: %.2f\n", stats.memory_read_filter.peak / MB);
+    fprintf(stderr, "     cigar expansion: %.2f\n", stats.memory_cigar_expansion.peak / MB);
+    fprintf(stderr, "     bp filtering: %.2f\n", stats.memory_bp_filter.peak / MB);
+    fprintf(stderr, "     snp filtering: %.2f\n", stats.memory_snp_filter.peak / MB);
+    if (!command_line_options.gatk4)
     {
-        fprintf(stderr, "failed to load variant database %s\n", command_line_options.snp_database);
-        exit(1);
+        fprintf(stderr, "     baq: %.2f\n", stats.memory_baq_stage.peak / MB);
     }
+    fprintf(stderr, "     fractional error: %.2f\n", stats.memory_fractional_error_stage.peak / MB);
+    fprintf(stderr, "     covariates: %.2f\n", stats.memory_covariates_stage.peak / MB);
+    fprintf(stderr, "   peak memory by buffer (MB):\n");
+    fprintf(stderr, "     cigar: %.2f\n", stats.memory_cigar.peak / MB);
+    fprintf(stderr, "     baq: %.2f\n", stats.memory_baq.peak / MB);
+    fprintf(stderr, "     fractional error: %.2f\n", stats.memory_fractional_error.peak / MB);
+    fprintf(stderr, "     covariates: %.2f\n", stats.memory_covariates.peak / MB);
+    fprintf(stderr, "     scratch: %.2f\n", stats.memory_scratch.peak / MB);
+}
 
-    data_io.stop();
-
+// computes the recalibration tables for the input file and writes them out
+// if spill_fname is not null, an uncompressed copy of the input is written there as it is read
+static void compute_recalibration_report(std::vector<firepony_pipeline *>& compute_devices,
+                                         reference_file_handle *ref_h,
+                                         variant_database_host *h_dbsnp,
+                                         timer<host>& data_io,
+                                         const char *spill_fname,
+                                         recalibration_report& report)
+{
     const uint32 data_mask = AlignmentDataMask::NAME |
                              AlignmentDataMask::CHROMOSOME |
                              AlignmentDataMask::ALIGNMENT_START |
@@ -329,6 +289,12 @@ int main(int argc, char **argv)
                              AlignmentDataMask::READ_GROUP;
 
     io_thread reader(command_line_options.input, data_mask, compute_devices.size(), ref_h);
+    if (spill_fname)
+    {
+        // keep an uncompressed copy of the input around for the recalibration pass
+        reader.file.spill_to(spill_fname);
+    }
+
     if (reader.start() == false)
     {
         exit(1);
@@ -340,7 +306,7 @@ int main(int argc, char **argv)
                  &command_line_options,
                  &reader.file.header,
                  &ref_h->sequence_data,
-                 &h_dbsnp);
+                 h_dbsnp);
     }
 
     fprintf(stderr, "processing file %s...\n", command_line_options.input);
@@ -371,7 +337,7 @@ int main(int argc, char **argv)
         }
     }
 
-    d->postprocess();
+    d->postprocess(report);
 
     wall_clock.stop();
 
@@ -387,11 +353,35 @@ int main(int argc, char **argv)
             aggregate_stats.total_reads,
             float(aggregate_stats.filtered_reads) / float(aggregate_stats.total_reads) * 100.0);
 
+    for(uint32 i = 0; i < NUM_READ_FILTERS; i++)
+    {
+        if (aggregate_stats.read_filter_rejections[i])
+        {
+            fprintf(stderr, "  %lu reads (%f%%) failed %s\n",
+                    aggregate_stats.read_filter_rejections[i],
+                    float(aggregate_stats.read_filter_rejections[i]) / float(aggregate_stats.total_reads) * 100.0,
+                    read_filter_name(i));
+        }
+    }
+
     fprintf(stderr, "computed base alignment quality for %lu reads out of %lu (%f%%)\n",
             aggregate_stats.baq_reads,
             aggregate_stats.total_reads - aggregate_stats.filtered_reads,
             float(aggregate_stats.baq_reads) / float(aggregate_stats.total_reads - aggregate_stats.filtered_reads) * 100.0);
 
+    if (command_line_options.baq_max_read_length)
+    {
+        fprintf(stderr, "skipped base alignment quality for %lu reads longer than %u bases\n",
+                aggregate_stats.baq_skipped_reads,
+                command_line_options.baq_max_read_length);
+    }
+
+    if (aggregate_stats.cycle_limited_reads)
+    {
+        fprintf(stderr, "%lu reads are longer than the cycle covariate allows (%d cycles); their later cycles were not recorded\n",
+                aggregate_stats.cycle_limited_reads, CYCLE_COVARIATE_MAX);
+    }
+
     fprintf(stderr, "\n");
 
     fprintf(stderr, "wall clock times:\n");
@@ -418,6 +408,237 @@ int main(int argc, char **argv)
     fprintf(stderr, "\n");
 
     reader.join();
+}
+
+// loads the tables given with --apply
+static void load_recalibration_report(recalibration_report& report)
+{
+    recalibration_table_file file;
+
+    if (!recalibration_table_file::open(&file, command_line_options.apply_table))
+    {
+        fprintf(stderr, "failed to load recalibration tables %s\n", command_line_options.apply_table);
+        exit(1);
+    }
+
+    file.load(&report);
+    file.close();
+}
+
+// rewrites the base qualities in input with the tables in report and writes the result to the recalibrated output file
+static void write_recalibrated_alignments(std::vector<firepony_pipeline *>& compute_devices,
+                                          reference_file_handle *ref_h,
+                                          variant_database_host *h_dbsnp,
+                                          recalibration_report& report,
+                                          const char *input)
+{
+    const uint32 data_mask = AlignmentDataMask::CIGAR |
+                             AlignmentDataMask::READS |
+                             AlignmentDataMask::QUALITIES |
+                             AlignmentDataMask::FLAGS |
+                             AlignmentDataMask::READ_GROUP |
+                             AlignmentDataMask::RECORD;
+
+    io_thread reader(input, data_mask, compute_devices.size(), ref_h);
+
+    // the read group covariate values in the tables are read group IDs; make sure the reader assigns the same ones
+    for(uint32 i = 0; i < report.read_groups.size(); i++)
+    {
+        reader.file.header.read_groups_db.insert(report.read_groups.lookup(i));
+    }
+
+    if (reader.start() == false)
+    {
+        exit(1);
+    }
+
+    alignment_writer writer;
+    if (writer.open(command_line_options.recalibrated_output, reader.file, command_line_options.output_threads) == false)
+    {
+        exit(1);
+    }
+
+    recalibration_tables<host> tables;
+    build_recalibration_tables(tables, report);
+
+    for(auto d : compute_devices)
+    {
+        if (command_line_options.apply_table)
+        {
+            // we didn't compute the tables, so the pipelines haven't been set up yet
+            d->setup(&reader,
+                     &command_line_options,
+                     &reader.file.header,
+                     &ref_h->sequence_data,
+                     h_dbsnp);
+        }
+
+        d->setup_recalibration(&reader, &writer, &tables);
+
+        // the statistics for the pass that computed the tables have already been reported
+        d->statistics() = pipeline_statistics();
+    }
+
+    fprintf(stderr, "writing recalibrated alignments to %s...\n", command_line_options.recalibrated_output);
+
+    timer<host> wall_clock;
+
+    wall_clock.start();
+
+    for(auto d : compute_devices)
+    {
+        d->start();
+    }
+
+    for(auto d : compute_devices)
+    {
+        d->join();
+    }
+
+    writer.close();
+    wall_clock.stop();
+
+    reader.join();
+
+    pipeline_statistics aggregate_stats;
+    for(auto d : compute_devices)
+    {
+        aggregate_stats += d->statistics();
+    }
+
+    fprintf(stderr, "\n");
+    fprintf(stderr, "recalibrated %lu reads in %f seconds (%.2fK reads/sec)\n",
+            writer.num_reads, wall_clock.elapsed_time(), writer.num_reads / 1000.0 / wall_clock.elapsed_time());
+    fprintf(stderr, "   blocked on io: %.4f\n", aggregate_stats.io.elapsed_time);
+    fprintf(stderr, "   recalibration: %.4f\n", aggregate_stats.recalibration.elapsed_time);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<firepony_pipeline *> compute_devices;
+
+    reference_file_handle *ref_h;
+    variant_database_host h_dbsnp;
+    bool ret;
+
+    fprintf(stderr, "Firepony v%d.%d.%d\n", FIREPONY_VERSION_MAJOR, FIREPONY_VERSION_MINOR, FIREPONY_VERSION_REV);
+    parse_command_line(argc, argv);
+
+    if (command_line_options.verbose)
+    {
+        output_build_info();
+    }
+
+    if (command_line_options.enable_cuda)
+    {
+        std::string runtime_version;
+        if (cuda_runtime_init(runtime_version) == true)
+        {
+            fprintf(stderr, "CUDA runtime version %s\n", runtime_version.c_str());
+        }
+    }
+
+    compute_devices = enumerate_compute_devices();
+
+    if (compute_devices.size() == 0)
+    {
+        fprintf(stderr, "failed to initialize compute backend\n");
+        exit(1);
+    }
+
+    fprintf(stderr, "enabled compute devices:\n");
+    for(auto d : compute_devices)
+    {
+        fprintf(stderr, "  %s\n", d->get_name().c_str());
+    }
+    fprintf(stderr, "\n");
+
+    if (command_line_options.batch_size == uint32(-1))
+    {
+        command_line_options.batch_size = choose_batch_size(compute_devices);
+    }
+
+    if (command_line_options.output)
+    {
+        bool ret;
+        ret = output_open_file(command_line_options.output);
+        if (ret == false)
+        {
+            exit(1);
+        }
+    }
+
+    if (command_line_options.verbose)
+    {
+        fprintf(stderr, "original command line: ");
+        for(int i = 1; i < argc; i++)
+        {
+            fprintf(stderr, "%s ", argv[i]);
+        }
+        fprintf(stderr, "\n");
+
+        fprintf(stderr, "computed command line: %s\n", canonical_command_line().c_str());
+        fprintf(stderr, "\n");
+    }
+
+    timer<host> data_io;
+    data_io.start();
+
+    // load the reference genome
+    ref_h = reference_file_handle::open(command_line_options.reference, compute_devices.size(), command_line_options.try_mmap);
+
+    if (ref_h == nullptr)
+    {
+        fprintf(stderr, "failed to load reference %s\n", command_line_options.reference);
+        exit(1);
+    }
+
+    // the variant database is only needed to compute the tables
+    if (command_line_options.apply_table == nullptr)
+    {
+        fprintf(stderr, "loading variant database %s...", command_line_options.snp_database);
+        fflush(stderr);
+        ret = load_vcf(&h_dbsnp, ref_h, command_line_options.snp_database, command_line_options.try_mmap);
+        fprintf(stderr, "\n");
+
+        if (ret == false)
+        {
+            fprintf(stderr, "failed to load variant database %s\n", command_line_options.snp_database);
+            exit(1);
+        }
+    }
+
+    data_io.stop();
+
+    recalibration_report report;
+
+    // the uncompressed copy of the input that the recalibration pass reads from when we compute the tables first
+    std::string spill_fname;
+    if (command_line_options.recalibrated_output && command_line_options.apply_table == nullptr)
+    {
+        spill_fname = std::string(command_line_options.recalibrated_output) + ".spill";
+    }
+
+    if (command_line_options.apply_table)
+    {
+        load_recalibration_report(report);
+    } else {
+        compute_recalibration_report(compute_devices, ref_h, &h_dbsnp, data_io,
+                                     spill_fname.size() ? spill_fname.c_str() : nullptr,
+                                     report);
+    }
+
+    if (command_line_options.recalibrated_output)
+    {
+        write_recalibrated_alignments(compute_devices, ref_h, &h_dbsnp, report,
+                                      spill_fname.size() ? spill_fname.c_str() : command_line_options.input);
+
+        if (spill_fname.size())
+        {
+            remove(spill_fname.c_str());
+        }
+    }
 
     return 0;
 }
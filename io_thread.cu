@@ -34,6 +34,7 @@
 #include "command_line.h"
 #include "output.h"
 
+#include <algorithm>
 #include <mutex>
 #include <condition_variable>
 
@@ -45,7 +46,10 @@ io_thread::io_thread(const char *fname, uint32 data_mask, const int consumers, r
     : NUM_BUFFERS(consumers + 1),
       file(fname),
       data_mask(data_mask),
-      reference(reference)
+      reference(reference),
+      footprint_scale(FOOTPRINT_INITIAL_SCALE),
+      footprint_measured(false),
+      resident_footprint(0)
 {
     for(int i = 0; i < NUM_BUFFERS; i++)
     {
@@ -94,6 +98,74 @@ void io_thread::retire_batch(alignment_batch_host *buffer)
     sem_producer.post();
 }
 
+void io_thread::report_footprint(const alignment_batch_host *batch, uint64 measured_footprint, uint64 resident)
+{
+    if (batch->footprint_estimate == 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(footprint_mutex);
+
+    if (resident > resident_footprint)
+    {
+        resident_footprint = resident;
+    }
+
+    // the first measurement replaces the initial guess, even if it is smaller
+    const double scale = double(measured_footprint) / double(batch->footprint_estimate);
+    if (!footprint_measured || scale > footprint_scale)
+    {
+        footprint_scale = scale;
+    }
+
+    footprint_measured = true;
+}
+
+// describes how the pipeline options change the working memory of a read
+footprint_model io_thread::make_footprint_model(void)
+{
+    footprint_model model;
+
+    // this follows the precision selection in baq_reads
+    const bool use_double = !command_line_options.baq_single_precision || command_line_options.baq_validate_precision;
+    const bool use_single = command_line_options.baq_single_precision || command_line_options.baq_validate_precision;
+
+    if (command_line_options.gatk4)
+    {
+        // GATK4 mode doesn't run BAQ
+        model.hmm_cell_bytes = 0;
+    } else {
+        model.hmm_cell_bytes = (use_double ? sizeof(double) : 0) + (use_single ? sizeof(float) : 0);
+    }
+
+    model.checkpoint_interval = command_line_options.baq_checkpoint_interval;
+    model.baq_max_read_length = command_line_options.baq_max_read_length;
+
+    return model;
+}
+
+// loads the next batch, closing it early if needed to keep within the memory budget
+bool io_thread::next_batch(alignment_batch_host *batch)
+{
+    uint64 max_footprint = 0;
+
+    if (command_line_options.max_memory)
+    {
+        std::lock_guard<std::mutex> lock(footprint_mutex);
+
+        // only the part of the budget not already held by the consumers is available for the batch
+        // until a batch has been measured (which covers the NUM_BUFFERS batches that prime the queue in run()),
+        // hold back part of the budget for them instead
+        const uint64 resident = (footprint_measured ? resident_footprint : uint64(command_line_options.max_memory * FOOTPRINT_INITIAL_RESERVE));
+        const uint64 available = (command_line_options.max_memory > resident ?
+                                  command_line_options.max_memory - resident : 0);
+
+        // a zero max_footprint would disable the budget; the loader always takes at least one read
+        max_footprint = std::max(uint64(available / footprint_scale), uint64(1));
+    }
+
+    return file.next_batch(batch, data_mask, reference, command_line_options.batch_size, max_footprint, make_footprint_model());
+}
+
 void io_thread::run(void)
 {
     alignment_batch_host *buf;
@@ -108,12 +180,13 @@ void io_thread::run(void)
         assert(empty_batches.size());
         buf = empty_batches.pop();
 
-        eof = !(file.next_batch(buf, data_mask, reference, command_line_options.batch_size));
+        eof = !(next_batch(buf));
         if (eof)
         {
             break;
         }
 
+        buf->batch_index = batch_counter;
         batches.push(buf);
         batch_counter++;
         sem_consumer.post();
@@ -129,9 +202,10 @@ void io_thread::run(void)
         assert(empty_batches.size());
         buf = empty_batches.pop();
 
-        eof = !(file.next_batch(buf, data_mask, reference, command_line_options.batch_size));
+        eof = !(next_batch(buf));
         if (!eof)
         {
+            buf->batch_index = batch_counter;
             batches.push(buf);
             batch_counter++;
             sem_consumer.post();
@@ -40,6 +40,11 @@
 
 namespace firepony {
 
+// until a consumer has measured a batch, the loader's footprint estimate is multiplied by this factor
+// and this fraction of the memory budget is held back for the batch-independent buffers
+#define FOOTPRINT_INITIAL_SCALE 2.0
+#define FOOTPRINT_INITIAL_RESERVE 0.5
+
 struct semaphore
 {
     std::mutex sem_mutex;
@@ -115,6 +120,15 @@ struct io_thread
     alignment_file file;
     uint32 data_mask;
 
+    // ratio between the measured and the estimated working memory of a batch (the largest seen so far)
+    // used to correct the loader's footprint estimate when running under a memory budget
+    double footprint_scale;
+    // set once a consumer has reported a measurement; until then footprint_scale holds the conservative initial guess
+    bool footprint_measured;
+    // largest batch-independent footprint reported by a consumer, taken off the budget before sizing batches
+    uint64 resident_footprint;
+    std::mutex footprint_mutex;
+
     std::thread thread;
 
     io_thread(const char *fname, uint32 data_mask, const int consumers, reference_file_handle *reference);
@@ -126,8 +140,14 @@ struct io_thread
     alignment_batch_host *get_batch(void);
     void retire_batch(alignment_batch_host *batch);
 
+    // called by consumers with the peak working memory measured while processing a batch,
+    // along with the memory they hold regardless of batch size
+    void report_footprint(const alignment_batch_host *batch, uint64 measured_footprint, uint64 resident);
+
 private:
     void run(void);
+    footprint_model make_footprint_model(void);
+    bool next_batch(alignment_batch_host *batch);
 };
 
 } // namespace firepony
@@ -29,6 +29,7 @@
  */
 
 #include <string>
+#include <algorithm>
 
 #include <htslib/hfile.h>
 #include <htslib/bgzf.h>
@@ -125,7 +126,10 @@ alignment_file::alignment_file(const char *fname)
     : fname(fname),
       fp(nullptr),
       bam_header(nullptr),
-      data(nullptr)
+      data(nullptr),
+      pending_read(false),
+      spill_fname(nullptr),
+      spill_fp(nullptr)
 {
 }
 
@@ -194,9 +198,33 @@ bool alignment_file::init(void)
         header.chromosome_lengths.push_back(bam_header->target_len[i]);
     }
 
+    if (spill_fname)
+    {
+        spill_fp = hts_open(spill_fname, "wbu");
+        if (spill_fp == nullptr || sam_hdr_write(spill_fp, bam_header) < 0)
+        {
+            fprintf(stderr, "error opening spill file %s\n", spill_fname);
+            return false;
+        }
+    }
+
     return true;
 }
 
+void alignment_file::spill_to(const char *fname)
+{
+    spill_fname = fname;
+}
+
+void alignment_file::close_spill(void)
+{
+    if (spill_fp)
+    {
+        hts_close(spill_fp);
+        spill_fp = nullptr;
+    }
+}
+
 static uint8 htslib_to_firepony_cigar_op(uint32 e)
 {
     // lowest 4 bits contain cigar op
@@ -254,7 +282,73 @@ static uint32 extract_htslib_flags(bam1_t *data)
     return flags;
 }
 
-bool alignment_file::next_batch(alignment_batch_host *batch, uint32 data_mask, reference_file_handle *reference, const uint32 batch_size)
+// number of query bases covered by the alignment, i.e., the read length without soft clips
+static uint32 aligned_query_length(const bam1_t *data)
+{
+    const uint32 *cigar = bam_get_cigar(data);
+    uint32 len = 0;
+
+    for(uint32 i = 0; i < data->core.n_cigar; i++)
+    {
+        const uint32 op = bam_cigar_op(cigar[i]);
+
+        // bit 0 of the type is set for operations that consume query bases
+        if ((bam_cigar_type(op) & 1) && op != BAM_CSOFT_CLIP)
+        {
+            len += bam_cigar_oplen(cigar[i]);
+        }
+    }
+
+    return len;
+}
+
+// rough estimate of the pipeline working memory required for a read, used to size batches under a memory budget
+// this is dominated by the BAQ forward and backward matrices, which hold a row of (bandwidth * 2 + 1) * 3 + 6 cells for each aligned base plus one,
+// or fewer rows when checkpointing (this follows hmm_read_state::matrix_size);
+// the HMM band is 7 wide unless the read and reference lengths differ by more than that
+// the remaining per-base arrays (reads, qualities, offsets, error vectors, covariate observations) are folded into a flat per-base cost
+// the pipeline measures its actual footprint and io_thread scales this estimate accordingly
+static uint64 estimate_read_footprint(const bam1_t *data, const footprint_model& model)
+{
+    const uint32 read_len = data->core.l_qseq;
+    const uint32 per_base_bytes = 128;
+
+    uint64 ret = uint64(read_len) * per_base_bytes;
+
+    if (model.hmm_cell_bytes == 0)
+        return ret;
+
+    // the HMM only runs over the aligned part of the read
+    const uint32 query_len = aligned_query_length(data);
+    if (model.baq_max_read_length && query_len > model.baq_max_read_length)
+        return ret;
+
+    const uint32 reference_len = bam_cigar2rlen(data->core.n_cigar, bam_get_cigar(data));
+    const uint32 length_difference = (query_len > reference_len ? query_len - reference_len : reference_len - query_len);
+    uint32 bandwidth = std::max(query_len, reference_len);
+
+    if (bandwidth > 7)
+        bandwidth = 7;
+
+    if (bandwidth < length_difference)
+        bandwidth = length_difference;
+
+    const uint64 hmm_row = (bandwidth * 2 + 1) * 3 + 6;
+    uint64 hmm_rows = query_len + 1;
+
+    if (model.checkpoint_interval)
+    {
+        const uint32 segment_rows = std::min(model.checkpoint_interval, query_len + 1);
+        hmm_rows = query_len / model.checkpoint_interval + 1 + segment_rows + 2;
+    }
+
+    // forward and backward matrices plus the per-row scaling factors
+    ret += (2 * hmm_rows * hmm_row + query_len + 2) * model.hmm_cell_bytes;
+    return ret;
+}
+
+bool alignment_file::next_batch(alignment_batch_host *batch, uint32 data_mask, reference_file_handle *reference, const uint32 batch_size, const uint64 max_footprint,
+                                const footprint_model& model)
 {
     uint32 read_id;
 
@@ -262,11 +356,39 @@ bool alignment_file::next_batch(alignment_batch_host *batch, uint32 data_mask, r
 
     for(read_id = 0; read_id < batch_size; read_id++)
     {
-        int ret;
-        ret = sam_read1(fp, bam_header, data);
-        if (ret < 0)
+        if (pending_read)
         {
-            break;
+            // the record left over from the previous batch is already in data
+            pending_read = false;
+        } else {
+            int ret;
+            ret = sam_read1(fp, bam_header, data);
+            if (ret < 0)
+            {
+                // the spill file is complete once we hit the end of the input
+                close_spill();
+                break;
+            }
+
+            if (spill_fp && sam_write1(spill_fp, bam_header, data) < 0)
+            {
+                fprintf(stderr, "ERROR: failed writing to spill file %s\n", spill_fname);
+                exit(1);
+            }
+        }
+
+        if (max_footprint)
+        {
+            const uint64 footprint = estimate_read_footprint(data, model);
+
+            if (read_id > 0 && batch->footprint_estimate + footprint > max_footprint)
+            {
+                // this read doesn't fit; keep it for the next batch
+                pending_read = true;
+                break;
+            }
+
+            batch->footprint_estimate += footprint;
         }
 
         batch->num_reads++;
@@ -428,6 +550,17 @@ bool alignment_file::next_batch(alignment_batch_host *batch, uint32 data_mask, r
                 }
             }
         }
+
+        if (data_mask & AlignmentDataMask::RECORD)
+        {
+            // hand the record over to the batch and take one of its spare records to read into next
+            if (read_id == batch->records.size())
+            {
+                batch->records.push_back(bam_init1());
+            }
+
+            std::swap(batch->records[read_id], data);
+        }
     }
 
     if (read_id == 0)
@@ -40,6 +40,23 @@
 
 namespace firepony {
 
+// pipeline settings that change how much working memory a read needs, used to size batches under a memory budget
+struct footprint_model
+{
+    // bytes per HMM matrix cell: 8 for double precision, 4 for single, 12 when both are computed (0 when BAQ is disabled)
+    uint32 hmm_cell_bytes;
+    // only every n-th forward row is stored (see --baq-checkpoint-interval; 0 stores the full matrices)
+    uint32 checkpoint_interval;
+    // reads with more aligned bases than this skip the HMM (see --baq-max-read-length; 0 means no limit)
+    uint32 baq_max_read_length;
+
+    footprint_model()
+        : hmm_cell_bytes(sizeof(double)),
+          checkpoint_interval(0),
+          baq_max_read_length(0)
+    { }
+};
+
 struct alignment_file
 {
 private:
@@ -51,6 +68,12 @@ private:
     std::string header_text;
 
     bam1_t *data;
+    // set when data holds a record that was read but didn't fit in the previous batch
+    bool pending_read;
+
+    // optional uncompressed copy of every record read, see spill_to()
+    const char *spill_fname;
+    htsFile *spill_fp;
 
     // map read group identifiers in tag data to read group names from the header
     // the read group name is either taken from the platform unit string if present, or else it's just the identifier itself
@@ -64,11 +87,28 @@ public:
 
     bool init(void);
 
-    bool next_batch(alignment_batch_host *batch, uint32 data_mask, reference_file_handle *reference, const uint32 batch_size = 100000);
+    // write an uncompressed BAM copy of the input to fname while reading it
+    // this lets a second pass over the data skip BGZF decompression; must be called before init()
+    void spill_to(const char *fname);
+
+    // the htslib header for the input file
+    const bam_hdr_t *get_bam_header(void) const
+    {
+        return bam_header;
+    }
+
+    // loads up to batch_size reads; if max_footprint is nonzero, the batch is also closed before its
+    // working memory, estimated according to model, exceeds max_footprint bytes (a batch always holds at least one read)
+    bool next_batch(alignment_batch_host *batch, uint32 data_mask, reference_file_handle *reference,
+                    const uint32 batch_size = 100000, const uint64 max_footprint = 0,
+                    const footprint_model& model = footprint_model());
     const char *get_sequence_name(uint32 id);
 
     // returns a percentage of file read (range 0.0 to 1.0)
     float progress(void);
+
+private:
+    void close_spill(void);
 };
 
 } // namespace firepony
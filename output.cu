@@ -60,6 +60,11 @@ void output_printf(const char *fmt, ...)
     va_end(args);
 }
 
+void output_write(const char *data, size_t len)
+{
+    fwrite(data, 1, len, output_fp);
+}
+
 static int last_progress_bar_len = -1;
 
 void output_progress_bar(float progress, uint64_t batch_counter, std::time_t start)
@@ -36,6 +36,7 @@ namespace firepony {
 
 bool output_open_file(const char *fname);
 void output_printf(const char *fmt, ...);
+void output_write(const char *data, size_t len);
 void output_progress_bar(float progress, uint64 batch_counter, std::time_t time);
 
 } // namespace firepony
@@ -45,6 +45,7 @@ make VERBOSE=1 %{?_smp_mflags}
 %files
 /usr/bin/firepony
 /usr/bin/firepony-loader
+/usr/bin/firepony-export
 
 %changelog
 * Wed Nov 25 2015 Nuno Subtil <subtil at gmail.com> - 1.1.1
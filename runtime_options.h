@@ -34,6 +34,13 @@
 
 namespace firepony {
 
+// BAQ HMM execution strategy
+typedef enum {
+    baq_hmm_auto,   // fused on the host, split-phase on CUDA
+    baq_hmm_fused,  // all HMM phases for a read in one pass
+    baq_hmm_split,  // a separate pass over all reads for each HMM phase
+} baq_hmm_mode;
+
 struct runtime_options
 {
     // file names for reference, SNP database, input and output files
@@ -41,6 +48,15 @@ struct runtime_options
     const char *snp_database;
     const char *input;
     const char *output;
+    // optional binary copy of the recalibration tables (see device/recalibration_table_file.h)
+    const char *binary_output;
+    // binary recalibration tables to apply instead of computing them from the input
+    const char *apply_table;
+    // BAM file to write the input to with recalibrated base qualities
+    const char *recalibrated_output;
+
+    // number of BGZF compression threads used when writing recalibrated_output
+    uint32 output_threads;
 
     // whether to attempt to load either the reference or SNP database via mmap
     bool reference_use_mmap;
@@ -49,6 +65,14 @@ struct runtime_options
     // the batch size to use
     uint32 batch_size;
 
+    // reads with fewer bases than this are filtered out
+    // (0 means no minimum)
+    uint32 min_read_length;
+
+    // working memory budget for each compute pipeline in bytes; batches are closed early to stay under it
+    // (0 means no limit)
+    uint64 max_memory;
+
     // enable debugging
     bool debug;
     // disable rounding on the output tables
@@ -68,6 +92,22 @@ struct runtime_options
     // verbose mode
     bool verbose;
 
+    // run the BAQ HMM in single precision
+    bool baq_single_precision;
+    // compare single-precision BAQ against double precision on a sample of reads from each batch
+    bool baq_validate_precision;
+    // store only every n-th row of the BAQ forward matrix and recompute the rest during the backward pass
+    // (0 means store the full forward and backward matrices)
+    uint32 baq_checkpoint_interval;
+    // fused or split-phase BAQ HMM
+    baq_hmm_mode baq_hmm;
+    // reads with more than this many aligned bases skip the BAQ HMM and keep their original qualities
+    // (0 means no limit)
+    uint32 baq_max_read_length;
+
+    // match GATK4 BaseRecalibrator defaults (no BAQ)
+    bool gatk4;
+
     void disable_all_backends(void)
     {
         enable_cuda = false;
@@ -80,10 +120,17 @@ struct runtime_options
         snp_database = nullptr;
         input = nullptr;
         output = nullptr;
+        binary_output = nullptr;
+        apply_table = nullptr;
+        recalibrated_output = nullptr;
+
+        output_threads = 4;
 
         reference_use_mmap = true;
         snp_database_use_mmap = true;
         batch_size = uint32(-1);
+        min_read_length = 0;
+        max_memory = 0;
 
         debug = false;
         disable_output_rounding = false;
@@ -96,6 +143,14 @@ struct runtime_options
         try_mmap = false;
 
         verbose = false;
+
+        baq_single_precision = false;
+        baq_validate_precision = false;
+        baq_checkpoint_interval = 0;
+        baq_hmm = baq_hmm_auto;
+        baq_max_read_length = 0;
+
+        gatk4 = false;
     }
 };
 
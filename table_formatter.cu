@@ -29,6 +29,9 @@
 #include "output.h"
 #include "device/util.h"
 
+#include <cmath>
+#include <string.h>
+
 namespace firepony {
 
 // adds a column to the table
@@ -37,6 +40,7 @@ void table_formatter::add_column(const std::string& name, output_format fmt, out
     column_names.push_back(std::string(name));
     column_formats.push_back(fmt);
     column_widths.push_back(strlen(name.c_str()));
+    column_ranges.push_back(column_range());
 
     if (alignment == ALIGNMENT_DEFAULT)
     {
@@ -73,161 +77,298 @@ void table_formatter::start_row(void)
 // signals the end of the current row
 void table_formatter::end_row(void)
 {
-    if (!preprocess)
-    {
-        output_printf("\n");
-    }
+    assert(col_idx == num_columns);
 }
 
+// number of rows formatted by each parallel work item
+static constexpr uint32 ROWS_PER_CHUNK = 4096;
+
 // signals the end of the table
-// during preprocessing, this initiates the output pass and triggers header output
+// this computes the column widths, formats all rows and writes out the table
 void table_formatter::end_table(void)
 {
-    if (preprocess)
+    char buf[256];
+    std::string header;
+
+    // compute final column widths from the value ranges
+    for(uint32 i = 0; i < num_columns; i++)
     {
-        preprocess = false;
+        const column_range& r = column_ranges[i];
+        uint32 w = max(column_widths[i], r.max_text_len);
 
-        // print the table header data
-        output_printf("#:GATKTable:%d:%d:", num_columns, num_rows);
-        for(uint32 i = 0; i < num_columns; i++)
+        if (r.has_uint)
         {
-            switch(column_formats[i])
-            {
-            case FMT_STRING:
-            case FMT_CHAR:
-                output_printf("%%s:");
-                break;
-
-            case FMT_UINT64:
-                output_printf("%%d:");
-                break;
-
-            case FMT_FLOAT_2:
-                if (command_line_options.disable_output_rounding)
-                {
-                    output_printf("%%.64f:");
-                } else {
-                    output_printf("%%.2f:");
-                }
-
-                break;
-
-            case FMT_FLOAT_4:
-                if (command_line_options.disable_output_rounding)
-                {
-                    output_printf("%%.64f:");
-                } else {
-                    output_printf("%%.4f:");
-                }
-
-                break;
-            }
+            w = max(w, uint32(snprintf(buf, sizeof(buf), "%lu", r.max_uint)));
         }
-        output_printf(";\n");
 
-        output_printf("#:GATKTable:%s:%s\n", table_name.c_str(), description.c_str());
-
-        for(uint32 i = 0; i < num_columns; i++)
+        if (r.has_int)
         {
-            char fmt_string[256];
+            w = max(w, uint32(snprintf(buf, sizeof(buf), "%ld", r.min_int)));
+            w = max(w, uint32(snprintf(buf, sizeof(buf), "%ld", r.max_int)));
+        }
 
-            snprintf(fmt_string, sizeof(fmt_string), "%%%ds", (header_alignments[i] == ALIGNMENT_RIGHT ? 1 : -1) * column_widths[i]);
-            output_printf(fmt_string, column_names[i].c_str());
-            if (i == num_columns - 1)
-            {
-                output_printf("\n");
-            } else {
-                output_printf("  ");
-            }
+        if (r.has_float)
+        {
+            // the width of a formatted value only grows with its magnitude, so the extremes bound the column
+            w = max(w, min(uint32(snprintf(buf, sizeof(buf), float_format(i), r.min_float)), uint32(sizeof(buf) - 1)));
+            w = max(w, min(uint32(snprintf(buf, sizeof(buf), float_format(i), r.max_float)), uint32(sizeof(buf) - 1)));
         }
-    } else {
-        output_printf("\n");
+
+        column_widths[i] = w;
     }
-}
 
-template <>
-void table_formatter::data(std::string val)
-{
-    if (preprocess)
+    // table header data
+    snprintf(buf, sizeof(buf), "#:GATKTable:%d:%d:", num_columns, num_rows);
+    header += buf;
+
+    for(uint32 i = 0; i < num_columns; i++)
     {
-        // track column widths prior to output
-        column_widths[col_idx] = max(size_t(column_widths[col_idx]), strlen(val.c_str()));
-    } else {
-        // output the column with the correct width
-        char fmt_string[256];
+        switch(column_formats[i])
+        {
+        case FMT_STRING:
+        case FMT_CHAR:
+            header += "%s:";
+            break;
 
-        snprintf(fmt_string, sizeof(fmt_string), "%%%ds", (column_alignments[col_idx] == ALIGNMENT_RIGHT ? 1 : -1) * column_widths[col_idx]);
-        output_printf(fmt_string, val.c_str());
+        case FMT_UINT64:
+            header += "%d:";
+            break;
 
-        if (col_idx < num_columns - 1)
-        {
-            output_printf("  ");
+        case FMT_FLOAT_2:
+        case FMT_FLOAT_4:
+            header += float_format(i);
+            header += ":";
+            break;
         }
     }
+    header += ";\n";
 
-    col_idx++;
+    header += "#:GATKTable:" + table_name + ":" + description + "\n";
+
+    for(uint32 i = 0; i < num_columns; i++)
+    {
+        snprintf(buf, sizeof(buf), "%*s", (header_alignments[i] == ALIGNMENT_RIGHT ? 1 : -1) * int(column_widths[i]), column_names[i].c_str());
+        header += buf;
+        header += (i == num_columns - 1 ? "\n" : "  ");
+    }
+
+    output_write(header.data(), header.size());
+
+    // format the rows in parallel, in contiguous chunks so the output order is preserved
+    const uint32 num_chunks = (num_rows + ROWS_PER_CHUNK - 1) / ROWS_PER_CHUNK;
+    std::vector<std::string> chunks(num_chunks);
+
+    #pragma omp parallel for schedule(dynamic) if (num_chunks > 1)
+    for(int32 c = 0; c < int32(num_chunks); c++)
+    {
+        const uint32 row_start = c * ROWS_PER_CHUNK;
+        const uint32 row_end = min(row_start + ROWS_PER_CHUNK, num_rows);
+        format_rows(chunks[c], row_start, row_end);
+    }
+
+    for(const auto& chunk : chunks)
+    {
+        output_write(chunk.data(), chunk.size());
+    }
+
+    output_write("\n", 1);
 }
 
-// process a data element
-template <typename T>
-void table_formatter::data(T val)
+// returns the printf format for a floating point column
+const char *table_formatter::float_format(uint32 col) const
 {
-    char data[256];
-    const char *data_fmt_string;
+    if (command_line_options.disable_output_rounding)
+    {
+        return "%.64f";
+    }
 
-    switch(column_formats[col_idx])
+    return (column_formats[col] == FMT_FLOAT_2 ? "%.2f" : "%.4f");
+}
+
+// formats a cell without padding, returns the number of characters written
+uint32 table_formatter::format_cell(char *out, size_t out_size, const cell& c, uint32 col) const
+{
+    int len;
+
+    switch(c.type)
     {
-    case FMT_CHAR:
-        data_fmt_string = "%c";
+    case cell::CELL_STRING:
+        len = min(size_t(c.len), out_size - 1);
+        memcpy(out, &string_data[c.value.u], len);
+        out[len] = 0;
+        return len;
+
+    case cell::CELL_CHAR:
+        len = snprintf(out, out_size, "%c", char(c.value.u));
         break;
 
-    case FMT_UINT64:
-        data_fmt_string = "%lu";
+    case cell::CELL_UINT64:
+        len = snprintf(out, out_size, "%lu", c.value.u);
         break;
 
-    case FMT_FLOAT_2:
-        if (command_line_options.disable_output_rounding)
-        {
-            data_fmt_string = "%.64f";
-        } else {
-            data_fmt_string = "%.2f";
-            val = round_n(val, 2);
-        }
-
+    case cell::CELL_INT:
+        len = snprintf(out, out_size, "%ld", c.value.i);
         break;
 
-    case FMT_FLOAT_4:
-        if (command_line_options.disable_output_rounding)
-        {
-            data_fmt_string = "%.64f";
-        } else {
-            data_fmt_string = "%.4f";
-            val = round_n(val, 4);
-        }
-
+    case cell::CELL_FLOAT:
+        len = snprintf(out, out_size, float_format(col), c.value.f);
         break;
 
     default:
         assert(!"can't happen");
-        return;
+        return 0;
+    }
+
+    // snprintf returns the untruncated length
+    return min(uint32(len), uint32(out_size - 1));
+}
+
+// formats a range of rows into a buffer, padding each column to its width
+void table_formatter::format_rows(std::string& out, uint32 row_start, uint32 row_end) const
+{
+    char text[256];
+
+    for(uint32 row = row_start; row < row_end; row++)
+    {
+        for(uint32 col = 0; col < num_columns; col++)
+        {
+            const cell& c = cells[row * num_columns + col];
+            const uint32 len = format_cell(text, sizeof(text), c, col);
+            const uint32 pad = (column_widths[col] > len ? column_widths[col] - len : 0);
+
+            if (column_alignments[col] == ALIGNMENT_RIGHT)
+            {
+                out.append(pad, ' ');
+                out.append(text, len);
+            } else {
+                out.append(text, len);
+                out.append(pad, ' ');
+            }
+
+            if (col < num_columns - 1)
+            {
+                out.append("  ");
+            }
+        }
+
+        out.append("\n");
     }
+}
+
+table_formatter::cell& table_formatter::next_cell(uint32 type)
+{
+    assert(col_idx < num_columns);
 
-    snprintf(data, sizeof(data), data_fmt_string, val);
+    cells.push_back(cell());
+    cell& c = cells.back();
+    c.type = type;
+    c.len = 0;
 
-    this->data(std::string(data));
+    col_idx++;
+    return c;
+}
+
+void table_formatter::data(const char *val)
+{
+    const uint32 len = strlen(val);
+    column_range& r = column_ranges[col_idx];
+    r.max_text_len = max(r.max_text_len, len);
+
+    cell& c = next_cell(cell::CELL_STRING);
+    c.value.u = string_data.size();
+    c.len = len;
+
+    string_data.insert(string_data.end(), val, val + len);
 }
 
-template void table_formatter::data<uint64>(uint64 val);
-template void table_formatter::data<float>(float val);
-template void table_formatter::data<double>(double val);
-template void table_formatter::data<std::string>(std::string val);
-template void table_formatter::data<char>(char val);
+void table_formatter::data(const std::string& val)
+{
+    data(val.c_str());
+}
+
+void table_formatter::data(char val)
+{
+    column_range& r = column_ranges[col_idx];
+    r.max_text_len = max(r.max_text_len, 1u);
+
+    cell& c = next_cell(cell::CELL_CHAR);
+    c.value.u = uint8(val);
+}
+
+void table_formatter::data(uint64 val)
+{
+    column_range& r = column_ranges[col_idx];
+    r.max_uint = (r.has_uint ? max(r.max_uint, val) : val);
+    r.has_uint = true;
+
+    cell& c = next_cell(cell::CELL_UINT64);
+    c.value.u = val;
+}
 
 void table_formatter::data_int_as_string(int val)
 {
-    char buf[256];
-    snprintf(buf, sizeof(buf), "%d", val);
-    data(std::string(buf));
+    column_range& r = column_ranges[col_idx];
+    r.min_int = (r.has_int ? min(r.min_int, int64(val)) : int64(val));
+    r.max_int = (r.has_int ? max(r.max_int, int64(val)) : int64(val));
+    r.has_int = true;
+
+    cell& c = next_cell(cell::CELL_INT);
+    c.value.i = val;
+}
+
+// process a floating point data element that has already been rounded for output
+void table_formatter::push_float(double val)
+{
+    column_range& r = column_ranges[col_idx];
+
+    if (std::isfinite(val))
+    {
+        if (!r.has_float)
+        {
+            r.min_float = val;
+            r.max_float = val;
+            r.has_float = true;
+        } else {
+            // -0 formats with a sign, so prefer it as the minimum
+            if (val < r.min_float || (val == r.min_float && std::signbit(val)))
+                r.min_float = val;
+
+            if (val > r.max_float)
+                r.max_float = val;
+        }
+    } else {
+        // inf and nan don't fit in a numeric range, measure them directly
+        char buf[256];
+        r.max_text_len = max(r.max_text_len, uint32(snprintf(buf, sizeof(buf), float_format(col_idx), val)));
+    }
+
+    cell& c = next_cell(cell::CELL_FLOAT);
+    c.value.f = val;
+}
+
+void table_formatter::data(double val)
+{
+    assert(column_formats[col_idx] == FMT_FLOAT_2 || column_formats[col_idx] == FMT_FLOAT_4);
+
+    if (!command_line_options.disable_output_rounding)
+    {
+        val = round_n(val, column_formats[col_idx] == FMT_FLOAT_2 ? 2 : 4);
+    }
+
+    push_float(val);
+}
+
+void table_formatter::data(float val)
+{
+    assert(column_formats[col_idx] == FMT_FLOAT_2 || column_formats[col_idx] == FMT_FLOAT_4);
+
+    // note: rounding happens in double precision, but the result is kept in single precision
+    if (!command_line_options.disable_output_rounding)
+    {
+        val = round_n(val, column_formats[col_idx] == FMT_FLOAT_2 ? 2 : 4);
+    }
+
+    push_float(val);
 }
 
 } // namespace firepony
@@ -71,19 +71,61 @@ struct table_formatter
     std::vector<output_alignment> column_alignments;
     std::vector<output_alignment> header_alignments;
 
-    // describes the current state of the formatter object
-    // output happens in two passes: during the first pass,
-    // we gather size information for each column, then use that
-    // during the second pass to properly pad each column while outputting
+    // a single table cell
+    // cells are stored unformatted while the table is built and rendered once, when the table ends
+    struct cell
+    {
+        typedef enum {
+            CELL_STRING,    // offset into string_data in value.u, length in len
+            CELL_CHAR,
+            CELL_UINT64,
+            CELL_INT,
+            CELL_FLOAT,     // already rounded for output
+        } cell_type;
+
+        uint32 type;
+        uint32 len;
+
+        union {
+            uint64 u;
+            int64 i;
+            double f;
+        } value;
+    };
+
+    // range of the values seen in each column
+    // column widths are derived from these instead of formatting every cell ahead of time
+    struct column_range
+    {
+        uint32 max_text_len;    // longest string, char or non-finite value
+
+        bool has_uint;
+        uint64 max_uint;
+
+        bool has_int;
+        int64 min_int;
+        int64 max_int;
+
+        bool has_float;
+        double min_float;
+        double max_float;
+    };
+
+    std::vector<column_range> column_ranges;
+
+    // cell storage, num_columns cells per row
+    std::vector<cell> cells;
+    // backing storage for string cells
+    std::vector<char> string_data;
+
     uint32 col_idx;     // current column index
-    bool preprocess;    // determines which output pass we're in
 
     table_formatter(const std::string& table_name, const std::string& description)
-        : table_name(table_name), description(description), num_columns(0), num_rows(0), col_idx(0), preprocess(true)
+        : table_name(table_name), description(description), num_columns(0), num_rows(0), col_idx(0)
     { }
 
     table_formatter(const std::string& table_name)
-        : table_name(table_name), description(""), num_columns(0), num_rows(0), col_idx(0), preprocess(true)
+        : table_name(table_name), description(""), num_columns(0), num_rows(0), col_idx(0)
     { }
 
     // adds a column to the table
@@ -95,15 +137,26 @@ struct table_formatter
     void end_row(void);
 
     // signals the end of the table
-    // during preprocessing, this initiates the output pass and triggers header output
+    // this computes the column widths, formats all rows and writes out the table
     void end_table(void);
 
     // process a data element
-    template <typename T>
-    void data(T val);
-
-    // process an integer data element, converting to string
+    void data(const std::string& val);
+    void data(const char *val);
+    void data(char val);
+    void data(uint64 val);
+    void data(float val);
+    void data(double val);
+
+    // process an integer data element, output as a string
     void data_int_as_string(int val);
+
+private:
+    cell& next_cell(uint32 type);
+    void push_float(double val);
+    const char *float_format(uint32 col) const;
+    uint32 format_cell(char *out, size_t out_size, const cell& c, uint32 col) const;
+    void format_rows(std::string& out, uint32 row_start, uint32 row_end) const;
 };
 
 } // namespace firepony
@@ -85,6 +85,53 @@ struct cigar_op
     }
 };
 
+// read-relative coordinates (read offsets, reference offsets within an alignment window, read windows)
+// these are 16-bit by default, which limits reads to 64 kbp
+// building with FIREPONY_LONG_READS=1 widens them to 32 bits for long-read data
+#ifndef FIREPONY_LONG_READS
+#define FIREPONY_LONG_READS 0
+#endif
+
+#if FIREPONY_LONG_READS
+typedef uint32 read_coord;
+typedef uint2 read_coord2;
+typedef int32 signed_read_coord;
+typedef int2 signed_read_coord2;
+#else
+typedef uint16 read_coord;
+typedef ushort2 read_coord2;
+typedef int16 signed_read_coord;
+typedef short2 signed_read_coord2;
+#endif
+
+// bits reserved for the cycle covariate (sign bit included)
+// 10 bits cover cycles up to +-511; long-read builds need 20 bits for cycles up to +-524287
+#if FIREPONY_LONG_READS
+#define CYCLE_COVARIATE_BITS 20
+#else
+#define CYCLE_COVARIATE_BITS 10
+#endif
+
+// the largest cycle that fits in the cycle covariate key
+// -CYCLE_COVARIATE_MAX would encode as the invalid key pattern, so negative cycles stop one short of it
+#define CYCLE_COVARIATE_MAX ((1 << (CYCLE_COVARIATE_BITS - 1)) - 1)
+
+CUDA_HOST_DEVICE inline read_coord2 make_read_coord2(read_coord x, read_coord y)
+{
+    read_coord2 ret;
+    ret.x = x;
+    ret.y = y;
+    return ret;
+}
+
+CUDA_HOST_DEVICE inline signed_read_coord2 make_signed_read_coord2(signed_read_coord x, signed_read_coord y)
+{
+    signed_read_coord2 ret;
+    ret.x = x;
+    ret.y = y;
+    return ret;
+}
+
 template <target_system system> struct firepony_context;
 
 // shorthand for DNA packed vector/stream types